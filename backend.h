@@ -0,0 +1,62 @@
+// Display backends: display modules chosen while a program runs instead of when it is linked.
+// -----------------------------------------------------------------
+// A backend is a table of the functions of displayfull.h. Every display a backend makes
+// starts with a display structure pointing at its table, followed by whatever the backend
+// needs, and the functions of displayfull.h (display.c) call through the table. So one
+// program can draw in a window, on a software framebuffer, into nothing (to time decoding
+// alone) or into a recording of the calls, whichever it picks when it starts.
+
+// The functions of a display module. Headless backends open no window and their run()
+// calls the action until it returns true, without waiting for events or keys.
+typedef struct backend {
+    char *name;
+    bool headless;
+    display *(*newDisplay)(char *name, int width, int height);
+    void (*freeDisplay)(display *d);
+    void (*pause)(display *d, int ms);
+    void (*show)(display *d);
+    void (*line)(display *d, int x0, int y0, int x1, int y1);
+    void (*block)(display *d, int x, int y, int w, int h);
+    void (*colour)(display *d, int rgba);
+    void (*capture)(display *d, unsigned int *pixels);
+    void (*blit)(display *d, unsigned int *pixels);
+    void (*setViewport)(display *d, int x, int y, int level);
+    void (*keepCanvas)(display *d, bool keep);
+    void (*startFrame)(display *d, long frame);
+    void (*run)(display *d, void *data, bool action(display*, void*, const char));
+} backend;
+
+// The start of every display: its backend, title and size
+struct display { const backend *b; char *name; int width, height; };
+
+// Window drawn with SDL (displayfull.c)
+extern const backend windowBackend;
+
+// Software framebuffer, drawing on a canvas in memory (displaycpu.c)
+extern const backend cpuBackend;
+
+// Display that draws nothing (displaycpu.c)
+extern const backend nullBackend;
+
+// Recording of the calls made, see recorder.h (recorder.c)
+extern const backend recordBackend;
+
+// Video frames written on a virtual clock, by the export program (displayexport.c)
+extern const backend exportBackend;
+
+// Frames published through a shared-memory ring, by the shm program (displayshm.c)
+extern const backend shmBackend;
+
+// Create a display on the given backend.
+display *openDisplay(const backend *b, char *name, int width, int height);
+
+// Create a display of the cpu backend for a width*height picture drawn straight at
+// 1/2^shift of its size on each side (shift 0 to 3, see canvas.h): capture and blit
+// then take the (width>>shift)*(height>>shift) pixels of the thumbnail.
+display *openThumbnail(char *name, int width, int height, int shift);
+
+// Make newDisplay create its displays on the given backend.
+void useBackend(const backend *b);
+
+// The backend a display was made by.
+const backend *displayBackend(display *d);
@@ -0,0 +1,371 @@
+// Software canvas, see canvas.h for how to use it.
+#include "canvas.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Most colours a pixel of a scaled canvas keeps of the picture under it. When a pixel
+// is under more colours, its two closest ones are merged into their average.
+#define LAYERS 4
+
+// A colour covering the pixels of a mask, bit y*size+x standing for pixel (x,y) of a cell
+typedef struct layer { unsigned long long mask; unsigned int rgba; } layer;
+
+// The colours of the picture under a pixel of a scaled canvas (with room for one more
+// before merging), and whether the pixel has to be averaged again. A cell without colours
+// is all in the colour of its pixel, and so is a cell whose stamp is not the one of the
+// thumbnail: it has not been painted since the canvas was last cleared or blitted.
+struct cell { int stamp, count; bool stale; layer layers[LAYERS + 1]; };
+
+// The cells of a scaled canvas, the numbers of the stale ones, the stamp of valid cells,
+// and the masks of a whole cell and of its first column
+struct thumbnail { struct cell *cells; int *changed, changes, stamp; unsigned long long all, columns; };
+
+// Mask of the bits from up to to (excluded) of a 64 bit word
+static unsigned long long bits(int from, int to) {
+    unsigned long long below = to == 64 ? ~0ULL : (1ULL << to) - 1;
+    return below & ~((1ULL << from) - 1);
+}
+
+// Create a canvas filled with opaque black, drawing in white.
+canvas *newCanvas(int width, int height) {
+    return newScaledCanvas(width, height, 0);
+}
+
+// Create a canvas for a width*height picture scaled down by 2^shift on each side.
+canvas *newScaledCanvas(int width, int height, int shift) {
+    canvas *c = malloc(sizeof(canvas));
+    c->width = (width + (1 << shift) - 1) >> shift;
+    c->height = (height + (1 << shift) - 1) >> shift;
+    c->rgba = 0xFFFFFFFF;
+    c->pixels = malloc(sizeof(unsigned int) * c->width * c->height);
+    c->shift = shift;
+    c->scaled = NULL;
+    if (shift > 0) {
+        struct thumbnail *t = malloc(sizeof(struct thumbnail));
+        t->cells = calloc(c->width * c->height, sizeof(struct cell));
+        t->stamp = 0;
+        t->changed = malloc(sizeof(int) * c->width * c->height);
+        t->all = bits(0, 1 << (2 * shift));
+        t->columns = 0;
+        for (int y = 0; y < 1 << shift; y++) t->columns |= 1ULL << (y << shift);
+        c->scaled = t;
+    }
+    clearCanvas(c, 0xFF);
+    return c;
+}
+
+// Release the canvas and its pixels.
+void freeCanvas(canvas *c) {
+    if (c->scaled != NULL) {
+        free(c->scaled->cells);
+        free(c->scaled->changed);
+        free(c->scaled);
+    }
+    free(c->pixels);
+    free(c);
+}
+
+// Fill the whole canvas with a colour (the drawing colour is not changed).
+void clearCanvas(canvas *c, unsigned int rgba) {
+    int n = c->width * c->height;
+    for (int i = 0; i < n; i++) c->pixels[i] = rgba;
+    if (c->scaled == NULL) return;
+    c->scaled->stamp++;
+    c->scaled->changes = 0;
+}
+
+// Copy width*height pixels (of the canvas, not of the picture it scales) over the canvas.
+void blitCanvas(canvas *c, unsigned int *pixels) {
+    memcpy(c->pixels, pixels, sizeof(unsigned int) * c->width * c->height);
+    if (c->scaled == NULL) return;
+    c->scaled->stamp++;
+    c->scaled->changes = 0;
+}
+
+// The average of the colours of a cell, weighted by the pixels they cover (rounded)
+static unsigned int average(struct cell *k, int shift) {
+    unsigned int sums[4] = {0, 0, 0, 0}, rgba = 0;
+    for (int i = 0; i < k->count; i++) {
+        unsigned int n = __builtin_popcountll(k->layers[i].mask);
+        for (int ch = 0; ch < 4; ch++) sums[ch] += ((k->layers[i].rgba >> (24 - 8 * ch)) & 0xFF) * n;
+    }
+    for (int ch = 0; ch < 4; ch++) rgba |= ((sums[ch] + (1u << (2 * shift - 1))) >> (2 * shift)) << (24 - 8 * ch);
+    return rgba;
+}
+
+// The pixels of the canvas, averaging the ones of a scaled canvas painted since.
+unsigned int *canvasPixels(canvas *c) {
+    struct thumbnail *t = c->scaled;
+    if (t == NULL) return c->pixels;
+    for (int i = 0; i < t->changes; i++) {
+        struct cell *k = &t->cells[t->changed[i]];
+        if (k->count > 0) c->pixels[t->changed[i]] = average(k, c->shift);
+        k->stale = false;
+    }
+    t->changes = 0;
+    return c->pixels;
+}
+
+// Difference between two colours, summed over their channels
+static int distance(unsigned int a, unsigned int b) {
+    int d = 0;
+    for (int ch = 0; ch < 4; ch++) d += abs((int) ((a >> (8 * ch)) & 0xFF) - (int) ((b >> (8 * ch)) & 0xFF));
+    return d;
+}
+
+// Replace two layers by one covering both in their average colour
+static layer merge(layer a, layer b) {
+    unsigned int na = __builtin_popcountll(a.mask), nb = __builtin_popcountll(b.mask), rgba = 0;
+    for (int ch = 0; ch < 4; ch++) {
+        unsigned int va = (a.rgba >> (8 * ch)) & 0xFF, vb = (b.rgba >> (8 * ch)) & 0xFF;
+        rgba |= ((va * na + vb * nb + (na + nb) / 2) / (na + nb)) << (8 * ch);
+    }
+    return (layer) {a.mask | b.mask, rgba};
+}
+
+// Paint the pixels of the picture in a mask of cell (x,y) of a scaled canvas in the
+// drawing colour, unless they have that colour already. A whole cell just sets its
+// pixel, otherwise the cell is marked stale.
+static void paint(canvas *c, int x, int y, unsigned long long mask) {
+    struct thumbnail *t = c->scaled;
+    int i = y * c->width + x, n = 0;
+    struct cell *k = &t->cells[i];
+    bool found = false;
+    if (k->stamp != t->stamp) k->stamp = t->stamp, k->count = 0, k->stale = false;
+    if (mask == t->all) {
+        k->count = 0;
+        c->pixels[i] = c->rgba;
+        return;
+    }
+    if (k->count == 0) k->layers[k->count++] = (layer) {t->all, c->pixels[i]};
+    for (int j = 0; j < k->count; j++) {
+        layer l = k->layers[j];
+        if (l.rgba == c->rgba) {
+            if ((mask & ~l.mask) == 0) return;
+            l.mask |= mask;
+            found = true;
+        } else l.mask &= ~mask;
+        if (l.mask != 0) k->layers[n++] = l;
+    }
+    if (!found) k->layers[n++] = (layer) {mask, c->rgba};
+    if (n > LAYERS) {
+        int a = 0, b = 1, closest = distance(k->layers[0].rgba, k->layers[1].rgba);
+        for (int p = 0; p < n; p++) {
+            for (int q = p + 1; q < n; q++) {
+                int d = distance(k->layers[p].rgba, k->layers[q].rgba);
+                if (d < closest) a = p, b = q, closest = d;
+            }
+        }
+        k->layers[a] = merge(k->layers[a], k->layers[b]);
+        k->layers[b] = k->layers[--n];
+    }
+    k->count = n;
+    if (!k->stale) {
+        k->stale = true;
+        t->changed[t->changes++] = i;
+    }
+}
+
+// Fill the part of the picture from (left,top) up to (right,bottom) excluded, already
+// clipped to it, on a scaled canvas: cells inside are painted whole, the ones on the
+// edges with the mask of the pixels covered
+static void scaledBlock(canvas *c, long long left, long long top, long long right, long long bottom) {
+    int shift = c->shift, size = 1 << shift;
+    unsigned long long columns = c->scaled->columns;
+    for (long long cy = top >> shift; cy <= (bottom - 1) >> shift; cy++) {
+        int y0 = top > (cy << shift) ? top - (cy << shift) : 0;
+        int y1 = bottom < ((cy + 1) << shift) ? bottom - (cy << shift) : size;
+        unsigned long long rows = bits(y0 * size, y1 * size);
+        for (long long cx = left >> shift; cx <= (right - 1) >> shift; cx++) {
+            int x0 = left > (cx << shift) ? left - (cx << shift) : 0;
+            int x1 = right < ((cx + 1) << shift) ? right - (cx << shift) : size;
+            paint(c, cx, cy, rows & (bits(x0, x1) * columns));
+        }
+    }
+}
+
+// A line drawn with Bresenham's algorithm: its start, lengths along both axes and
+// directions. Every step moves one pixel along the longer axis.
+typedef struct bresenham { long long x0, y0, dx, dy; int sx, sy; } bresenham;
+
+// The part of a line inside a canvas: its first point there, the error term of the
+// algorithm at that point and the number of points inside
+typedef struct walk { long long x, y, error, count; } walk;
+
+// Steps along the shorter axis (of length minor) made in the first k steps along the
+// longer one (of length major): the nearest whole number to k*minor/major, halves rounded
+// down, as the error term of the algorithm does. Computed without overflowing 64 bits.
+static long long minorSteps(unsigned long long major, unsigned long long minor, unsigned long long k) {
+    if (major == 0) return 0;
+    unsigned long long p = minor * k;
+    return p / major + (2 * (p % major) >= major);
+}
+
+// Point of a line after k steps
+static void pointAt(bresenham *l, long long k, long long *x, long long *y) {
+    if (l->dx >= l->dy) {
+        *x = l->x0 + l->sx * k;
+        *y = l->y0 + l->sy * minorSteps(l->dx, l->dy, k);
+    } else {
+        *y = l->y0 + l->sy * k;
+        *x = l->x0 + l->sx * minorSteps(l->dy, l->dx, k);
+    }
+}
+
+// Whether the point of a line after k steps has not reached the area from (0,0) up to
+// (width,height) excluded yet (entering) or has left it on the far side (leaving). Both
+// coordinates move monotonically, so entering holds for the first steps only, leaving for
+// the last ones only, and the steps in between are the points inside.
+static bool outside(bresenham *l, long long k, long long width, long long height, bool entering) {
+    long long x, y;
+    pointAt(l, k, &x, &y);
+    bool xs = (l->sx > 0) == entering ? x < 0 : x >= width;
+    bool ys = (l->sy > 0) == entering ? y < 0 : y >= height;
+    return xs || ys;
+}
+
+// First of the steps 0 to n-1 at which the line is no longer entering the area (entering
+// true) or is leaving it (entering false), n if there is none (binary search)
+static long long firstStep(bresenham *l, long long n, long long width, long long height, bool entering) {
+    long long low = 0, high = n;
+    while (low < high) {
+        long long middle = low + (high - low) / 2;
+        if (outside(l, middle, width, height, entering) != entering) high = middle;
+        else low = middle + 1;
+    }
+    return low;
+}
+
+// Clip the line from (x0,y0) to (x1,y1) to the area from (0,0) up to (width,height)
+// excluded, keeping exactly the pixels the whole line draws there, so long lines cost
+// no more than the part inside. Returns false if no point of the line is inside.
+static bool clipLine(int x0, int y0, int x1, int y1, long long width, long long height, walk *w) {
+    bresenham l = {x0, y0, llabs((long long) x1 - x0), llabs((long long) y1 - y0), x0 < x1 ? 1 : -1, y0 < y1 ? 1 : -1};
+    long long steps = (l.dx > l.dy ? l.dx : l.dy) + 1;
+    long long first = firstStep(&l, steps, width, height, true);
+    long long last = firstStep(&l, steps, width, height, false);
+    if (first >= last) return false;
+    pointAt(&l, first, &w->x, &w->y);
+    // error = dx - dy - dy * (steps along x) + dx * (steps along y), exact modulo 2^64
+    unsigned long long sx = llabs(w->x - x0), sy = llabs(w->y - y0);
+    w->error = (long long) ((unsigned long long) l.dx - l.dy - l.dy * sx + l.dx * sy);
+    w->count = last - first;
+    return true;
+}
+
+// Draw a line on a scaled canvas. Horizontal and vertical lines are blocks one pixel
+// thick, the pixels of the picture other lines pass through are collected cell by cell
+// (a line never comes back to a cell it has left) and painted
+static void scaledLine(canvas *c, int x0, int y0, int x1, int y1) {
+    int shift = c->shift, size = 1 << shift;
+    long long width = (long long) c->width << shift, height = (long long) c->height << shift;
+    if ((x0 < 0 && x1 < 0) || (y0 < 0 && y1 < 0)) return;
+    if ((x0 >= width && x1 >= width) || (y0 >= height && y1 >= height)) return;
+    if (x0 == x1 || y0 == y1) {
+        long long left = x0 < x1 ? x0 : x1, top = y0 < y1 ? y0 : y1;
+        long long right = (x0 < x1 ? x1 : x0) + 1LL, bottom = (y0 < y1 ? y1 : y0) + 1LL;
+        scaledBlock(c, left < 0 ? 0 : left, top < 0 ? 0 : top, right > width ? width : right, bottom > height ? height : bottom);
+        return;
+    }
+    walk w;
+    if (!clipLine(x0, y0, x1, y1, width, height, &w)) return;
+    long long x = w.x, y = w.y, error = w.error, cx = -1, cy = -1;
+    long long dx = llabs((long long) x1 - x0), dy = -llabs((long long) y1 - y0);
+    int sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1;
+    unsigned long long mask = 0;
+    for (long long n = w.count; n > 0; n--) {
+        if ((x >> shift) != cx || (y >> shift) != cy) {
+            if (mask != 0) paint(c, cx, cy, mask);
+            cx = x >> shift;
+            cy = y >> shift;
+            mask = 0;
+        }
+        mask |= 1ULL << (((y & (size - 1)) << shift) | (x & (size - 1)));
+        long long twice = 2 * error;
+        if (twice >= dy) {
+            error += dy;
+            x += sx;
+        }
+        if (twice <= dx) {
+            error += dx;
+            y += sy;
+        }
+    }
+    if (mask != 0) paint(c, cx, cy, mask);
+}
+
+// Draw a line with both end points on an unscaled canvas. Every point of a line lies in
+// the box of its end points, so the line is certified to stay on the canvas and is stepped
+// through without clipping or bounds checks.
+static void uncheckedLine(canvas *c, int x0, int y0, int x1, int y1) {
+    int dx = abs(x1 - x0), dy = -abs(y1 - y0), error = dx + dy;
+    long sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? c->width : -c->width;
+    unsigned int *p = c->pixels + (long) y0 * c->width + x0, *end = c->pixels + (long) y1 * c->width + x1;
+    while (true) {
+        *p = c->rgba;
+        if (p == end) break;
+        int twice = 2 * error;
+        if (twice >= dy) {
+            error += dy;
+            p += sx;
+        }
+        if (twice <= dx) {
+            error += dx;
+            p += sy;
+        }
+    }
+}
+
+// Draw a line from (x0,y0) to (x1,y1) including both end points (Bresenham).
+// Lines inside the canvas take the unchecked path, of others only the part inside
+// the canvas is stepped through.
+void canvasLine(canvas *c, int x0, int y0, int x1, int y1) {
+    if (c->shift > 0) {
+        scaledLine(c, x0, y0, x1, y1);
+        return;
+    }
+    if (x0 >= 0 && x1 >= 0 && y0 >= 0 && y1 >= 0 && x0 < c->width && x1 < c->width &&
+        y0 < c->height && y1 < c->height) {
+        uncheckedLine(c, x0, y0, x1, y1);
+        return;
+    }
+    if ((x0 < 0 && x1 < 0) || (y0 < 0 && y1 < 0)) return;
+    if ((x0 >= c->width && x1 >= c->width) || (y0 >= c->height && y1 >= c->height)) return;
+    walk w;
+    if (!clipLine(x0, y0, x1, y1, c->width, c->height, &w)) return;
+    long long x = w.x, y = w.y, error = w.error;
+    long long dx = llabs((long long) x1 - x0), dy = -llabs((long long) y1 - y0);
+    int sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1;
+    for (long long n = w.count; n > 0; n--) {
+        c->pixels[y * c->width + x] = c->rgba;
+        long long twice = 2 * error;
+        if (twice >= dy) {
+            error += dy;
+            x += sx;
+        }
+        if (twice <= dx) {
+            error += dx;
+            y += sy;
+        }
+    }
+}
+
+// Fill the rectangle at (x,y) of size (w,h), negative sizes extend left or up.
+void canvasBlock(canvas *c, int x, int y, int w, int h) {
+    long long left = w < 0 ? (long long) x + w : x, top = h < 0 ? (long long) y + h : y;
+    long long right = left + llabs((long long) w), bottom = top + llabs((long long) h);
+    if (left < 0) left = 0;
+    if (top < 0) top = 0;
+    if (right > (long long) c->width << c->shift) right = (long long) c->width << c->shift;
+    if (bottom > (long long) c->height << c->shift) bottom = (long long) c->height << c->shift;
+    if (c->shift > 0) {
+        if (left < right && top < bottom) scaledBlock(c, left, top, right, bottom);
+        return;
+    }
+    for (long long j = top; j < bottom; j++) {
+        unsigned int *row = c->pixels + j * c->width;
+        for (long long i = left; i < right; i++) row[i] = c->rgba;
+    }
+}
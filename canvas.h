@@ -0,0 +1,45 @@
+// Software canvas: an RGBA framebuffer in memory with the same drawing semantics
+// as the SDL display (lines include both end points, blocks are x,y,w,h rectangles).
+// -----------------------------------------------------------------
+// Pixels are packed rgba ints like the ones passed to colour(), stored row by row
+// from the top left corner. Drawing outside the canvas is clipped.
+// A scaled canvas holds a picture at 1/2, 1/4 or 1/8 of its size (thumbnails): lines and
+// blocks are given in the coordinates of the picture, and every pixel of the canvas is
+// the average of the size*size pixels of the picture under it (size = 2^shift). Each
+// pixel keeps the colours of the picture under it as masks of the pixels they cover, so
+// primitives only partly covering a pixel replace just their part of it, and a primitive
+// costs a step per pixel of the canvas it touches rather than per pixel of the picture.
+
+// Colours of the picture under the pixels of a scaled canvas, see canvas.c
+struct thumbnail;
+
+// A canvas of width*height pixels and the colour used for drawing on it, with the
+// colours under its pixels if it is scaled (shift > 0).
+typedef struct canvas { int width, height; unsigned int rgba; unsigned int *pixels;
+                        int shift; struct thumbnail *scaled; } canvas;
+
+// Create a canvas filled with opaque black, drawing in white.
+canvas *newCanvas(int width, int height);
+
+// Create a canvas for a width*height picture scaled down by 2^shift (shift 0 to 3) on
+// each side, filled with opaque black and drawing in white.
+canvas *newScaledCanvas(int width, int height, int shift);
+
+// The pixels of the canvas. Pixels of a scaled canvas are only averaged when asked for
+// here, so read them through this function rather than the pixels field.
+unsigned int *canvasPixels(canvas *c);
+
+// Release the canvas and its pixels.
+void freeCanvas(canvas *c);
+
+// Fill the whole canvas with a colour (the drawing colour is not changed).
+void clearCanvas(canvas *c, unsigned int rgba);
+
+// Copy width*height pixels (of the canvas, not of the picture it scales) over the canvas.
+void blitCanvas(canvas *c, unsigned int *pixels);
+
+// Draw a line from (x0,y0) to (x1,y1) including both end points.
+void canvasLine(canvas *c, int x0, int y0, int x1, int y1);
+
+// Fill the rectangle at (x,y) of size (w,h), negative sizes extend left or up.
+void canvasBlock(canvas *c, int x, int y, int w, int h);
@@ -0,0 +1,67 @@
+// Compiled sketches, see compiled.h for how to use them.
+#include "displayfull.h"
+#include "compiled.h"
+#include <dlfcn.h>
+
+// A loaded compiled sketch and the frame to play next
+struct compiled {
+    void *library;
+    void (*const *frames)(display *d);
+    int count, next;
+};
+
+// Check if file name string is of .so format (a compiled sketch)
+bool isCompiled(char *filename) {
+    int n = strlen(filename);
+    return (n > 3 && strcmp(filename + n - 3, ".so") == 0);
+}
+
+// Load a compiled sketch given the filename, exits with an error if it is not one.
+compiled *loadCompiled(char *filename) {
+    // dlopen only looks in the current directory for paths containing a slash
+    char path[strlen(filename) + 3];
+    sprintf(path, "%s%s", strchr(filename, '/') == NULL ? "./" : "", filename);
+    void *library = dlopen(path, RTLD_NOW);
+    if (library == NULL) {
+        fprintf(stderr, "Error: %s\n", dlerror());
+        exit(1);
+    }
+    compiled *c = malloc(sizeof(compiled));
+    *c = (compiled) {library, dlsym(library, "sketchFrames"), 0, 0};
+    int *count = dlsym(library, "sketchFrameCount");
+    if (c->frames == NULL || count == NULL || *count <= 0) {
+        fprintf(stderr, "Error: %s is not a compiled sketch\n", filename);
+        exit(1);
+    }
+    c->count = *count;
+    return c;
+}
+
+// Unload a compiled sketch.
+void freeCompiled(compiled *c) {
+    dlclose(c->library);
+    free(c);
+}
+
+// Play the next frame of a compiled sketch, returns true if it was the last one
+bool playCompiled(display *d, compiled *c) {
+    startFrame(d, c->next);
+    c->frames[c->next](d);
+    c->next = (c->next + 1) % c->count;
+    return (c->next == 0);
+}
+
+// Play the next frame of a compiled sketch in a loop until escape is pressed
+static bool processCompiled(display *d, void *data, const char pressedKey) {
+    playCompiled(d, (compiled*) data);
+    return (pressedKey == 27);
+}
+
+// Play the frames of a compiled sketch in a 200x200 pixel window given the filename
+void viewCompiled(char *filename) {
+    compiled *c = loadCompiled(filename);
+    display *d = newDisplay(filename, 200, 200);
+    run(d, c, processCompiled);
+    freeDisplay(d);
+    freeCompiled(c);
+}
@@ -0,0 +1,27 @@
+// Compiled sketches: shared objects built from the C source written by sketchc.
+// -----------------------------------------------------------------
+// A compiled sketch exports an array of frame functions (sketchFrames) and their
+// number (sketchFrameCount). Playing it calls one frame function per frame, so no
+// sketch commands are decoded. The viewer must be linked with -rdynamic so that the
+// shared object finds the display functions.
+
+// A loaded compiled sketch and the frame to play next, create it with loadCompiled and
+// free it with freeCompiled.
+struct compiled;
+typedef struct compiled compiled;
+
+// Check if file name string is of .so format (a compiled sketch)
+bool isCompiled(char *filename);
+
+// Load a compiled sketch given the filename, exits with an error if it is not one.
+compiled *loadCompiled(char *filename);
+
+// Unload a compiled sketch.
+void freeCompiled(compiled *c);
+
+// Play the next frame of a compiled sketch on a display, looping back to the first after
+// the last. Returns true if the frame played was the last one.
+bool playCompiled(display *d, compiled *c);
+
+// Play the frames of a compiled sketch in a 200x200 pixel window given the filename
+void viewCompiled(char *filename);
@@ -3,22 +3,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "displayfull.h"
+#include "backend.h"
+#include "sketch.h"
+#include "tools.h"
+#include "skz.h"
+#include "trace.h"
+#include "canvas.h"
 
-// Data structure holding the drawing state
-typedef struct state { int x, y, tx, ty; unsigned char tool; unsigned int data, color;} state;
-
-// Structure containing image width, height and maxval
-typedef struct specs {int width, height, maxval;} specs;
-
-// Operations
-enum { DX = 0, DY = 1, TOOL = 2, // basic
-       DATA = 3 // intermediate
-     };
-
-// Tool Types
-enum { NONE = 0, LINE = 1, // basic
-       BLOCK = 2, COLOUR = 3, TARGETX = 4, TARGETY = 5, // intermediate
-     };
+// Structure containing image width, height, maxval and number of channels (1 for grey, 3 for RGB)
+typedef struct specs {int width, height, maxval, channels;} specs;
 
 // Check if file name string is of .pgm format
 bool isPgm(char *filename) { 
@@ -29,6 +27,12 @@ bool isPgm(char *filename) {
     return (first == '.' && second == 'p' && third == 'g' && fourth == 'm');
 }
 
+// Check if file name string is of .ppm format
+bool isPpm(char *filename) {
+    int n = strlen(filename);
+    return (n > 4 && strcmp(filename + n - 4, ".ppm") == 0);
+}
+
 // Check if file name string is of .sk format
 bool isSk(char *filename) {
     char first = filename[strlen(filename)-3];
@@ -47,98 +51,6 @@ bool isDigit(char c) {
     return (c >= '0' && c <= '9');
 }
 
-// Extract an opcode from a byte (two most significant bits).
-int getOpcode(unsigned char b) {
-    int mostSignificantBits = b >> 6;
-    if (mostSignificantBits == 0) {
-        return DX;
-    }
-    else if (mostSignificantBits == 1) {
-        return DY;
-    }
-    else if (mostSignificantBits == 2) {
-        return TOOL;
-    }
-    else return DATA;
-}
-
-// Extract an operand (-32..31) from the rightmost 6 bits of a byte.
-int getOperand(unsigned char b) {
-    unsigned char fiveOnes = 0x1F;
-    int fiveLSBs = b & fiveOnes;
-    int sixthLSB = 0;
-    if ((b >> 5) & 1) sixthLSB = -32;
-    return fiveLSBs + sixthLSB;
-}
-
-// Draw a vertical line on input matrix according to x, y, tx, ty and color values from state s
-// Only draws vertical lines
-void drawLine(unsigned char **pgmMatrix, state *s, int operand) {
-    if (s->y <= s->ty) {
-        for (int i = s->y; i <= s->ty; i++) {
-            pgmMatrix[i][s->x] = (s->color >> 8) & 255;
-        }
-    } else {
-        for (int i = s->y; i >= s->ty; i--) {
-            pgmMatrix[i][s->x] = (s->color >> 8) & 255;
-        }
-    }
-}
-
-// Draw a block on input matrix according to values from state s
-void drawBlock(unsigned char **pgmMatrix, state *s, int operand) {
-    if (s->tx >= s->x) {
-        for (int i = s->x; i <= s->tx; i++) {
-            if (s->ty >= s->y) {
-                for (int j = s->y; j <= s->ty; j++) {
-                    pgmMatrix[j][i] = (s->color >> 8) & 255;
-                }
-            } else {
-                for (int j = s->y; j >= s->ty; j--) {
-                    pgmMatrix[j][i] = (s->color >> 8) & 255;
-                }            
-            }
-        }
-    } else {
-        for (int i = s->x; i >= s->tx; i--) {
-            if (s->ty >= s->y) {
-                for (int j = s->y; j <= s->ty; j++) {
-                    pgmMatrix[j][i] = (s->color >> 8) & 255;
-                }
-            } else {
-                for (int j = s->y; j >= s->ty; j--) {
-                    pgmMatrix[j][i] = (s->color >> 8) & 255;
-                }            
-            }
-        }
-    }
-}
-
-// Execute a byte of the command sequence.
-void obey(unsigned char **pgmMatrix, state *s, unsigned char op) {
-    int opcode = getOpcode(op);
-    int operand = getOperand(op);
-    int unsignedOperand = op & 63;
-    if (opcode == DX) {
-        s->tx += operand;
-    } else if (opcode == DY) {
-        s->ty += operand;
-        if (s->tool == LINE) drawLine(pgmMatrix, s, operand);
-        else if (s->tool == BLOCK) drawBlock(pgmMatrix, s, operand);
-        s->x = s->tx;
-        s->y = s->ty;
-    } else if (opcode == TOOL) {
-        if (operand == COLOUR) s->color = s->data;
-        else if (operand == TARGETX) s->tx = s->data;
-        else if (operand == TARGETY) s->ty = s->data;
-        else s->tool = operand;
-        s->data = 0;
-    } else if (opcode == DATA) {
-        s->data = s->data << 6;
-        s->data = s->data | unsignedOperand;
-    }
-}
-
 // Returns integer converted from string (assumes string contains only digits)
 // Number starting with 0 does NOT mean hexadecimal, considered as valid decimal input
 int decimalStringToInt(char *inputStr) {
@@ -186,26 +98,28 @@ unsigned char convertColor(int color, int maxval) {
     return (color * 255 / maxval);
 }
 
-// Writes commands to set the color to a grayscale value (0 to 255), requires 7 commands
-void setColor(FILE *skFile, unsigned char color) {
-    // All other color channels should be equal to grayscale color value
-    unsigned long red = (long) color << 24;
-    unsigned long rgbaColor = 255 + (color << 8) + (color << 16) + red;
-    // Set opcode to DATA
-    unsigned char opcode = 128 + 64;
-    unsigned char operand = 0;
-    // If color is 0 just set alpha channel to FF
-    if (color == 0) {
-        fputc(opcode+3, skFile);
-        fputc(255, skFile);
-    } else {
-        fputc(opcode+((rgbaColor >> 30) & 3), skFile);
-        for (int i = 0; i < 5; i++) {
-            operand = (rgbaColor >> (24-(i*6))) & 63;
-            fputc(opcode+operand, skFile);
-        }
-    }
-    fputc(128+3, skFile);   
+// Pack red, green and blue values (0 to 255) into an opaque RGBA colour
+unsigned int rgba(int red, int green, int blue) {
+    return ((unsigned int) red << 24) | (green << 16) | (blue << 8) | 255;
+}
+
+// RGBA colour of a grayscale value (0 to 255)
+unsigned int grey(int value) {
+    return rgba(value, value, value);
+}
+
+// Writes DATA commands building up value followed by a TOOL command with the given operand,
+// a value of 0 needs no DATA commands since the data field is 0 after any TOOL command
+void writeTool(FILE *skFile, int tool, unsigned int value) {
+    int chunks = 0;
+    for (unsigned int v = value; v != 0; v = v >> 6) chunks++;
+    for (int i = chunks - 1; i >= 0; i--) fputc(128 + 64 + ((value >> (6*i)) & 63), skFile);
+    fputc(128 + tool, skFile);
+}
+
+// Writes commands to set the color to an RGBA value, requires 7 commands (3 for black)
+void setColor(FILE *skFile, unsigned int color) {
+    writeTool(skFile, COLOUR, color);
 }
 
 // Writes a DY command with char value (-32 to 31) as operand
@@ -243,14 +157,32 @@ void freeMatrix(unsigned char **pointerToMatrix) {
     free(pointerToMatrix);
 }
 
-// Extract specs from file
+// Create an empty image of RGBA colours, accessed with image[x][y] like a matrix
+unsigned int **allocateImage(int width, int height) {
+    unsigned int *data = malloc(sizeof(unsigned int) * width * height);
+    unsigned int **pointerArray = malloc(sizeof(unsigned int*) * width);
+    for (int i = 0; i < width; i++) {
+        pointerArray[i] = data + ((long) i * height);
+    }
+    return pointerArray;
+}
+
+// Free an image created by allocateImage
+void freeImage(unsigned int **image) {
+    free(image[0]);
+    free(image);
+}
+
+// Extract specs from file, the number of channels is 1 for .pgm (P5) and 3 for .ppm (P6) files
 specs getSpecs(FILE *pgmFile) {
     specs outputSpecs;
     // Check that first characters correspond to the "magic number"
-    if (fgetc(pgmFile) != 'P' || fgetc(pgmFile) != '5') {
+    int magic = fgetc(pgmFile) == 'P' ? fgetc(pgmFile) : EOF;
+    if (magic != '5' && magic != '6') {
         fprintf(stderr, "Error: \"magic number\" of file doesn't check out!\n");
         exit(1);
     }
+    outputSpecs.channels = magic == '5' ? 1 : 3;
     // Assign width, height and maxval and skip to image data
     char current = '\0';
     current = skipSpace(pgmFile, current);
@@ -259,58 +191,108 @@ specs getSpecs(FILE *pgmFile) {
     outputSpecs.height = posToInt(pgmFile, current);
     current = skipSpace(pgmFile, current);
     outputSpecs.maxval = posToInt(pgmFile, current);
+    if (outputSpecs.maxval < 1 || outputSpecs.maxval > 65535) {
+        fprintf(stderr, "Error: maxval must be between 1 and 65535\n");
+        exit(1);
+    }
     return outputSpecs;
 }
 
-// Take a .pgm file and return a char matrix (width * height) with grayscale color values
-unsigned char **pgmToMatrix(char *filename) {
-    FILE *pgmFile = fopen(filename, "rb");
-    // Extract specs
-    specs pgmSpecs = getSpecs(pgmFile);
-    char current = '\0';
-    current = skipSpace(pgmFile, current);
-    // oneByte is true iff the greyscale value is represented with 1 byte
-    bool oneByte = true;
-    int color = 0;
-    if (pgmSpecs.maxval > 255) {
-        oneByte = false;
-    }
-    // Allocate memory to 2 dimensional array of chars
-    unsigned char **imageMatrix = allocateMatrix(pgmSpecs.width, pgmSpecs.height);
-    // Assign values to matrix (if maxval is not 255 conversion may not be lossless)
-    for (int i = 0; i < pgmSpecs.height; i++) {
-        for (int j = 0; j < pgmSpecs.width; j++) {
-            // Read byte by byte if only 1 byte is used
-            if (oneByte) imageMatrix[j][i] = convertColor(current, pgmSpecs.maxval);
-            else { // Otherwise read two 2 bytes
-                color = current << 8;
-                current = fgetc(pgmFile);
-                color += current;
-                imageMatrix[j][i] = convertColor(color, pgmSpecs.maxval);
-            }
-            current = fgetc(pgmFile);
+// Multiplier and shift that turn v * 255 / maxval into (v * 255 * m) >> shift. With
+// 2^(shift-24) >= maxval and m rounded up, the result is exact for all v * 255 < 2^24.
+typedef struct scaling { unsigned long long m; int shift; } scaling;
+
+// Work out the scaling for a maxval
+scaling newScaling(int maxval) {
+    int bits = 0;
+    while ((1 << bits) < maxval) bits++;
+    int shift = 24 + bits;
+    return (scaling) {((1ULL << shift) + maxval - 1) / maxval, shift};
+}
+
+// Rescale n samples (1 or 2 bytes each, most significant byte first) from 0..maxval to
+// 0..255 with a multiply and shift instead of a division. With SSE2, four samples are
+// widened to 32 bits and multiplied into 64 bit products per step.
+void scaleSamples(unsigned char *samples, int bytes, long n, int maxval, unsigned char *out) {
+    scaling s = newScaling(maxval);
+    long i = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128(), m = _mm_set1_epi32(s.m), shift = _mm_cvtsi32_si128(s.shift);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v;
+        if (bytes == 1) {
+            int four;
+            memcpy(&four, samples + i, 4);
+            v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(four), zero), zero);
+        } else {
+            v = _mm_loadl_epi64((__m128i *) (samples + 2 * i));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            v = _mm_unpacklo_epi16(v, zero);
         }
+        // v * 255, then the products of lanes 0, 2 and of lanes 1, 3
+        v = _mm_sub_epi32(_mm_slli_epi32(v, 8), v);
+        __m128i even = _mm_srl_epi64(_mm_mul_epu32(v, m), shift);
+        __m128i odd = _mm_srl_epi64(_mm_mul_epu32(_mm_srli_epi64(v, 32), m), shift);
+        v = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+        v = _mm_packus_epi16(_mm_packs_epi32(v, zero), zero);
+        int result = _mm_cvtsi128_si32(v);
+        memcpy(out + i, &result, 4);
+    }
+#endif
+    for (; i < n; i++) {
+        unsigned int v = bytes == 1 ? samples[i] : (samples[2 * i] << 8) | samples[2 * i + 1];
+        out[i] = (v * 255 * s.m) >> s.shift;
     }
-    fclose(pgmFile);
-    return imageMatrix;
 }
 
-// Convert provided file to .sk
-void convertPgm(char *filename) {
-    // Generate image matrix
-    unsigned char **imageMatrix = pgmToMatrix(filename);
-    // Get image width and height through getSpecs()
-    FILE *pgmFile = fopen(filename, "rb");
-    specs imageSpecs = getSpecs(pgmFile);
-    fclose(pgmFile);
-    // Open renamed file to write
-    char *renamed = filename;
-    renamed[strlen(filename)-3] = 's';
-    renamed[strlen(filename)-2] = 'k';
-    renamed[strlen(filename)-1] = '\0';
-    FILE *skFile = fopen(renamed, "w+");
-    // Write commands
-    unsigned char currentColor;
+// Read a .pgm (P5) or .ppm (P6) file with 8 or 16 bit samples into an image of RGBA
+// colours, storing its specs. The samples are read in one block and rescaled to 0..255.
+unsigned int **readImage(char *filename, specs *imageSpecs) {
+    FILE *imageFile = fopen(filename, "rb");
+    if (imageFile == NULL) {
+        fprintf(stderr, "Error: cannot open %s\n", filename);
+        exit(1);
+    }
+    *imageSpecs = getSpecs(imageFile);
+    int bytes = imageSpecs->maxval > 255 ? 2 : 1, channels = imageSpecs->channels;
+    long n = (long) imageSpecs->width * imageSpecs->height * channels;
+    unsigned char *samples = calloc(n, bytes), *scaled = malloc(n);
+    if (fread(samples, bytes, n, imageFile) != (size_t) n) {
+        fprintf(stderr, "Warning: %s is shorter than its header says, the rest is black\n", filename);
+    }
+    fclose(imageFile);
+    scaleSamples(samples, bytes, n, imageSpecs->maxval, scaled);
+    unsigned int **image = allocateImage(imageSpecs->width, imageSpecs->height);
+    long i = 0;
+    for (int y = 0; y < imageSpecs->height; y++) {
+        for (int x = 0; x < imageSpecs->width; x++) {
+            if (channels == 1) image[x][y] = grey(scaled[i]);
+            else image[x][y] = rgba(scaled[i], scaled[i+1], scaled[i+2]);
+            i += channels;
+        }
+    }
+    free(samples);
+    free(scaled);
+    return image;
+}
+
+// Quantise a channel value (0 to 255) to the nearest of the given number of evenly
+// spaced levels, a number of levels below 2 keeps the value as it is
+unsigned char quantise(unsigned char grey, int levels) {
+    if (levels < 2 || levels >= 256) return grey;
+    int step = (grey * (levels - 1) + 127) / 255;
+    return step * 255 / (levels - 1);
+}
+
+// Quantise the red, green and blue channels of an RGBA colour
+unsigned int quantiseColour(unsigned int colour, int levels) {
+    return rgba(quantise(colour >> 24, levels), quantise(colour >> 16, levels), quantise(colour >> 8, levels));
+}
+
+// Writes the image column by column, top to bottom, changing colour whenever it differs
+void encodeColumns(FILE *skFile, unsigned int **image, specs imageSpecs) {
+    // Sketches start drawing in white
+    unsigned int currentColor = 0xFFFFFFFF;
     int x = 0, y = 0;
     while (x < imageSpecs.width) {
         // Execute TARGETY command, since no data commands were executed, this sets TY to 0
@@ -325,8 +307,8 @@ void convertPgm(char *filename) {
         fputc(128+1, skFile);
         // Draws x column of sketch file
         while (y < imageSpecs.height) {
-            if (currentColor != imageMatrix[x][y]) {
-                currentColor = imageMatrix[x][y];
+            if (currentColor != image[x][y]) {
+                currentColor = image[x][y];
                 setColor(skFile, currentColor);
             }
             if (imageSpecs.height-1 == y) writeDY(skFile, 0);
@@ -335,76 +317,545 @@ void convertPgm(char *filename) {
         }
         x++;
     }
-    // Close files, free memory
-    fclose(skFile);
-    freeMatrix(imageMatrix);
-    return;
 }
 
-void writePgm(FILE *pgmFile, unsigned char **pgmMatrix) {
-    fprintf(pgmFile, "P5 %d %d %d\n", 200, 200, 255);
-    for (int i = 0; i < 200; i++) {
-        for (int j = 0; j < 200; j++) {
-            fputc(pgmMatrix[i][j], pgmFile);        
-        }    
+// Position and tool of the sketch being written by encodeGrouped
+typedef struct pen { int x, y, tool; } pen;
+
+// Writes commands drawing a vertical line from (x,y0) down to (x,y1), moving there
+// without drawing first. Columns are reached with TARGETX, rows with a DY command
+// if they are close enough or with TARGETY otherwise.
+void writeRun(FILE *skFile, pen *p, int x, int y0, int y1) {
+    if (p->x != x || p->y != y0) {
+        if (p->tool != NONE) writeTool(skFile, NONE, 0);
+        if (p->x != x) writeTool(skFile, TARGETX, x);
+        if (y0 - p->y < -32 || y0 - p->y > 31) {
+            writeTool(skFile, TARGETY, y0);
+            writeDY(skFile, 0);
+        } else writeDY(skFile, y0 - p->y);
+        p->tool = NONE;
     }
+    if (p->tool != LINE) writeTool(skFile, LINE, 0);
+    if (y1 - y0 > 31) {
+        writeTool(skFile, TARGETY, y1);
+        writeDY(skFile, 0);
+    } else writeDY(skFile, y1 - y0);
+    p->x = x;
+    p->y = y1;
+    p->tool = LINE;
 }
 
-// Allocate memory for a drawing state and initialise it
-state *newState() {
-    state *nState = malloc(sizeof(state));
-    nState->x = 0;
-    nState->y = 0;
-    nState->tx = 0;
-    nState->ty = 0;
-    nState->tool = 1;
-    nState->data = 0;
-    nState->color = 0xFFFFFFFF;
-    return nState;
+// A colour of an image, the number of its pixels and its place in the drawing order
+typedef struct swatch { unsigned int colour; long count; int rank; } swatch;
+
+// Order unsigned ints
+int compareColours(const void *a, const void *b) {
+    unsigned int c1 = *(const unsigned int *) a, c2 = *(const unsigned int *) b;
+    return (c1 > c2) - (c1 < c2);
 }
 
-// Release all memory associated with the drawing state
-void freeState(state *s) {
-    free(s);
+// Order swatches from the most to the least frequent colour
+int compareSwatches(const void *a, const void *b) {
+    const swatch *s1 = a, *s2 = b;
+    return (s1->count < s2->count) - (s1->count > s2->count);
 }
 
-// Process pgm matrix according to .sk file
-void processMatrix(char *skFilename, unsigned char **pgmMatrix) {
-    // Initialise all values as 0
-    state *imageState = newState();
-    for (int i = 0; i < 200; i++) {
-        for (int j = 0; j < 200; j++) {
-            pgmMatrix[i][j] = 0;        
-        }    
+// Order swatches by colour
+int compareSwatchColours(const void *a, const void *b) {
+    return compareColours(&((const swatch *) a)->colour, &((const swatch *) b)->colour);
+}
+
+// Compare a colour with the colour of a swatch, to look it up with bsearch
+int findColour(const void *key, const void *element) {
+    return compareColours(key, &((const swatch *) element)->colour);
+}
+
+// A vertical run of pixels from y0 to y1 of column x, drawn with the colour of the given rank
+typedef struct stroke { int rank, x, y0, y1; } stroke;
+
+// Order runs by rank, then column and row
+int compareRuns(const void *a, const void *b) {
+    const stroke *r1 = a, *r2 = b;
+    if (r1->rank != r2->rank) return r1->rank - r2->rank;
+    if (r1->x != r2->x) return r1->x - r2->x;
+    return r1->y0 - r2->y0;
+}
+
+// Writes the image colour by colour: every colour is set once, followed by all of its
+// vertical runs. Colours are drawn from the most to the least frequent one, so a run may
+// be stretched over pixels of colours drawn after it, which paint over it later. The most
+// frequent colour is drawn as one block over the whole image (or not at all if it is black,
+// the colour of an empty sketch, unless cover asks to cover whatever the canvas holds).
+void encodeGrouped(FILE *skFile, unsigned int **image, specs imageSpecs, bool cover) {
+    int width = imageSpecs.width, height = imageSpecs.height;
+    long n = (long) width * height;
+    // Count the colours, then rank them by frequency
+    unsigned int *sorted = malloc(sizeof(unsigned int) * n);
+    memcpy(sorted, image[0], sizeof(unsigned int) * n);
+    qsort(sorted, n, sizeof(unsigned int), compareColours);
+    swatch *colours = malloc(sizeof(swatch) * n);
+    int count = 0;
+    for (long i = 0; i < n; i++) {
+        if (count > 0 && colours[count-1].colour == sorted[i]) colours[count-1].count++;
+        else colours[count++] = (swatch) {sorted[i], 1, 0};
+    }
+    free(sorted);
+    qsort(colours, count, sizeof(swatch), compareSwatches);
+    unsigned int *palette = malloc(sizeof(unsigned int) * count);
+    for (int i = 0; i < count; i++) {
+        colours[i].rank = i;
+        palette[i] = colours[i].colour;
+    }
+    qsort(colours, count, sizeof(swatch), compareSwatchColours);
+    // Find the runs of every column with a stack of the runs still open: a pixel closes
+    // the open runs of colours drawn after its own and extends or opens a run of its colour
+    stroke *runs = malloc(sizeof(stroke) * n), *open = malloc(sizeof(stroke) * (height + 1));
+    long total = 0;
+    for (int x = 0; x < width; x++) {
+        int top = 0;
+        for (int y = 0; y < height; y++) {
+            swatch *found = bsearch(&image[x][y], colours, count, sizeof(swatch), findColour);
+            int rank = found->rank;
+            while (top > 0 && open[top-1].rank > rank) runs[total++] = open[--top];
+            if (rank == 0) continue;
+            if (top > 0 && open[top-1].rank == rank) open[top-1].y1 = y;
+            else open[top++] = (stroke) {rank, x, y, y};
+        }
+        while (top > 0) runs[total++] = open[--top];
+    }
+    free(open);
+    qsort(runs, total, sizeof(stroke), compareRuns);
+    pen p = {0, 0, LINE};
+    if (cover || palette[0] != grey(0)) {
+        setColor(skFile, palette[0]);
+        writeTool(skFile, BLOCK, 0);
+        writeTool(skFile, TARGETX, width);
+        writeTool(skFile, TARGETY, height);
+        writeDY(skFile, 0);
+        p = (pen) {width, height, BLOCK};
+    }
+    for (long i = 0; i < total; i++) {
+        if (i == 0 || runs[i].rank != runs[i-1].rank) setColor(skFile, palette[runs[i].rank]);
+        writeRun(skFile, &p, runs[i].x, runs[i].y0, runs[i].y1);
+    }
+    free(palette);
+    free(runs);
+    free(colours);
+}
+
+// A vertical run of pixels from y0 to y1 of column x that changed to the same colour
+typedef struct change { unsigned int colour; int x, y0, y1; } change;
+
+// Order changes by colour, then column and row
+int compareChanges(const void *a, const void *b) {
+    const change *c1 = a, *c2 = b;
+    if (c1->colour != c2->colour) return c1->colour < c2->colour ? -1 : 1;
+    if (c1->x != c2->x) return c1->x - c2->x;
+    return c1->y0 - c2->y0;
+}
+
+// Writes only the pixels of an image that differ from the previous image of a sequence
+// (drawn on a kept canvas), as vertical runs of one colour, every colour set once.
+// Returns the number of pixels that changed.
+long encodeChanges(FILE *skFile, unsigned int **image, unsigned int **previous, specs imageSpecs) {
+    change *changes = malloc(sizeof(change) * imageSpecs.width * imageSpecs.height);
+    long count = 0, pixels = 0;
+    for (int x = 0; x < imageSpecs.width; x++) {
+        for (int y = 0; y < imageSpecs.height; y++) {
+            if (image[x][y] == previous[x][y]) continue;
+            pixels++;
+            change *last = count > 0 ? &changes[count-1] : NULL;
+            if (last != NULL && last->x == x && last->y1 == y - 1 && last->colour == image[x][y]) last->y1 = y;
+            else changes[count++] = (change) {image[x][y], x, y, y};
+        }
+    }
+    qsort(changes, count, sizeof(change), compareChanges);
+    pen p = {0, 0, LINE};
+    for (long i = 0; i < count; i++) {
+        if (i == 0 || changes[i].colour != changes[i-1].colour) setColor(skFile, changes[i].colour);
+        writeRun(skFile, &p, changes[i].x, changes[i].y0, changes[i].y1);
+    }
+    free(changes);
+    return pixels;
+}
+
+// Writes image i of a sequence of count images as a frame of an animation keeping the
+// canvas between frames: the first image is drawn whole, every later one only where it
+// differs from the previous one, each followed by a pause of the given milliseconds (if
+// any) and ended by NEXTFRAME (the last one by the end of the file). When the animation
+// loops the first image covers the last.
+void encodeFrame(FILE *skFile, int i, int count, unsigned int **image, unsigned int **previous,
+                 specs imageSpecs, int pause) {
+    if (i == 0) {
+        writeTool(skFile, KEEP, 1);
+        encodeGrouped(skFile, image, imageSpecs, true);
+    }
+    else encodeChanges(skFile, image, previous, imageSpecs);
+    if (pause > 0) writeTool(skFile, PAUSE, pause);
+    if (i < count - 1) writeTool(skFile, NEXTFRAME, 0);
+}
+
+// Writes a sequence of images as an animation, see encodeFrame
+void encodeSequence(FILE *skFile, int count, unsigned int **images[count], specs imageSpecs, int pause) {
+    for (int i = 0; i < count; i++) {
+        encodeFrame(skFile, i, count, images[i], i == 0 ? NULL : images[i-1], imageSpecs, pause);
+    }
+}
+
+// A rectangle of the image drawn in one colour, covering x to x+w-1 and y to y+h-1
+typedef struct region { int x, y, w, h; unsigned int colour; } region;
+
+// Growing list of regions
+typedef struct regions { int count, capacity; region *list; } regions;
+
+// Size and peak signal to noise ratio (infinite for an exact image) of an encoded image
+typedef struct quality { long bytes; double psnr; } quality;
+
+// Pick the value of a channel ranging from min to max that keeps every pixel within
+// tolerance, preferring values divisible by large powers of two so regions share colours
+unsigned char regionColour(int min, int max, int tolerance) {
+    int low = max - tolerance < 0 ? 0 : max - tolerance;
+    int high = min + tolerance > 255 ? 255 : min + tolerance;
+    for (int step = 128; step > 1; step = step / 2) {
+        int c = (low + step - 1) / step * step;
+        if (c <= high) return c;
+    }
+    return (min + max) / 2;
+}
+
+// Split a rectangle of the image into quarters (or halves if it is one pixel wide or high)
+// until every channel of every pixel of a part is within tolerance of one colour, adding
+// the parts to out
+void splitRegion(unsigned int **image, region r, int tolerance, regions *out) {
+    int min[3] = {255, 255, 255}, max[3] = {0, 0, 0};
+    for (int x = r.x; x < r.x + r.w; x++) {
+        for (int y = r.y; y < r.y + r.h; y++) {
+            for (int c = 0; c < 3; c++) {
+                int value = (image[x][y] >> (24 - 8 * c)) & 255;
+                if (value < min[c]) min[c] = value;
+                if (value > max[c]) max[c] = value;
+            }
+        }
+    }
+    if (max[0] - min[0] <= 2 * tolerance && max[1] - min[1] <= 2 * tolerance && max[2] - min[2] <= 2 * tolerance) {
+        if (out->count == out->capacity) {
+            out->capacity = out->capacity == 0 ? 256 : out->capacity * 2;
+            out->list = realloc(out->list, sizeof(region) * out->capacity);
+        }
+        r.colour = rgba(regionColour(min[0], max[0], tolerance), regionColour(min[1], max[1], tolerance),
+                        regionColour(min[2], max[2], tolerance));
+        out->list[out->count] = r;
+        out->count++;
+        return;
     }
-    FILE *skFile = fopen(skFilename, "rb");
-    unsigned char command;
-    while (!feof(skFile)) {
-        command = fgetc(skFile);
-        obey(pgmMatrix, imageState, command);
+    int w = r.w > 1 ? r.w / 2 : r.w, h = r.h > 1 ? r.h / 2 : r.h;
+    splitRegion(image, (region) {r.x, r.y, w, h, 0}, tolerance, out);
+    if (w < r.w) splitRegion(image, (region) {r.x + w, r.y, r.w - w, h, 0}, tolerance, out);
+    if (h < r.h) splitRegion(image, (region) {r.x, r.y + h, w, r.h - h, 0}, tolerance, out);
+    if (w < r.w && h < r.h) splitRegion(image, (region) {r.x + w, r.y + h, r.w - w, r.h - h, 0}, tolerance, out);
+}
+
+// Order regions by colour, then column and row
+int compareColumns(const void *a, const void *b) {
+    const region *r1 = a, *r2 = b;
+    if (r1->colour != r2->colour) return r1->colour < r2->colour ? -1 : 1;
+    if (r1->x != r2->x) return r1->x - r2->x;
+    return r1->y - r2->y;
+}
+
+// Order regions by colour, then row and column
+int compareRows(const void *a, const void *b) {
+    const region *r1 = a, *r2 = b;
+    if (r1->colour != r2->colour) return r1->colour < r2->colour ? -1 : 1;
+    if (r1->y != r2->y) return r1->y - r2->y;
+    return r1->x - r2->x;
+}
+
+// Merge regions of the same colour that together form a rectangle, those on top of each
+// other and those next to each other in turn until nothing changes. Leaves the regions
+// ordered by colour, column and row.
+void mergeRegions(regions *rs) {
+    // Stop once merging in both directions in a row changed nothing
+    int pass = 0, unchanged = 0;
+    while (unchanged < 2) {
+        int before = rs->count, n = 0;
+        qsort(rs->list, rs->count, sizeof(region), pass == 0 ? compareColumns : compareRows);
+        for (int i = 0; i < rs->count; i++) {
+            region *r = &rs->list[i], *last = n > 0 ? &rs->list[n-1] : NULL;
+            if (last != NULL && pass == 0 && last->colour == r->colour && last->x == r->x &&
+                last->w == r->w && last->y + last->h == r->y) last->h += r->h;
+            else if (last != NULL && pass == 1 && last->colour == r->colour && last->y == r->y &&
+                last->h == r->h && last->x + last->w == r->x) last->w += r->w;
+            else {
+                rs->list[n] = *r;
+                n++;
+            }
+        }
+        rs->count = n;
+        unchanged = n == before ? unchanged + 1 : 0;
+        pass = 1 - pass;
+    }
+    qsort(rs->list, rs->count, sizeof(region), compareColumns);
+}
+
+// Writes commands drawing a block over a region, moving to its corner without drawing first
+void writeBlock(FILE *skFile, pen *p, region *r) {
+    if (p->x != r->x || p->y != r->y) {
+        if (p->tool != NONE) writeTool(skFile, NONE, 0);
+        if (p->x != r->x) writeTool(skFile, TARGETX, r->x);
+        if (r->y - p->y < -32 || r->y - p->y > 31) {
+            writeTool(skFile, TARGETY, r->y);
+            writeDY(skFile, 0);
+        } else writeDY(skFile, r->y - p->y);
+        p->tool = NONE;
+    }
+    if (p->tool != BLOCK) writeTool(skFile, BLOCK, 0);
+    if (r->w > 31) writeTool(skFile, TARGETX, r->x + r->w);
+    else fputc(r->w, skFile);
+    if (r->h > 31) {
+        writeTool(skFile, TARGETY, r->y + r->h);
+        writeDY(skFile, 0);
+    } else writeDY(skFile, r->h);
+    p->x = r->x + r->w;
+    p->y = r->y + r->h;
+    p->tool = BLOCK;
+}
+
+// Writes the image as blocks of one colour found by splitting it into quarters until
+// every channel of every pixel of a block is within tolerance of its colour (0 keeps the
+// image exact). As in encodeGrouped, every colour is set once and the colour covering the
+// largest area is drawn as one block behind the others. Returns the size and quality reached.
+quality encodeQuadtree(FILE *skFile, unsigned int **image, specs imageSpecs, int tolerance) {
+    long start = ftell(skFile);
+    regions leaves = {0, 0, NULL};
+    splitRegion(image, (region) {0, 0, imageSpecs.width, imageSpecs.height, 0}, tolerance, &leaves);
+    mergeRegions(&leaves);
+    // The regions are ordered by colour, find the colour with the largest area
+    unsigned int background = grey(0);
+    long area = 0, largest = 0;
+    double error = 0;
+    for (int i = 0; i < leaves.count; i++) {
+        region *r = &leaves.list[i];
+        if (i > 0 && r->colour != leaves.list[i-1].colour) area = 0;
+        area += (long) r->w * r->h;
+        if (area > largest) {
+            largest = area;
+            background = r->colour;
+        }
+        for (int x = r->x; x < r->x + r->w; x++) {
+            for (int y = r->y; y < r->y + r->h; y++) {
+                for (int shift = 8; shift <= 24; shift += 8) {
+                    int d = (int) ((image[x][y] >> shift) & 255) - (int) ((r->colour >> shift) & 255);
+                    error += d * d;
+                }
+            }
+        }
+    }
+    pen p = {0, 0, LINE};
+    if (background != grey(0)) {
+        setColor(skFile, background);
+        region all = {0, 0, imageSpecs.width, imageSpecs.height, background};
+        writeBlock(skFile, &p, &all);
+    }
+    for (int i = 0; i < leaves.count; i++) {
+        region *r = &leaves.list[i];
+        if (r->colour == background) continue;
+        if (i == 0 || r->colour != leaves.list[i-1].colour) setColor(skFile, r->colour);
+        writeBlock(skFile, &p, r);
+    }
+    free(leaves.list);
+    double mse = error / (3.0 * imageSpecs.width * imageSpecs.height);
+    return (quality) {ftell(skFile) - start, mse == 0 ? INFINITY : 10 * log10(255.0 * 255.0 / mse)};
+}
+
+// Convert provided .pgm or .ppm file to .sk, grouping runs by colour if grouped is true,
+// quantising channel values to the given number of levels (0 keeps all of them) and, if
+// tolerance is not negative, drawing blocks within that tolerance of the colours. Returns
+// the size of the sketch and the quality of the blocks.
+quality convertPgm(char *filename, bool grouped, int levels, int tolerance) {
+    // Generate image
+    specs imageSpecs;
+    long begin = traceClock();
+    unsigned int **image = readImage(filename, &imageSpecs);
+    for (int x = 0; x < imageSpecs.width; x++) {
+        for (int y = 0; y < imageSpecs.height; y++) {
+            image[x][y] = quantiseColour(image[x][y], levels);
+        }
+    }
+    long pixels = (long) imageSpecs.width * imageSpecs.height;
+    traceSpan("read", begin, 0, pixels);
+    // Open renamed file to write
+    char *renamed = filename;
+    renamed[strlen(filename)-3] = 's';
+    renamed[strlen(filename)-2] = 'k';
+    renamed[strlen(filename)-1] = '\0';
+    FILE *skFile = fopen(renamed, "w+");
+    // Write commands
+    quality result = {0, INFINITY};
+    begin = traceClock();
+    if (tolerance >= 0) result = encodeQuadtree(skFile, image, imageSpecs, tolerance);
+    else if (grouped) encodeGrouped(skFile, image, imageSpecs, false);
+    else encodeColumns(skFile, image, imageSpecs);
+    result.bytes = ftell(skFile);
+    traceSpan("encode", begin, result.bytes, pixels);
+    // Close files, free memory
+    fclose(skFile);
+    freeImage(image);
+    return result;
+}
+
+// Convert a sequence of .pgm or .ppm files of the same size into an animated .sk file
+// drawing only what changes from frame to frame, quantising channel values to the given
+// number of levels (0 keeps all of them) and pausing after every frame. Returns the size
+// of the sketch in bytes. The images are read one at a time, so only the current one and
+// the one before it are in memory however long the sequence is.
+long convertSequence(int count, char *filenames[count], char *output, int levels, int pause) {
+    FILE *skFile = fopen(output, "wb");
+    if (skFile == NULL) {
+        fprintf(stderr, "Error: cannot open %s\n", output);
+        exit(1);
+    }
+    specs imageSpecs, first;
+    unsigned int **previous = NULL;
+    for (int i = 0; i < count; i++) {
+        long begin = traceClock();
+        unsigned int **image = readImage(filenames[i], &imageSpecs);
+        if (i == 0) first = imageSpecs;
+        if (imageSpecs.width != first.width || imageSpecs.height != first.height) {
+            fprintf(stderr, "Error: %s is not the size of %s\n", filenames[i], filenames[0]);
+            exit(1);
+        }
+        for (int x = 0; x < imageSpecs.width; x++) {
+            for (int y = 0; y < imageSpecs.height; y++) {
+                image[x][y] = quantiseColour(image[x][y], levels);
+            }
+        }
+        long pixels = (long) first.width * first.height;
+        traceSpan("read", begin, 0, pixels);
+        begin = traceClock();
+        long start = ftell(skFile);
+        encodeFrame(skFile, i, count, image, previous, first, pause);
+        traceSpan("encode", begin, ftell(skFile) - start, pixels);
+        if (previous != NULL) freeImage(previous);
+        previous = image;
+    }
+    long bytes = ftell(skFile);
+    fclose(skFile);
+    if (previous != NULL) freeImage(previous);
+    return bytes;
+}
+
+// Print size and quality of the encoders on an image for a range of tolerances
+void benchmarkImage(char *name, unsigned int **image, specs imageSpecs) {
+    int tolerances[] = {0, 1, 2, 4, 8, 16, 32};
+    FILE *skFile = tmpfile();
+    encodeGrouped(skFile, image, imageSpecs, false);
+    printf("%-10s %4dx%-4d  grouped: %8ld bytes\n", name, imageSpecs.width, imageSpecs.height, ftell(skFile));
+    for (int i = 0; i < 7; i++) {
+        rewind(skFile);
+        clock_t begin = clock();
+        quality q = encodeQuadtree(skFile, image, imageSpecs, tolerances[i]);
+        double ms = (clock() - begin) * 1000.0 / CLOCKS_PER_SEC;
+        printf("%-10s tolerance %2d: %8ld bytes  %5.1f dB  %6.1f ms\n", name, tolerances[i], q.bytes, q.psnr, ms);
     }
-    freeState(imageState);
     fclose(skFile);
 }
 
-// Convert .sk file to .pgm
-void convertSk(char *filename) {
+void writePgm(FILE *pgmFile, unsigned char **pgmMatrix, int size) {
+    fprintf(pgmFile, "P5 %d %d %d\n", size, size, 255);
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            fputc(pgmMatrix[i][j], pgmFile);        
+        }    
+    }
+}
+
+// Process pgm matrix according to .sk (or .skz) file, decoded like the viewer does on a
+// software framebuffer. The canvas is kept, so every frame is drawn over the ones before it.
+// With a shift the picture is drawn straight at 1/2^shift of its size (a thumbnail of
+// 200>>shift pixels square), every pixel the average of the ones under it.
+void processMatrix(char *skFilename, unsigned char **pgmMatrix, int shift) {
+    display *d = openThumbnail(skFilename, 200, 200, shift);
+    keepCanvas(d, true);
+    state *s = newState();
+    do processSketch(d, s, 0);
+    while (s->start != 0);
+    int size = 200 >> shift;
+    unsigned int *pixels = malloc(sizeof(unsigned int) * size * size);
+    capture(d, pixels);
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            pgmMatrix[i][j] = (pixels[i * size + j] >> 8) & 255;
+        }
+    }
+    free(pixels);
+    freeState(s);
+    freeDisplay(d);
+}
+
+// Convert .sk (or .skz) file to .pgm, scaled down by 2^shift on each side
+void convertSk(char *filename, int shift) {
     // .sk files don't hold information about dimensions, default to 200x200
-    unsigned char **pgmMatrix = allocateMatrix(200, 200);
-    int len = strlen(filename);
-    char convertedFilename[len+2];
-    strcpy(convertedFilename, filename);
-    convertedFilename[len-2] = 'p';
-    convertedFilename[len-1] = 'g';
-    convertedFilename[len] = 'm';
-    convertedFilename[len+1] = '\0';
+    int size = 200 >> shift;
+    unsigned char **pgmMatrix = allocateMatrix(size, size);
+    int len = strrchr(filename, '.') - filename;
+    char convertedFilename[len+5];
+    strncpy(convertedFilename, filename, len);
+    strcpy(convertedFilename + len, ".pgm");
     FILE *pgmFile = fopen(convertedFilename, "w+");
-    processMatrix(filename, pgmMatrix);
-    writePgm(pgmFile, pgmMatrix);
+    processMatrix(filename, pgmMatrix, shift);
+    long begin = traceClock();
+    writePgm(pgmFile, pgmMatrix, size);
     fclose(pgmFile);
+    traceSpan("write", begin, 0, size * size);
     freeMatrix(pgmMatrix);
 }
 
+// Time drawing a sketch at full size and straight as 1/4 and 1/8 thumbnails
+void benchmarkThumbnails(char *name, unsigned int **image, specs imageSpecs) {
+    FILE *skFile = fopen("converter.tmp", "wb");
+    encodeQuadtree(skFile, image, imageSpecs, 8);
+    fclose(skFile);
+    unsigned char **matrix = allocateMatrix(200, 200);
+    double full = 0;
+    for (int shift = 0; shift <= 3; shift += shift == 0 ? 2 : 1) {
+        clock_t begin = clock();
+        for (int i = 0; i < 100; i++) processMatrix("converter.tmp", matrix, shift);
+        double ms = (clock() - begin) * 1000.0 / CLOCKS_PER_SEC / 100;
+        if (shift == 0) full = ms;
+        printf("%-10s drawn at 1/%d: %6.2f ms  %5.1fx\n", name, 1 << shift, ms, full / ms);
+    }
+    freeMatrix(matrix);
+    remove("converter.tmp");
+}
+
+// Rate-distortion benchmark of the quadtree encoder on the example images (with the time
+// taken to draw thumbnails of them) and a large synthetic image of smooth shading with
+// fine texture
+void benchmark() {
+    char *files[] = {"bands.pgm", "fractal.pgm"};
+    for (int i = 0; i < 2; i++) {
+        FILE *pgmFile = fopen(files[i], "rb");
+        if (pgmFile == NULL) continue;
+        fclose(pgmFile);
+        specs imageSpecs;
+        unsigned int **image = readImage(files[i], &imageSpecs);
+        benchmarkImage(files[i], image, imageSpecs);
+        benchmarkThumbnails(files[i], image, imageSpecs);
+        freeImage(image);
+    }
+    specs synthetic = {1024, 1024, 255, 1};
+    unsigned int **image = allocateImage(synthetic.width, synthetic.height);
+    for (int x = 0; x < synthetic.width; x++) {
+        for (int y = 0; y < synthetic.height; y++) {
+            double shade = 120 + 100 * sin(x / 150.0) * cos(y / 100.0);
+            image[x][y] = grey(shade + (x * 31 + y * 17) % 7 - 3);
+        }
+    }
+    benchmarkImage("synthetic", image, synthetic);
+    freeImage(image);
+}
+
 // A replacement for the library assert function.
 void assert(int line, bool b) {
     if (b) return;
@@ -420,6 +871,13 @@ void testIsPgm() {
     assert(__LINE__, isPgm("uncompressMeFirstPlease.zip") == false);
 }
 
+// Test isPpm()
+void testIsPpm() {
+    assert(__LINE__, isPpm("photo.ppm") == true);
+    assert(__LINE__, isPpm("photo.pgm") == false);
+    assert(__LINE__, isPpm("ppm") == false);
+}
+
 // Test isSk()
 void testIsSk() {
     assert(__LINE__, isSk("somefile.sk") == true);
@@ -470,36 +928,369 @@ void testGetOperand() {
     assert(__LINE__, getOperand(0x81) == LINE);
 }
 
+// Test that lines and blocks leaving the matrix are clipped, and that lines which are
+// not vertical are drawn too
+void testBounds() {
+    // Line from (0,0) to (0,30), block to (30,60), then a line from (30,60) up to (30,-4),
+    // a block from (30,-4) to (29,-3) and a line from (29,-3) to (59,27)
+    unsigned char outside[] = {0x5e, 0x82, 0x1e, 0x5e, 0x81, 0x60, 0x60, 0x82, 0x3f, 0x41, 0x81, 0x1e, 0x5e};
+    FILE *skFile = fopen("converter.tmp", "wb");
+    fwrite(outside, 1, sizeof(outside), skFile);
+    fclose(skFile);
+    unsigned char **matrix = allocateMatrix(200, 200);
+    processMatrix("converter.tmp", matrix, 0);
+    assert(__LINE__, matrix[0][30] == 255 && matrix[60][30] == 255 && matrix[61][30] == 0);
+    assert(__LINE__, matrix[30][0] == 255 && matrix[45][15] == 255 && matrix[59][29] == 255);
+    assert(__LINE__, matrix[12][44] == 255 && matrix[27][59] == 255 && matrix[12][45] == 0);
+    remove("converter.tmp");
+    freeMatrix(matrix);
+}
+
+// Test that scaleSamples() gives the same values as convertColor() for every sample of
+// 8 and 16 bit maxvals, with lengths that are not a multiple of the SIMD width
+void testScaleSamples() {
+    int maxvals[] = {1, 3, 255, 256, 1000, 40000, 65535};
+    unsigned char *samples = malloc(2 * 65536), *out = malloc(65536);
+    for (int m = 0; m < 7; m++) {
+        int maxval = maxvals[m], bytes = maxval > 255 ? 2 : 1;
+        for (int v = 0; v <= maxval; v++) {
+            if (bytes == 1) samples[v] = v;
+            else {
+                samples[2 * v] = v >> 8;
+                samples[2 * v + 1] = v & 255;
+            }
+        }
+        scaleSamples(samples, bytes, maxval + 1, maxval, out);
+        bool same = true;
+        for (int v = 0; v <= maxval; v++) same = same && out[v] == convertColor(v, maxval);
+        assert(__LINE__, same);
+    }
+    free(samples);
+    free(out);
+}
+
+// Test readImage() on 16 bit colour and 8 bit grey files, whose samples may look like spaces
+void testReadImage() {
+    FILE *file = fopen("converter.tmp", "wb");
+    fprintf(file, "P6 2 1 65535\n");
+    unsigned char colour[] = {255, 255, 0, 0, 128, 0, 0, 1, 0, 2, 0, 3};
+    fwrite(colour, 1, 12, file);
+    fclose(file);
+    specs imageSpecs;
+    unsigned int **image = readImage("converter.tmp", &imageSpecs);
+    assert(__LINE__, imageSpecs.width == 2 && imageSpecs.height == 1 && imageSpecs.channels == 3);
+    assert(__LINE__, image[0][0] == rgba(255, 0, 127) && image[1][0] == rgba(0, 0, 0));
+    freeImage(image);
+    file = fopen("converter.tmp", "wb");
+    fprintf(file, "P5 1 2 255\n");
+    fputc(' ', file);
+    fputc('\n', file);
+    fclose(file);
+    image = readImage("converter.tmp", &imageSpecs);
+    assert(__LINE__, imageSpecs.channels == 1 && image[0][0] == grey(' ') && image[0][1] == grey('\n'));
+    freeImage(image);
+    remove("converter.tmp");
+}
+
+// Test quantise()
+void testQuantise() {
+    assert(__LINE__, quantise(77, 0) == 77);
+    assert(__LINE__, quantise(77, 256) == 77);
+    assert(__LINE__, quantise(0, 2) == 0 && quantise(127, 2) == 0 && quantise(128, 2) == 255);
+    assert(__LINE__, quantise(100, 4) == 85);
+    assert(__LINE__, quantise(255, 16) == 255);
+}
+
+// Test that grouped encoding draws an image exactly (width and height of 200 as expected
+// by processMatrix), with a background that is not black and noisy columns
+// (processMatrix only draws the blue channel, so every colour has a different blue value)
+void testGrouped() {
+    unsigned int **image = allocateImage(200, 200), colours[] = {rgba(200, 0, 0), rgba(10, 20, 100), grey(200)};
+    unsigned char **drawn = allocateMatrix(200, 200);
+    for (int x = 0; x < 200; x++) {
+        for (int y = 0; y < 200; y++) {
+            image[x][y] = (x * 7 + y * y * 13) % 5 == 0 ? colours[(x + y) % 3] : grey(60);
+        }
+    }
+    FILE *skFile = fopen("converter.tmp", "wb");
+    encodeGrouped(skFile, image, (specs) {200, 200, 255, 3}, false);
+    fclose(skFile);
+    processMatrix("converter.tmp", drawn, 0);
+    bool same = true;
+    for (int x = 0; x < 200; x++) {
+        for (int y = 0; y < 200; y++) same = same && drawn[y][x] == ((image[x][y] >> 8) & 255);
+    }
+    assert(__LINE__, same);
+    remove("converter.tmp");
+    freeImage(image);
+    freeMatrix(drawn);
+}
+
+// Test that quadtree blocks decode to an image within the tolerance, exactly for tolerance 0
+void testQuadtree() {
+    unsigned int **image = allocateImage(200, 200);
+    unsigned char **drawn = allocateMatrix(200, 200);
+    for (int x = 0; x < 200; x++) {
+        for (int y = 0; y < 200; y++) image[x][y] = grey(x < 50 ? 255 : (x * 3 + y * y) % 40 + (y > 150) * 90);
+    }
+    int tolerances[] = {0, 3, 20};
+    long previous = 0x7FFFFFFF;
+    for (int t = 0; t < 3; t++) {
+        FILE *skFile = fopen("converter.tmp", "wb");
+        quality q = encodeQuadtree(skFile, image, (specs) {200, 200, 255, 1}, tolerances[t]);
+        fclose(skFile);
+        assert(__LINE__, q.bytes < previous && (t == 0) == (q.psnr == INFINITY));
+        previous = q.bytes;
+        processMatrix("converter.tmp", drawn, 0);
+        int worst = 0;
+        for (int x = 0; x < 200; x++) {
+            for (int y = 0; y < 200; y++) {
+                int d = abs(drawn[y][x] - (int) (image[x][y] & 0xFF00) / 256);
+                if (d > worst) worst = d;
+            }
+        }
+        assert(__LINE__, worst <= tolerances[t]);
+    }
+    assert(__LINE__, regionColour(100, 106, 5) == 104);
+    assert(__LINE__, regionColour(0, 0, 0) == 0);
+    remove("converter.tmp");
+    freeImage(image);
+    freeMatrix(drawn);
+}
+
+// Test that an encoded sequence of images draws the last image when its frames are drawn
+// over each other, and that frames changing little take little space
+void testSequence() {
+    unsigned int **images[3];
+    for (int i = 0; i < 3; i++) images[i] = allocateImage(200, 200);
+    for (int x = 0; x < 200; x++) {
+        for (int y = 0; y < 200; y++) {
+            images[0][x][y] = grey((x * 7 + y * y * 13) % 5 == 0 ? 0 : (x / 20) * 25);
+            // A square turns white, then a column turns black
+            images[1][x][y] = x >= 50 && x < 70 && y >= 50 && y < 70 ? grey(255) : images[0][x][y];
+            images[2][x][y] = x == 120 ? grey(0) : images[1][x][y];
+        }
+    }
+    FILE *skFile = fopen("converter.tmp", "wb");
+    encodeGrouped(skFile, images[0], (specs) {200, 200, 255, 1}, true);
+    long single = ftell(skFile);
+    fclose(skFile);
+    skFile = fopen("converter.tmp", "wb");
+    encodeSequence(skFile, 3, images, (specs) {200, 200, 255, 1}, 40);
+    long total = ftell(skFile);
+    fclose(skFile);
+    assert(__LINE__, total < single + single / 10);
+    unsigned char **drawn = allocateMatrix(200, 200);
+    processMatrix("converter.tmp", drawn, 0);
+    bool same = true;
+    for (int x = 0; x < 200; x++) {
+        for (int y = 0; y < 200; y++) same = same && drawn[y][x] == ((images[2][x][y] >> 8) & 255);
+    }
+    assert(__LINE__, same);
+    // Converting the images from files, read one at a time, gives the same sketch
+    char *names[3] = {"converter0.tmp.pgm", "converter1.tmp.pgm", "converter2.tmp.pgm"};
+    for (int i = 0; i < 3; i++) {
+        for (int x = 0; x < 200; x++) {
+            for (int y = 0; y < 200; y++) drawn[y][x] = (images[i][x][y] >> 8) & 255;
+        }
+        FILE *pgmFile = fopen(names[i], "wb");
+        writePgm(pgmFile, drawn, 200);
+        fclose(pgmFile);
+    }
+    assert(__LINE__, convertSequence(3, names, "converter.tmp2", 0, 40) == total);
+    FILE *a = fopen("converter.tmp", "rb"), *b = fopen("converter.tmp2", "rb");
+    int ca, cb;
+    do { ca = fgetc(a); cb = fgetc(b); } while (ca == cb && ca != EOF);
+    assert(__LINE__, ca == cb);
+    fclose(a);
+    fclose(b);
+    for (int i = 0; i < 3; i++) remove(names[i]);
+    remove("converter.tmp2");
+    remove("converter.tmp");
+    for (int i = 0; i < 3; i++) freeImage(images[i]);
+    freeMatrix(drawn);
+}
+
+// Test that thumbnails drawn straight at 1/4 and 1/8 of the size are the averages of the
+// pixels of the full picture under each of their pixels: exactly for the example sketches,
+// and nearly for converted images giving thumbnail pixels more colours than they keep
+void testThumbnails() {
+    unsigned char **full = allocateMatrix(200, 200), **small = allocateMatrix(100, 100);
+    for (int f = 0; f < 12; f++) {
+        char filename[16];
+        if (f < 10) sprintf(filename, "sketch%02d.sk", f);
+        else {
+            unsigned int **image = allocateImage(200, 200);
+            for (int x = 0; x < 200; x++) {
+                for (int y = 0; y < 200; y++) image[x][y] = grey(f == 10 ? (x * 3 + y / 7) % 256 : (x * y) % 5 * 60);
+            }
+            FILE *skFile = fopen("converter.tmp", "wb");
+            encodeGrouped(skFile, image, (specs) {200, 200, 255, 1}, false);
+            fclose(skFile);
+            freeImage(image);
+            strcpy(filename, "converter.tmp");
+        }
+        processMatrix(filename, full, 0);
+        for (int shift = 2; shift <= 3; shift++) {
+            processMatrix(filename, small, shift);
+            int size = 1 << shift, worst = 0;
+            for (int i = 0; i < 200 / size; i++) {
+                for (int j = 0; j < 200 / size; j++) {
+                    int sum = 0;
+                    for (int y = 0; y < size; y++) {
+                        for (int x = 0; x < size; x++) sum += full[i * size + y][j * size + x];
+                    }
+                    int difference = abs(small[i][j] - (sum + size * size / 2) / (size * size));
+                    if (difference > worst) worst = difference;
+                }
+            }
+            assert(__LINE__, worst <= (f < 10 ? 0 : 8));
+        }
+    }
+    remove("converter.tmp");
+    freeMatrix(full);
+    freeMatrix(small);
+}
+
+// Draw a line on a canvas by stepping through all of it, plotting the points inside
+void referenceLine(canvas *c, int x0, int y0, int x1, int y1) {
+    long long x = x0, y = y0;
+    long long dx = llabs((long long) x1 - x0), dy = -llabs((long long) y1 - y0);
+    int sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1;
+    long long error = dx + dy;
+    while (true) {
+        if (x >= 0 && x < c->width && y >= 0 && y < c->height) c->pixels[y * c->width + x] = c->rgba;
+        if (x == x1 && y == y1) break;
+        long long twice = 2 * error;
+        if (twice >= dy) {
+            error += dy;
+            x += sx;
+        }
+        if (twice <= dx) {
+            error += dx;
+            y += sy;
+        }
+    }
+}
+
+// Test that lines clipped to the canvas before stepping, and lines inside it drawn without
+// bounds checks, draw the same pixels as lines stepped through completely with a check
+// per pixel, on full size and on scaled canvases, and that a line running a billion
+// pixels past the canvas is drawn at once
+void testClipping() {
+    canvas *a = newCanvas(200, 120), *b = newCanvas(200, 120);
+    canvas *small = newScaledCanvas(200, 120, 2);
+    unsigned int seed = 1;
+    for (int i = 0; i < 20000; i++) {
+        int p[4];
+        for (int j = 0; j < 4; j++) {
+            seed = seed * 1103515245 + 12345;
+            p[j] = (int) (seed >> 16) % 1000 - 400;
+        }
+        if (i % 3 == 0) p[i % 4] *= 30;
+        // A third of the lines are inside the canvas
+        else if (i % 3 == 1) for (int j = 0; j < 4; j++) p[j] = (p[j] + 400) % (j % 2 == 0 ? 200 : 120);
+        canvasLine(a, p[0], p[1], p[2], p[3]);
+        referenceLine(b, p[0], p[1], p[2], p[3]);
+        canvasLine(small, p[0], p[1], p[2], p[3]);
+        if (i % 100 != 99) continue;
+        assert(__LINE__, memcmp(a->pixels, b->pixels, sizeof(unsigned int) * 200 * 120) == 0);
+        unsigned int *pixels = canvasPixels(small);
+        for (int k = 0; k < 50 * 30; k++) {
+            int sum = 0, x = k % 50, y = k / 50;
+            for (int j = 0; j < 16; j++) sum += a->pixels[(4 * y + j / 4) * 200 + 4 * x + j % 4] >> 8 & 255;
+            assert(__LINE__, (pixels[k] >> 8 & 255) == (sum + 8) / 16);
+        }
+        clearCanvas(a, 0xFF);
+        clearCanvas(b, 0xFF);
+        clearCanvas(small, 0xFF);
+    }
+    canvasLine(a, 0, 0, (1 << 30) - 1, 1);
+    assert(__LINE__, a->pixels[0] == 0xFFFFFFFF && a->pixels[199] == 0xFFFFFFFF && a->pixels[200] == 0xFF);
+    freeCanvas(a);
+    freeCanvas(b);
+    freeCanvas(small);
+}
+
 // Run tests
 void test() { 
     testIsPgm();
+    testIsPpm();
     testIsSk();
     testDecimalStringToInt();
     testConvertColor();
     testGetOperand();
     testGetOpcode();
+    testBounds();
+    testClipping();
+    testScaleSamples();
+    testReadImage();
+    testQuantise();
+    testGrouped();
+    testQuadtree();
+    testSequence();
+    testThumbnails();
     printf("All tests passed.\n");
 }
 
-// Run program if 1 argument, test program if no arguments
+// Run program if a file name is given (after the options), test program if no arguments
+// Options for .pgm and .ppm files: -g groups runs by colour, -q levels quantises grey values,
+// -e tolerance draws blocks within tolerance of the grey values. -b runs the benchmark.
+// -a animation.sk turns the files that follow into the frames of an animation, pausing
+// -p milliseconds after each. For .sk files -s 2, 4 or 8 writes a thumbnail at that fraction
+// of the size.
 int main(int n, char *args[n]) { 
+    startTrace("converter");
+    bool grouped = false;
+    int levels = 0, tolerance = -1, pause = 0, shift = 0, i = 1;
+    char *animation = NULL;
+    while (i < n - 1 && args[i][0] == '-') {
+        if (strcmp(args[i], "-g") == 0) grouped = true;
+        else if (strcmp(args[i], "-q") == 0 && i + 2 < n) levels = decimalStringToInt(args[++i]);
+        else if (strcmp(args[i], "-e") == 0 && i + 2 < n) tolerance = decimalStringToInt(args[++i]);
+        else if (strcmp(args[i], "-p") == 0 && i + 2 < n) pause = decimalStringToInt(args[++i]);
+        else if (strcmp(args[i], "-a") == 0 && i + 2 < n) animation = args[++i];
+        else if (strcmp(args[i], "-s") == 0 && i + 2 < n) {
+            int scale = decimalStringToInt(args[++i]);
+            while ((2 << shift) <= scale && shift < 3) shift++;
+            if (scale != 1 << shift) {
+                fprintf(stderr, "Thumbnails are 2, 4 or 8 times smaller.\n");
+                exit(1);
+            }
+        }
+        else break;
+        i++;
+    }
     if (n == 1) test();
-    else if (n == 2) {
-        if (isPgm(args[1])) {
-            convertPgm(args[1]);
+    else if (n == 2 && strcmp(args[1], "-b") == 0) benchmark();
+    else if (animation != NULL && isSk(animation) && i < n) {
+        for (int j = i; j < n; j++) {
+            if (!isPgm(args[j]) && !isPpm(args[j])) {
+                fprintf(stderr, "Invalid file type, the frames of an animation must be .pgm or .ppm files.\n");
+                exit(1);
+            }
+        }
+        long bytes = convertSequence(n - i, args + i, animation, levels, pause);
+        printf("Animation written: %d frames, %ld bytes.\n", n - i, bytes);
+    }
+    else if (i == n - 1) {
+        if ((isPgm(args[i]) || isPpm(args[i])) && tolerance >= 0) {
+            quality q = convertPgm(args[i], grouped, levels, tolerance);
+            printf("File converted: %ld bytes, PSNR %.1f dB.\n", q.bytes, q.psnr);
+        } else if (isPgm(args[i]) || isPpm(args[i])) {
+            convertPgm(args[i], grouped, levels, tolerance);
             printf("File converted.");
-        } else if (isSk(args[1])) {
-            convertSk(args[1]);
+        } else if (isSk(args[i]) || isSkz(args[i])) {
+            convertSk(args[i], shift);
             printf("File converted: Warning .sk to .pgm convertion is a work in progress:\n");
-            printf("- Files containing non vertical lines will not render properly.\n");
             printf("- Only blue color channel will be used for RGBA to grayscale conversion.\n");
-            printf("- Advanced sketch file fucntions will be ignored.\n");
+            printf("- Shows and pauses are ignored, frames are drawn over each other.\n");
         } else {
-            fprintf(stderr, "Invalid file type, this program only supports .pgm and .sk files.\n");
+            fprintf(stderr, "Invalid file type, this program only supports .pgm, .ppm, .sk and .skz files.\n");
             exit(1);
         }
     } else {
-        fprintf(stderr, "Usage: ./converter filename\n");
+        fprintf(stderr, "Usage: ./converter [-g] [-q levels] [-e tolerance] [-s scale] filename, ./converter [-q levels] [-p ms] -a out.sk frames... or ./converter -b\n");
         exit(1);
     }
 }
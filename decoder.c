@@ -0,0 +1,137 @@
+// Push decoder, see decoder.h for how to use it.
+#include "displayfull.h"
+#include "sketch.h"
+#include "decoder.h"
+#include <pthread.h>
+
+// A decoder: the drawing state and the bytes of the current frame (kept to replay it)
+struct decoder {
+    state s;
+    byte *frame;
+    int n, capacity;
+};
+
+// Reset the drawing state at the start of a frame
+static void resetDecoder(decoder *p) {
+    p->s = (state) {0, 0, 0, 0, LINE, 0, 0, false};
+}
+
+// Create a decoder at the start of a sketch.
+decoder *newDecoder() {
+    decoder *p = malloc(sizeof(decoder));
+    resetDecoder(p);
+    p->capacity = 256;
+    p->frame = malloc(p->capacity);
+    p->n = 0;
+    return p;
+}
+
+// Release a decoder.
+void freeDecoder(decoder *p) {
+    free(p->frame);
+    free(p);
+}
+
+// Decode n more bytes of a sketch, drawing on the display.
+void pushBytes(display *d, decoder *p, byte *bytes, int n) {
+    for (int i = 0; i < n; i++) {
+        if (p->n == p->capacity) {
+            p->capacity = p->capacity * 2;
+            p->frame = realloc(p->frame, p->capacity);
+        }
+        p->frame[p->n++] = bytes[i];
+        obey(d, &p->s, bytes[i]);
+        if (getOpcode(bytes[i]) == TOOL && getOperand(bytes[i]) == NEXTFRAME) {
+            resetDecoder(p);
+            p->n = 0;
+        }
+    }
+}
+
+// End the sketch: show the last frame (the one not ended by NEXTFRAME) and start again.
+void endSketch(display *d, decoder *p) {
+    show(d);
+    resetDecoder(p);
+}
+
+// Draw the last frame of an ended sketch again and show it, so that it stays on display.
+void replayFrame(display *d, decoder *p) {
+    for (int i = 0; i < p->n; i++) obey(d, &p->s, p->frame[i]);
+    endSketch(d, p);
+}
+
+// A file read by a background thread into a buffer, until its end
+struct feed {
+    FILE *in;
+    pthread_mutex_t lock;
+    byte *bytes;
+    int n, capacity;
+    bool ended, abandoned;
+};
+
+// Release a feed
+static void freeFeed(feed *f) {
+    pthread_mutex_destroy(&f->lock);
+    free(f->bytes);
+    free(f);
+}
+
+// Reading thread. getc returns as soon as a byte is there, so bytes are handed over
+// as they arrive instead of waiting for a whole block.
+static void *readFeed(void *data) {
+    feed *f = (feed*) data;
+    int ch = getc(f->in);
+    while (ch != EOF) {
+        pthread_mutex_lock(&f->lock);
+        if (f->n == f->capacity) {
+            f->capacity = f->capacity * 2;
+            f->bytes = realloc(f->bytes, f->capacity);
+        }
+        f->bytes[f->n++] = ch;
+        pthread_mutex_unlock(&f->lock);
+        ch = getc(f->in);
+    }
+    pthread_mutex_lock(&f->lock);
+    f->ended = true;
+    bool abandoned = f->abandoned;
+    pthread_mutex_unlock(&f->lock);
+    if (abandoned) freeFeed(f);
+    return NULL;
+}
+
+// Start reading a file in the background.
+feed *startFeed(FILE *in) {
+    feed *f = malloc(sizeof(feed));
+    f->in = in;
+    pthread_mutex_init(&f->lock, NULL);
+    f->capacity = 4096;
+    f->bytes = malloc(f->capacity);
+    f->n = 0;
+    f->ended = f->abandoned = false;
+    pthread_t thread;
+    pthread_create(&thread, NULL, readFeed, f);
+    pthread_detach(thread);
+    return f;
+}
+
+// Take the bytes read since the last call into a newly allocated array, returns their
+// number. Sets ended once the end of the file has been reached and every byte taken.
+int takeBytes(feed *f, byte **bytes, bool *ended) {
+    pthread_mutex_lock(&f->lock);
+    int n = f->n;
+    *bytes = malloc(n + 1);
+    memcpy(*bytes, f->bytes, n);
+    f->n = 0;
+    *ended = f->ended;
+    pthread_mutex_unlock(&f->lock);
+    return n;
+}
+
+// Stop using a feed. It is released now if the file has ended, otherwise by its thread once it does.
+void stopFeed(feed *f) {
+    pthread_mutex_lock(&f->lock);
+    bool ended = f->ended;
+    f->abandoned = true;
+    pthread_mutex_unlock(&f->lock);
+    if (ended) freeFeed(f);
+}
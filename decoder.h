@@ -0,0 +1,42 @@
+// Push decoder: decodes a sketch from bytes that arrive in chunks of any size.
+// -----------------------------------------------------------------
+// processSketch reads its frames from a named file, and so needs the whole file before
+// playing it. A decoder instead takes the bytes as they come (from a pipe, say) and
+// obeys every command as soon as it is complete. The drawing state, including a value
+// partly built up from DATA commands and the selected tool, is kept between pushes, so
+// a chunk may end anywhere. Every NEXTFRAME shows its frame straight away and resets
+// the drawing state, like the end of a frame in processSketch.
+
+// A decoder object, create it with newDecoder and free it with freeDecoder.
+struct decoder;
+typedef struct decoder decoder;
+
+// Create a decoder at the start of a sketch.
+decoder *newDecoder();
+
+// Release a decoder.
+void freeDecoder(decoder *p);
+
+// Decode n more bytes of a sketch, drawing on the display.
+void pushBytes(display *d, decoder *p, byte *bytes, int n);
+
+// End the sketch: show the last frame (the one not ended by NEXTFRAME) and start again.
+void endSketch(display *d, decoder *p);
+
+// Draw the last frame of an ended sketch again and show it, so that it stays on display.
+void replayFrame(display *d, decoder *p);
+
+// Bytes read from a file (like stdin) by a background thread, so that reading does not
+// hold up the display. Create a feed with startFeed and stop it with stopFeed.
+struct feed;
+typedef struct feed feed;
+
+// Start reading a file in the background.
+feed *startFeed(FILE *in);
+
+// Take the bytes read since the last call into a newly allocated array, returns their
+// number. Sets ended once the end of the file has been reached and every byte taken.
+int takeBytes(feed *f, byte **bytes, bool *ended);
+
+// Stop using a feed. It is released now if the file has ended, otherwise by its thread once it does.
+void stopFeed(feed *f);
@@ -0,0 +1,88 @@
+// The display module of programs choosing their backend while they run, see backend.h.
+// -----------------------------------------------------------------------------------
+// Every call is passed on to the backend the display was made by.
+#include "displayfull.h"
+#include "backend.h"
+
+// Backend newDisplay creates displays on, set by useBackend
+static const backend *chosen = NULL;
+
+display *openDisplay(const backend *b, char *name, int width, int height) {
+  return b->newDisplay(name, width, height);
+}
+
+void useBackend(const backend *b) {
+  chosen = b;
+}
+
+const backend *displayBackend(display *d) {
+  return d->b;
+}
+
+display *newDisplay(char *name, int width, int height) {
+  if (chosen == NULL) {
+    fprintf(stderr, "Error: no display backend chosen\n");
+    exit(1);
+  }
+  return openDisplay(chosen, name, width, height);
+}
+
+void freeDisplay(display *d) {
+  d->b->freeDisplay(d);
+}
+
+int getWidth(display *d) {
+  return d->width;
+}
+
+int getHeight(display *d) {
+  return d->height;
+}
+
+char *getName(display *d) {
+  return d->name;
+}
+
+void pause(display *d, int ms) {
+  d->b->pause(d, ms);
+}
+
+void show(display *d) {
+  d->b->show(d);
+}
+
+void line(display *d, int x0, int y0, int x1, int y1) {
+  d->b->line(d, x0, y0, x1, y1);
+}
+
+void block(display *d, int x, int y, int w, int h) {
+  d->b->block(d, x, y, w, h);
+}
+
+void colour(display *d, int rgba) {
+  d->b->colour(d, rgba);
+}
+
+void capture(display *d, unsigned int *pixels) {
+  d->b->capture(d, pixels);
+}
+
+void blit(display *d, unsigned int *pixels) {
+  d->b->blit(d, pixels);
+}
+
+void setViewport(display *d, int x, int y, int level) {
+  d->b->setViewport(d, x, y, level);
+}
+
+void keepCanvas(display *d, bool keep) {
+  d->b->keepCanvas(d, keep);
+}
+
+void startFrame(display *d, long frame) {
+  d->b->startFrame(d, frame);
+}
+
+void run(display *d, void *data, bool action(display *, void*, const char)) {
+  d->b->run(d, data, action);
+}
@@ -0,0 +1,124 @@
+// Headless display backends: a software framebuffer and a display drawing nothing, see backend.h.
+// ----------------------------------------------------------------------------------------------
+// The framebuffer draws on a canvas in memory with the same pixels as the window, for
+// programs without a screen like converters and servers, or on a scaled canvas for
+// thumbnails. Neither backend waits: pauses and the 10ms after each show take no time,
+// so a sketch plays as fast as it decodes.
+#include "displayfull.h"
+#include "backend.h"
+#include "canvas.h"
+
+// Framebuffer display: the canvas drawn on, kept between shows if asked to
+typedef struct framebuffer {
+  display base;
+  canvas *drawing;
+  bool keep;
+} framebuffer;
+
+display *openThumbnail(char *name, int width, int height, int shift) {
+  framebuffer *f = malloc(sizeof(framebuffer));
+  f->base = (display) {&cpuBackend, name, width, height};
+  f->drawing = newScaledCanvas(width, height, shift);
+  f->keep = false;
+  return &f->base;
+}
+
+static display *cpuNew(char *name, int width, int height) {
+  return openThumbnail(name, width, height, 0);
+}
+
+static void cpuFree(display *d) {
+  framebuffer *f = (framebuffer *) d;
+  freeCanvas(f->drawing);
+  free(f);
+}
+
+static void cpuPause(display *d, int ms) {
+}
+
+static void cpuShow(display *d) {
+  framebuffer *f = (framebuffer *) d;
+  if (!f->keep) clearCanvas(f->drawing, 0xFF);
+}
+
+static void cpuLine(display *d, int x0, int y0, int x1, int y1) {
+  canvasLine(((framebuffer *) d)->drawing, x0, y0, x1, y1);
+}
+
+static void cpuBlock(display *d, int x, int y, int w, int h) {
+  canvasBlock(((framebuffer *) d)->drawing, x, y, w, h);
+}
+
+static void cpuColour(display *d, int rgba) {
+  ((framebuffer *) d)->drawing->rgba = rgba;
+}
+
+static void cpuCapture(display *d, unsigned int *pixels) {
+  canvas *c = ((framebuffer *) d)->drawing;
+  memcpy(pixels, canvasPixels(c), sizeof(unsigned int) * c->width * c->height);
+}
+
+static void cpuBlit(display *d, unsigned int *pixels) {
+  blitCanvas(((framebuffer *) d)->drawing, pixels);
+}
+
+// The view is not changed, the picture is drawn at the default view.
+static void cpuSetViewport(display *d, int x, int y, int level) {
+}
+
+static void cpuKeepCanvas(display *d, bool keep) {
+  ((framebuffer *) d)->keep = keep;
+}
+
+// Frames are not told apart, nothing waits for static content.
+static void cpuStartFrame(display *d, long frame) {
+}
+
+// Call the action until it returns true, there are no keys to pass on
+static void headlessRun(display *d, void *data, bool action(display *, void*, const char)) {
+  bool quit = false;
+  while (!quit) quit = action(d, data, 0);
+}
+
+const backend cpuBackend = {
+  "cpu", true, cpuNew, cpuFree, cpuPause, cpuShow, cpuLine, cpuBlock, cpuColour,
+  cpuCapture, cpuBlit, cpuSetViewport, cpuKeepCanvas, cpuStartFrame, headlessRun
+};
+
+static display *nullNew(char *name, int width, int height) {
+  display *d = malloc(sizeof(display));
+  *d = (display) {&nullBackend, name, width, height};
+  return d;
+}
+
+static void nullFree(display *d) {
+  free(d);
+}
+
+static void nullLine(display *d, int x0, int y0, int x1, int y1) {
+}
+
+static void nullBlock(display *d, int x, int y, int w, int h) {
+}
+
+static void nullColour(display *d, int rgba) {
+}
+
+// Nothing is drawn, so a capture is plain black and a blit is ignored.
+static void nullCapture(display *d, unsigned int *pixels) {
+  for (int i = 0; i < d->width * d->height; i++) pixels[i] = 0xFF;
+}
+
+static void nullBlit(display *d, unsigned int *pixels) {
+}
+
+static void nullShow(display *d) {
+}
+
+static void nullKeepCanvas(display *d, bool keep) {
+}
+
+const backend nullBackend = {
+  "null", true, nullNew, nullFree, cpuPause, nullShow, nullLine, nullBlock, nullColour,
+  nullCapture, nullBlit, cpuSetViewport, nullKeepCanvas, cpuStartFrame, headlessRun
+};
@@ -0,0 +1,301 @@
+// This display backend exports a sketch as a stream of video frames instead of opening a window.
+// ----------------------------------------------------------------------------------------------
+// Drawing goes to a software canvas, and time is kept by a virtual clock: show() advances
+// it by the usual 10ms and pause() by the given milliseconds, without sleeping. Frames are
+// written at a fixed rate as raw RGBA (4 bytes per pixel) or as a Y4M (YUV 4:4:4) stream,
+// so an export takes as long as drawing takes rather than as long as the animation runs.
+// Usage: ./export [-f fps] [-t seconds] [-y4m] [-o output] file.sk (without arguments the tests are run)
+#include "displayfull.h"
+#include "backend.h"
+#include "sketch.h"
+#include "canvas.h"
+
+// Display writing frames to a file according to a virtual clock (see backend.h)
+typedef struct exporter {
+  display base;
+  canvas *drawing;
+  unsigned int *shown;
+  unsigned char *buffer;
+  double clock, limit;
+  long frames;
+  int fps;
+  bool y4m, keep;
+  FILE *out;
+} exporter;
+
+// Write the currently shown image as one frame of the output stream
+static void writeFrame(exporter *d) {
+  int n = d->base.width * d->base.height;
+  unsigned char *b = d->buffer;
+  if (d->y4m) {
+    fprintf(d->out, "FRAME\n");
+    for (int i = 0; i < n; i++) {
+      int r = d->shown[i] >> 24, g = (d->shown[i] >> 16) & 0xFF, bl = (d->shown[i] >> 8) & 0xFF;
+      b[i] = ((66 * r + 129 * g + 25 * bl + 128) >> 8) + 16;
+      b[n + i] = ((-38 * r - 74 * g + 112 * bl + 128) >> 8) + 128;
+      b[2 * n + i] = ((112 * r - 94 * g - 18 * bl + 128) >> 8) + 128;
+    }
+    fwrite(b, 1, 3 * n, d->out);
+  } else {
+    for (int i = 0; i < n; i++) {
+      b[4 * i] = d->shown[i] >> 24;
+      b[4 * i + 1] = (d->shown[i] >> 16) & 0xFF;
+      b[4 * i + 2] = (d->shown[i] >> 8) & 0xFF;
+      b[4 * i + 3] = d->shown[i] & 0xFF;
+    }
+    fwrite(b, 1, 4 * n, d->out);
+  }
+  d->frames++;
+}
+
+// Move the virtual clock on by ms milliseconds, writing a frame for every frame time
+// passed while the current image was shown (stopping at the time limit, if one is set)
+static void advance(exporter *d, double ms) {
+  d->clock += ms;
+  double end = d->clock;
+  if (d->limit > 0 && end > d->limit) end = d->limit;
+  while (d->frames * 1000.0 / d->fps < end) writeFrame(d);
+}
+
+static void exportPause(display *d, int ms) {
+  if (ms > 0) advance((exporter *) d, ms);
+}
+
+static void exportLine(display *d, int x0, int y0, int x1, int y1) {
+  canvasLine(((exporter *) d)->drawing, x0, y0, x1, y1);
+}
+
+static void exportBlock(display *d, int x, int y, int w, int h) {
+  canvasBlock(((exporter *) d)->drawing, x, y, w, h);
+}
+
+static void exportColour(display *d, int rgba) {
+  ((exporter *) d)->drawing->rgba = rgba;
+}
+
+static void exportCapture(display *d, unsigned int *pixels) {
+  memcpy(pixels, ((exporter *) d)->drawing->pixels, sizeof(unsigned int) * d->width * d->height);
+}
+
+static void exportBlit(display *d, unsigned int *pixels) {
+  memcpy(((exporter *) d)->drawing->pixels, pixels, sizeof(unsigned int) * d->width * d->height);
+}
+
+static void exportShow(display *base) {
+  exporter *d = (exporter *) base;
+  memcpy(d->shown, d->drawing->pixels, sizeof(unsigned int) * base->width * base->height);
+  if (!d->keep) clearCanvas(d->drawing, 0xFF);
+  advance(d, 10);
+}
+
+// The view is not changed, the picture is drawn at the default view.
+static void exportSetViewport(display *d, int x, int y, int level) {
+}
+
+static void exportKeepCanvas(display *d, bool keep) {
+  ((exporter *) d)->keep = keep;
+}
+
+// Every frame is output, frames need not be told apart.
+static void exportStartFrame(display *d, long frame) {
+}
+
+static display *exportNew(char *name, int width, int height) {
+  exporter *d = malloc(sizeof(exporter));
+  d->base = (display) {&exportBackend, name, width, height};
+  d->drawing = newCanvas(width, height);
+  d->shown = malloc(sizeof(unsigned int) * width * height);
+  d->buffer = malloc(4 * width * height);
+  d->clock = 0;
+  d->limit = 0;
+  d->frames = 0;
+  d->fps = 25;
+  d->y4m = d->keep = false;
+  d->out = stdout;
+  return &d->base;
+}
+
+// Write the stream header, needed before the first show for Y4M output
+static void startStream(exporter *d) {
+  if (d->y4m) {
+    fprintf(d->out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", d->base.width, d->base.height, d->fps);
+  }
+  show(&d->base);
+}
+
+// Call the action until it returns true or the time limit (if one is set) is reached
+static void exportRun(display *base, void *data, bool action(display *, void*, const char)) {
+  exporter *d = (exporter *) base;
+  bool quit = false;
+  while (!quit && (d->limit <= 0 || d->clock < d->limit)) {
+    quit = action(base, data, 0);
+  }
+}
+
+static void exportFree(display *base) {
+  exporter *d = (exporter *) base;
+  if (d->frames == 0) writeFrame(d);
+  if (d->out != stdout) fclose(d->out);
+  else fflush(stdout);
+  freeCanvas(d->drawing);
+  free(d->shown);
+  free(d->buffer);
+  free(d);
+}
+
+const backend exportBackend = {
+  "export", true, exportNew, exportFree, exportPause, exportShow, exportLine, exportBlock,
+  exportColour, exportCapture, exportBlit, exportSetViewport, exportKeepCanvas,
+  exportStartFrame, exportRun
+};
+
+// A replacement for the library assert function.
+void assert(int line, bool b) {
+  if (b) return;
+  printf("The test on line %d fails.\n", line);
+  exit(1);
+}
+
+// Open an exporter of width x height pixels writing to a temporary file
+static exporter *openTest(int width, int height, bool y4m) {
+  exporter *d = (exporter *) openDisplay(&exportBackend, "test", width, height);
+  d->y4m = y4m;
+  d->out = tmpfile();
+  startStream(d);
+  return d;
+}
+
+// Read back the n bytes written so far by an exporter
+static bool written(exporter *d, unsigned char *bytes, long n) {
+  fflush(d->out);
+  if (ftell(d->out) != n) return false;
+  rewind(d->out);
+  bool read = fread(bytes, 1, n, d->out) == n;
+  fseek(d->out, 0, SEEK_END);
+  return read;
+}
+
+// Test that frames are written for every 40ms (at 25 fps) passed on the virtual clock,
+// up to the time limit
+void testClock() {
+  exporter *d = openTest(4, 3, false);
+  assert(__LINE__, d->clock == 10 && d->frames == 1);
+  pause(&d->base, 95);
+  assert(__LINE__, d->clock == 105 && d->frames == 3);
+  show(&d->base);
+  pause(&d->base, 5);
+  assert(__LINE__, d->clock == 120 && d->frames == 3);
+  pause(&d->base, 1);
+  pause(&d->base, 0);
+  assert(__LINE__, d->clock == 121 && d->frames == 4);
+  d->limit = 200;
+  pause(&d->base, 1000);
+  assert(__LINE__, d->frames == 5);
+  unsigned char bytes[5 * 4 * 12];
+  assert(__LINE__, written(d, bytes, sizeof(bytes)));
+  freeDisplay(&d->base);
+  d = (exporter *) openDisplay(&exportBackend, "sketch08.sk", 200, 200);
+  d->out = tmpfile();
+  startStream(d);
+  state *s = newState();
+  do processSketch(&d->base, s, 0);
+  while (s->start != 0);
+  assert(__LINE__, d->clock == 10 + 3 * 10 + 2 * 192 && d->frames == 11);
+  fflush(d->out);
+  assert(__LINE__, ftell(d->out) == 11 * 4 * 200 * 200);
+  freeState(s);
+  freeDisplay(&d->base);
+}
+
+// Test the bytes of RGBA and Y4M frames: the blank frame from the start of the stream
+// and a frame of a coloured block
+void testOutput() {
+  unsigned char bytes[2 * 4 * 12], *frame;
+  exporter *d = openTest(4, 3, false);
+  colour(&d->base, 0x11223344);
+  block(&d->base, 0, 0, 4, 3);
+  show(&d->base);
+  pause(&d->base, 30);
+  assert(__LINE__, written(d, bytes, sizeof(bytes)));
+  for (int i = 0; i < 12; i++) {
+    assert(__LINE__, bytes[4 * i] == 0 && bytes[4 * i + 1] == 0 && bytes[4 * i + 2] == 0 && bytes[4 * i + 3] == 0xFF);
+    frame = bytes + 4 * 12 + 4 * i;
+    assert(__LINE__, frame[0] == 0x11 && frame[1] == 0x22 && frame[2] == 0x33 && frame[3] == 0x44);
+  }
+  freeDisplay(&d->base);
+  char *header = "YUV4MPEG2 W4 H3 F25:1 Ip A1:1 C444\n";
+  int h = strlen(header), size = 6 + 3 * 12;
+  unsigned char stream[h + 2 * size];
+  d = openTest(4, 3, true);
+  colour(&d->base, 0x336699FF);
+  block(&d->base, 0, 0, 4, 3);
+  show(&d->base);
+  pause(&d->base, 30);
+  assert(__LINE__, written(d, stream, sizeof(stream)));
+  assert(__LINE__, memcmp(stream, header, h) == 0);
+  for (int f = 0; f < 2; f++) {
+    frame = stream + h + f * size;
+    assert(__LINE__, memcmp(frame, "FRAME\n", 6) == 0);
+    for (int i = 0; i < 12; i++) {
+      // Black, then 0x336699, in studio-swing YUV
+      int y = f == 0 ? 16 : 95, u = f == 0 ? 128 : 158, v = f == 0 ? 128 : 102;
+      assert(__LINE__, frame[6 + i] == y && frame[6 + 12 + i] == u && frame[6 + 24 + i] == v);
+    }
+  }
+  freeDisplay(&d->base);
+}
+
+// Run tests
+void test() {
+  testClock();
+  testOutput();
+  printf("All tests passed.\n");
+}
+
+// Export one pass of the sketch file (or, with -t, as many loops as fit into the given time)
+int main(int n, char *args[n]) {
+  if (n == 1) {
+    test();
+    return 0;
+  }
+  char *filename = NULL, *output = NULL;
+  int fps = 25;
+  double seconds = 0;
+  bool y4m = false;
+  for (int i = 1; i < n; i++) {
+    if (strcmp(args[i], "-f") == 0 && i + 1 < n) fps = atoi(args[++i]);
+    else if (strcmp(args[i], "-t") == 0 && i + 1 < n) seconds = atof(args[++i]);
+    else if (strcmp(args[i], "-o") == 0 && i + 1 < n) output = args[++i];
+    else if (strcmp(args[i], "-y4m") == 0) y4m = true;
+    else filename = args[i];
+  }
+  if (filename == NULL || fps <= 0) {
+    fprintf(stderr, "Use ./export [-f fps] [-t seconds] [-y4m] [-o output] file\n");
+    exit(1);
+  }
+  FILE *sketchFile = fopen(filename, "rb");
+  if (sketchFile == NULL) {
+    fprintf(stderr, "Error: cannot open %s\n", filename);
+    exit(1);
+  }
+  fclose(sketchFile);
+  exporter *d = (exporter *) openDisplay(&exportBackend, filename, 200, 200);
+  d->fps = fps;
+  d->y4m = y4m;
+  d->limit = seconds * 1000;
+  if (output != NULL && strcmp(output, "-") != 0) d->out = fopen(output, "wb");
+  if (d->out == NULL) {
+    fprintf(stderr, "Error: cannot open %s\n", output);
+    exit(1);
+  }
+  startStream(d);
+  state *s = newState();
+  if (d->limit > 0) run(&d->base, s, processSketch);
+  else {
+    do processSketch(&d->base, s, 0);
+    while (s->start != 0);
+  }
+  freeState(s);
+  freeDisplay(&d->base);
+  return 0;
+}
@@ -1,19 +1,30 @@
-// This display module provides basic graphics support for drawing built on SDL2 using a single window.
+// This display backend provides basic graphics support for drawing built on SDL2 using a single window.
 // ----------------------------------------------------------------------------------------------------
-// Full comments on how to use the module can be found in the header file.
+// Full comments on how to use the module can be found in the header file, display.c passes
+// the calls on to the backend (see backend.h).
 #include "displayfull.h"
+#include "backend.h"
+#include "trace.h"
 #define SDL_MAIN_HANDLED
 #define FAILURE_CODE 1 // exit code at program failure
+#define IDLE_CHECK 1000 // ms between redraws of static content, to pick up changed files
 
 // display object needed for a managing a graphics window
-struct display {
+typedef struct window {
+  display base;
   SDL_Window *window;
   SDL_Renderer *renderer;
-  char *name;
-  int width;
-  int height;
+  SDL_Texture *frame;
+  SDL_Texture *kept; // picture drawn on while the canvas is kept between shows, NULL otherwise
   Uint8 r, g, b, a;
-};
+  unsigned int hash; // hash of the calls made by the current action, to spot static content
+  int shows, pauses; // number of show and pause calls made by the current action
+  char key;          // key pressed during a pause, passed on to the next action
+  bool quit;         // window closed during a pause
+  long drawBegin, drawCalls, drawPixels; // draw calls since the last show, while tracing
+  int viewX, viewY;  // position of the picture shown at the top left corner
+  float scale;       // magnification of the picture
+} window;
 
 // If SDL fails, print the SDL error message, and stop the program immediately.
 static void fail() {
@@ -28,36 +39,72 @@ static void fail() {
 static int safeI(int n) { if (n < 0) fail(); return n; }
 static void *safeP(void *p) { if (p == NULL) fail(); return p; }
 
-void pause(display *d, int ms) {
-  SDL_Delay(ms);
+// Mix a call and its arguments into the hash of the calls of the current action (FNV-1a)
+static void note(window *d, int kind, int a, int b, int c, int e) {
+  int values[5] = {kind, a, b, c, e};
+  for (int i = 0; i < 5; i++) {
+    d->hash = (d->hash ^ (unsigned int) values[i]) * 16777619u;
+  }
 }
 
-int getWidth(display *d) {
-  return d->width;
+// Count a draw call and the pixels it covers towards the draw span of the next show
+static void traceDraw(window *d, long pixels) {
+  if (d->drawCalls == 0) d->drawBegin = traceClock();
+  d->drawCalls++;
+  d->drawPixels += pixels;
+  tracedPixels += pixels;
 }
 
-int getHeight(display *d) {
-  return d->height;
+// Handle an event, remembering keys and quitting. Returns true if the display needs to
+// be redrawn: after a key press or when the window was exposed or resized.
+static bool handle(window *d, SDL_Event *e) {
+  if (e->type == SDL_QUIT) d->quit = true;
+  if (e->type == SDL_KEYDOWN) {
+    d->key = (char) e->key.keysym.sym;
+    return true;
+  }
+  if (e->type == SDL_WINDOWEVENT) {
+    Uint8 w = e->window.event;
+    return (w == SDL_WINDOWEVENT_EXPOSED || w == SDL_WINDOWEVENT_RESIZED || w == SDL_WINDOWEVENT_SIZE_CHANGED);
+  }
+  return false;
 }
 
-char *getName(display *d) {
-  return d->name;
+// Wait for ms milliseconds while still handling events, so that the window stays
+// responsive and closing it ends the pause early.
+static void windowPause(display *base, int ms) {
+  window *d = (window *) base;
+  d->pauses++;
+  note(d, 'p', ms, 0, 0, 0);
+  long begin = traceClock();
+  Uint32 end = SDL_GetTicks() + ms;
+  SDL_Event e;
+  while (!d->quit) {
+    Sint32 left = (Sint32) (end - SDL_GetTicks());
+    if (left <= 0) break;
+    if (SDL_WaitEventTimeout(&e, left)) handle(d, &e);
+  }
+  traceSpan("pause", begin, 0, 0);
 }
 
-void line(display *d, int x0, int y0, int x1, int y1) {
-  safeI(SDL_RenderDrawLine(d->renderer, x0, y0, x1, y1));
+static void windowLine(display *base, int x0, int y0, int x1, int y1) {
+  window *d = (window *) base;
+  note(d, 'l', x0, y0, x1, y1);
+  if (tracing) traceDraw(d, 1 + (labs((long) x1 - x0) > labs((long) y1 - y0) ? labs((long) x1 - x0) : labs((long) y1 - y0)));
+  safeI(SDL_RenderDrawLine(d->renderer, x0 - d->viewX, y0 - d->viewY, x1 - d->viewX, y1 - d->viewY));
 }
 
-void block(display *d, int x, int y, int w, int h) {
-  SDL_Rect r = (SDL_Rect) {x, y, w, h};
+static void windowBlock(display *base, int x, int y, int w, int h) {
+  window *d = (window *) base;
+  note(d, 'b', x, y, w, h);
+  if (tracing) traceDraw(d, labs((long) w) * labs((long) h));
+  SDL_Rect r = (SDL_Rect) {x - d->viewX, y - d->viewY, w, h};
   safeI(SDL_RenderFillRect(d->renderer, &r));
 }
 
-void pixel(display *d, int x, int y) {
-  safeI(SDL_RenderDrawPoint(d->renderer, x, y));
-}
-
-void colour(display *d, int rgba) {
+static void windowColour(display *base, int rgba) {
+  window *d = (window *) base;
+  note(d, 'c', rgba, 0, 0, 0);
   d->r = (rgba >> 24) & 0xFF;
   d->g = (rgba >> 16) & 0xFF;
   d->b = (rgba >> 8) & 0xFF;
@@ -65,49 +112,154 @@ void colour(display *d, int rgba) {
   safeI(SDL_SetRenderDrawColor(d->renderer, d->r, d->g, d->b, d->a));
 }
 
-void show(display *d) {
+static void windowCapture(display *base, unsigned int *pixels) {
+  window *d = (window *) base;
+  safeI(SDL_RenderReadPixels(d->renderer, NULL, SDL_PIXELFORMAT_RGBA8888, pixels, d->base.width * 4));
+}
+
+static void windowBlit(display *base, unsigned int *pixels) {
+  window *d = (window *) base;
+  // Blitted images are told apart by their address (cached images are shared and never
+  // change), hashing every pixel would cost as much as the blit on large windows
+  note(d, 'i', (int) (uintptr_t) pixels, (int) ((uintptr_t) pixels >> 16 >> 16), 0, 0);
+  if (tracing) traceDraw(d, (long) d->base.width * d->base.height);
+  if (d->frame == NULL) {
+    d->frame = safeP(SDL_CreateTexture(d->renderer, SDL_PIXELFORMAT_RGBA8888,
+                 SDL_TEXTUREACCESS_STREAMING, d->base.width, d->base.height));
+  }
+  safeI(SDL_UpdateTexture(d->frame, NULL, pixels, d->base.width * 4));
+  // Captured pixels cover the whole window whatever the view
+  safeI(SDL_RenderSetScale(d->renderer, 1, 1));
+  safeI(SDL_RenderCopy(d->renderer, d->frame, NULL, NULL));
+  safeI(SDL_RenderSetScale(d->renderer, d->scale, d->scale));
+}
+
+static void windowShow(display *base) {
+  window *d = (window *) base;
+  d->shows++;
+  note(d, 's', 0, 0, 0, 0);
+  if (d->drawCalls > 0) traceSpan("draw", d->drawBegin, d->drawCalls, d->drawPixels);
+  d->drawCalls = d->drawPixels = 0;
+  long begin = traceClock();
+  if (d->kept != NULL) {
+    // Copy the kept picture to the window, then go on drawing on it
+    safeI(SDL_SetRenderTarget(d->renderer, NULL));
+    safeI(SDL_RenderSetScale(d->renderer, 1, 1));
+    safeI(SDL_RenderCopy(d->renderer, d->kept, NULL, NULL));
+  }
   SDL_RenderPresent(d->renderer);
+  traceSpan("present", begin, 0, (long) d->base.width * d->base.height);
+  begin = traceClock();
   SDL_Delay(10);
+  traceSpan("show delay", begin, 0, 0);
+  if (d->kept != NULL) {
+    safeI(SDL_SetRenderTarget(d->renderer, d->kept));
+    safeI(SDL_RenderSetScale(d->renderer, d->scale, d->scale));
+    return;
+  }
   safeI(SDL_SetRenderDrawColor(d->renderer, 0, 0, 0, 0xFF));
-  block(d, 0, 0, d->width, d->height);
+  SDL_Rect all = {0, 0, d->base.width / d->scale + 1, d->base.height / d->scale + 1};
+  safeI(SDL_RenderFillRect(d->renderer, &all));
   safeI(SDL_SetRenderDrawColor(d->renderer, d->r, d->g, d->b, d->a));
 }
 
-display *newDisplay(char *name, int width, int height) {
+static void windowSetViewport(display *base, int x, int y, int level) {
+  window *d = (window *) base;
+  d->viewX = x;
+  d->viewY = y;
+  d->scale = level >= 0 ? (float) (1 << level) : 1.0f / (1 << -level);
+  safeI(SDL_RenderSetScale(d->renderer, d->scale, d->scale));
+}
+
+// The kept picture is a target texture, as the window's own buffer is not preserved
+// after it is presented. Switching keeps what has been drawn since the last show.
+static void windowKeepCanvas(display *base, bool keep) {
+  window *d = (window *) base;
+  note(d, 'k', keep, 0, 0, 0);
+  if (keep == (d->kept != NULL)) return;
+  unsigned int *pixels = malloc(sizeof(unsigned int) * d->base.width * d->base.height);
+  windowCapture(base, pixels);
+  if (keep) {
+    d->kept = safeP(SDL_CreateTexture(d->renderer, SDL_PIXELFORMAT_RGBA8888,
+                SDL_TEXTUREACCESS_TARGET, d->base.width, d->base.height));
+    safeI(SDL_SetRenderTarget(d->renderer, d->kept));
+  } else {
+    safeI(SDL_SetRenderTarget(d->renderer, NULL));
+    SDL_DestroyTexture(d->kept);
+    d->kept = NULL;
+  }
+  windowBlit(base, pixels);
+  free(pixels);
+}
+
+// Two actions drawing different frames are never taken for static content, even when
+// they make the same calls (an animation showing the same image twice in a row).
+static void windowStartFrame(display *base, long frame) {
+  note((window *) base, 'f', (int) frame, (int) (frame >> 32), 0, 0);
+}
+
+static display *windowNew(char *name, int width, int height) {
   setbuf(stdout, NULL);
-  display *d = malloc(sizeof(display));
+  window *d = malloc(sizeof(window));
   safeI(SDL_Init(SDL_INIT_VIDEO));
-  d->name = name;
-  d->width = width;
-  d->height = height;
+  d->base = (display) {&windowBackend, name, width, height};
   d->window = safeP(SDL_CreateWindow(name, SDL_WINDOWPOS_UNDEFINED,
                  SDL_WINDOWPOS_UNDEFINED, width, height, SDL_WINDOW_SHOWN));
   d->renderer = safeP(SDL_CreateRenderer(d->window, -1, SDL_RENDERER_ACCELERATED));
+  d->frame = NULL;
+  d->kept = NULL;
+  d->key = 0;
+  d->quit = false;
+  d->drawBegin = d->drawCalls = d->drawPixels = 0;
+  d->viewX = d->viewY = 0;
+  d->scale = 1;
   safeI(SDL_RenderClear(d->renderer));
-  colour(d,0xFF);
-  block(d, 0, 0, width, height);
-  colour(d,0xFFFFFFFF);
-  show(d);
-  return d;
+  windowColour(&d->base, 0xFF);
+  windowBlock(&d->base, 0, 0, width, height);
+  windowColour(&d->base, 0xFFFFFFFF);
+  windowShow(&d->base);
+  return &d->base;
 }
 
-void run(display *d, void *data, bool action(display *, void*, const char)) {
-  bool quit = false;
-  char key = 0;
+// The content is static when an action makes exactly the same calls for the same frame
+// as the one before, with a single show and no pause: then the loop sleeps until an event asks for a redraw
+// (or IDLE_CHECK ms have passed) instead of calling the action again straight away.
+static void windowRun(display *base, void *data, bool action(display *, void*, const char)) {
+  window *d = (window *) base;
+  bool quit = false, first = true;
+  unsigned int previous = 0;
   SDL_Event e;
   while (!quit) {
-    quit = action(d, data, key);
-    key = 0;
-    while (SDL_PollEvent(&e)) {
-      if (e.type == SDL_KEYDOWN) key = (char) e.key.keysym.sym;
-      if (e.type == SDL_QUIT) quit = true;
+    char key = d->key;
+    d->key = 0;
+    d->hash = 2166136261u;
+    d->shows = d->pauses = 0;
+    quit = action(base, data, key) || d->quit;
+    bool still = !first && d->shows == 1 && d->pauses == 0 && d->hash == previous;
+    previous = d->hash;
+    first = false;
+    bool redraw = false;
+    while (still && !redraw && !d->quit) {
+      if (SDL_WaitEventTimeout(&e, IDLE_CHECK)) redraw = handle(d, &e);
+      else redraw = true;
     }
+    while (SDL_PollEvent(&e)) handle(d, &e);
+    quit = quit || d->quit;
   }
 }
 
-void freeDisplay(display *d) {
+static void windowFree(display *base) {
+  window *d = (window *) base;
+  if (d->frame != NULL) SDL_DestroyTexture(d->frame);
+  if (d->kept != NULL) SDL_DestroyTexture(d->kept);
   SDL_DestroyRenderer(d->renderer);
   SDL_DestroyWindow(d->window);
   SDL_Quit();
   free(d);
 }
+
+const backend windowBackend = {
+  "window", false, windowNew, windowFree, windowPause, windowShow, windowLine, windowBlock,
+  windowColour, windowCapture, windowBlit, windowSetViewport, windowKeepCanvas,
+  windowStartFrame, windowRun
+};
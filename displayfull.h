@@ -59,7 +59,32 @@ void block(display *d, int x, int y, int w, int h);
 // from the most to the least significant byte. (Default is white)
 void colour(display *d, int rgba);
 
+// Copy what has been drawn since the last show into pixels, which must hold width*height
+// packed rgba ints (same packing as for colour), row by row from the top left corner.
+void capture(display *d, unsigned int *pixels);
+
+// Draw width*height packed rgba ints (as filled in by capture) over the whole display.
+// (must call show to make it appear)
+void blit(display *d, unsigned int *pixels);
+
+// Draw the part of the picture starting at (x,y) magnified 2^level times (a negative level
+// zooms out). The default view is (0,0) at level 0. Only the window display zooms, other
+// display modules draw at the default view.
+void setViewport(display *d, int x, int y, int level);
+
+// Keep what has been drawn from one show to the next if keep is true, so frames only
+// draw what changes, or clear the display to black after every show (the default).
+void keepCanvas(display *d, bool keep);
+
+// Say which frame of the content the calls up to the next show draw, as a number telling
+// its frames apart (e.g. where the frame starts in its file). Only the window uses it, to
+// tell content that is static from an animation showing the same image twice in a row.
+void startFrame(display *d, long frame);
+
 // Runs the (drawing) function action repeatedly until the display is closed or action returns true.
 // The function action is provided with a pointer to the display, a pointer to the data,
 // and a char representing the currently pressed key on the keyboard.
+// When action keeps making the same calls for the same frame (see startFrame) with one show
+// and no pause, the content is static and run() sleeps until a key, an expose/resize of the
+// window or a periodic check.
 void run(display *d, void *data, bool action(display*, void*, const char));
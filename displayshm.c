@@ -0,0 +1,355 @@
+// This display backend hands the shown images to other processes through a shared-memory ring.
+// -----------------------------------------------------------------------------------------------
+// Drawing goes straight into the next free frame buffer of the ring (see shmring.h), and show()
+// publishes it, waking the consumers waiting on the ring, so a compositor or recorder on the same
+// machine reads the frames in place instead of grabbing them from a window. Every frame carries
+// the sketch frame it belongs to and the milliseconds paused before it. Pauses and the 10ms
+// after each show are slept through like in the viewer, unless -f asks for frames as fast as
+// they are drawn.
+// Usage: ./shm [-n slots] [-t seconds] [-f] name file.sk   (play file.sk into the ring called name)
+//        ./shm -c name count [prefix]                      (take count frames, saved as prefix000.ppm, ...)
+//        (without arguments the tests are run)
+#define _POSIX_C_SOURCE 200809L
+#include "displayfull.h"
+#include "backend.h"
+#include "sketch.h"
+#include "canvas.h"
+#include "shmring.h"
+#include <time.h>
+#include <signal.h>
+
+// Display drawing into the frame buffers of a ring, with a clock of the time played (see backend.h)
+typedef struct publisher {
+  display base;
+  canvas drawing;
+  unsigned int *scratch;
+  ring *r;
+  unsigned int frame, paused;
+  double clock, limit;
+  bool realTime, keep;
+} publisher;
+
+// Let ms milliseconds of the sketch pass, sleeping unless frames are wanted as fast as possible
+static void elapse(publisher *d, int ms) {
+  d->clock += ms;
+  if (!d->realTime || ms <= 0) return;
+  struct timespec t = {ms / 1000, (ms % 1000) * 1000000L};
+  nanosleep(&t, NULL);
+}
+
+static void shmPause(display *base, int ms) {
+  publisher *d = (publisher *) base;
+  if (ms <= 0) return;
+  d->paused += ms;
+  elapse(d, ms);
+}
+
+static void shmLine(display *d, int x0, int y0, int x1, int y1) {
+  canvasLine(&((publisher *) d)->drawing, x0, y0, x1, y1);
+}
+
+static void shmBlock(display *d, int x, int y, int w, int h) {
+  canvasBlock(&((publisher *) d)->drawing, x, y, w, h);
+}
+
+static void shmColour(display *d, int rgba) {
+  ((publisher *) d)->drawing.rgba = rgba;
+}
+
+static void shmCapture(display *d, unsigned int *pixels) {
+  memcpy(pixels, ((publisher *) d)->drawing.pixels, sizeof(unsigned int) * d->width * d->height);
+}
+
+static void shmBlit(display *d, unsigned int *pixels) {
+  memcpy(((publisher *) d)->drawing.pixels, pixels, sizeof(unsigned int) * d->width * d->height);
+}
+
+static void shmShow(display *base) {
+  publisher *d = (publisher *) base;
+  unsigned int *published = d->drawing.pixels;
+  if (d->r != NULL) {
+    publishFrame(d->r, d->frame, d->paused);
+    d->drawing.pixels = ringBuffer(d->r);
+  }
+  d->paused = 0;
+  // A kept canvas goes on from the published frame in the next buffer of the ring
+  if (!d->keep) clearCanvas(&d->drawing, 0xFF);
+  else if (published != d->drawing.pixels) memcpy(d->drawing.pixels, published, sizeof(unsigned int) * base->width * base->height);
+  elapse(d, 10);
+}
+
+// The view is not changed, the picture is drawn at the default view.
+static void shmSetViewport(display *d, int x, int y, int level) {
+}
+
+static void shmKeepCanvas(display *d, bool keep) {
+  ((publisher *) d)->keep = keep;
+}
+
+// Frames are numbered by run(), the position in the file is not needed.
+static void shmStartFrame(display *d, long frame) {
+}
+
+static display *shmNew(char *name, int width, int height) {
+  publisher *d = malloc(sizeof(publisher));
+  d->base = (display) {&shmBackend, name, width, height};
+  d->scratch = malloc(sizeof(unsigned int) * width * height);
+  d->drawing = (canvas) {width, height, 0xFFFFFFFF, d->scratch};
+  clearCanvas(&d->drawing, 0xFF);
+  d->r = NULL;
+  d->frame = d->paused = 0;
+  d->clock = d->limit = 0;
+  d->realTime = true;
+  d->keep = false;
+  return &d->base;
+}
+
+// Create the ring the display publishes its frames to, returns false if it cannot be set up
+static bool startRing(publisher *d, char *name, int slots) {
+  d->r = createRing(name, d->base.width, d->base.height, slots);
+  if (d->r == NULL) return false;
+  d->drawing.pixels = ringBuffer(d->r);
+  clearCanvas(&d->drawing, 0xFF);
+  return true;
+}
+
+// Play frames until action returns true or the time limit (if one is set) is reached
+static void shmRun(display *base, void *data, bool action(display *, void*, const char)) {
+  publisher *d = (publisher *) base;
+  bool quit = false;
+  while (!quit && (d->limit <= 0 || d->clock < d->limit)) {
+    quit = action(base, data, 0);
+    d->frame++;
+  }
+}
+
+static void shmFree(display *base) {
+  publisher *d = (publisher *) base;
+  if (d->r != NULL) closeRing(d->r);
+  free(d->scratch);
+  free(d);
+}
+
+const backend shmBackend = {
+  "shm", true, shmNew, shmFree, shmPause, shmShow, shmLine, shmBlock, shmColour,
+  shmCapture, shmBlit, shmSetViewport, shmKeepCanvas, shmStartFrame, shmRun
+};
+
+// Take count frames from the ring called name, printing what they are and saving them as
+// prefix000.ppm, ... if a prefix is given. Returns the number of frames taken.
+int consume(char *name, int count, char *prefix) {
+  ring *r = openRing(name);
+  if (r == NULL) {
+    fprintf(stderr, "Error: no ring called %s\n", name);
+    exit(1);
+  }
+  int w = ringWidth(r), h = ringHeight(r), taken = 0;
+  unsigned char *rgb = malloc(3 * w * h);
+  ringFrame f;
+  while (taken < count && nextFrame(r, &f, 5000)) {
+    for (int i = 0; i < w * h; i++) {
+      for (int c = 0; c < 3; c++) rgb[3 * i + c] = f.pixels[i] >> (24 - 8 * c);
+    }
+    bool valid = frameValid(r, &f);
+    printf("frame %llu: sketch frame %u, paused %u ms%s\n", f.index, f.frame, f.pause, valid ? "" : ", overwritten");
+    if (prefix != NULL && valid) {
+      char filename[strlen(prefix) + 16];
+      sprintf(filename, "%s%03d.ppm", prefix, taken);
+      FILE *out = fopen(filename, "wb");
+      if (out != NULL) {
+        fprintf(out, "P6\n%d %d\n255\n", w, h);
+        fwrite(rgb, 1, 3 * w * h, out);
+        fclose(out);
+      }
+    }
+    taken++;
+  }
+  free(rgb);
+  closeRing(r);
+  return taken;
+}
+
+// A replacement for the library assert function.
+void assert(int line, bool b) {
+  if (b) return;
+  printf("The test on line %d fails.\n", line);
+  exit(1);
+}
+
+// Test publishing and taking frames, skipping overwritten ones
+void testRing() {
+  ring *producer = createRing("/sketchshm.tmp", 4, 4, 3);
+  assert(__LINE__, producer != NULL);
+  ring *consumer = openRing("/sketchshm.tmp");
+  assert(__LINE__, consumer != NULL && ringWidth(consumer) == 4 && ringHeight(consumer) == 4);
+  ringFrame f, g;
+  assert(__LINE__, !nextFrame(consumer, &f, 10));
+  ringBuffer(producer)[0] = 42;
+  publishFrame(producer, 7, 100);
+  assert(__LINE__, nextFrame(consumer, &f, 10));
+  assert(__LINE__, f.index == 0 && f.frame == 7 && f.pause == 100 && f.pixels[0] == 42);
+  assert(__LINE__, frameValid(consumer, &f));
+  for (int i = 1; i < 4; i++) {
+    ringBuffer(producer)[0] = 42 + i;
+    publishFrame(producer, 7, 0);
+  }
+  assert(__LINE__, !frameValid(consumer, &f));
+  assert(__LINE__, nextFrame(consumer, &g, 10));
+  assert(__LINE__, g.index == 2 && g.pixels[0] == 44);
+  ringBuffer(producer);
+  assert(__LINE__, nextFrame(consumer, &g, 10));
+  assert(__LINE__, g.index == 3 && g.pixels[0] == 45);
+  assert(__LINE__, !nextFrame(consumer, &g, 10));
+  closeRing(consumer);
+  closeRing(producer);
+  assert(__LINE__, openRing("/sketchshm.tmp") == NULL);
+}
+
+// Write an int into the header of the ring called /sketchshm.tmp, the header starting with
+// the ints magic, width, height and slots
+static void corrupt(int position, int value) {
+  FILE *file = fopen("/dev/shm/sketchshm.tmp", "r+b");
+  assert(__LINE__, file != NULL);
+  fseek(file, sizeof(int) * position, SEEK_SET);
+  fwrite(&value, sizeof(int), 1, file);
+  fclose(file);
+}
+
+// Test that rings with a header not describing their shared memory are not opened
+void testCorrupt() {
+  ring *producer = createRing("/sketchshm.tmp", 4, 4, 3);
+  int fields[][2] = {{1, 5}, {1, 0}, {2, -4}, {3, 1}, {3, 4}, {1, 1 << 30}, {3, 1 << 30}};
+  int sizes[] = {0, 4, 4, 3};
+  for (int i = 0; i < 7; i++) {
+    corrupt(fields[i][0], fields[i][1]);
+    assert(__LINE__, openRing("/sketchshm.tmp") == NULL);
+    corrupt(fields[i][0], sizes[fields[i][0]]);
+    ring *consumer = openRing("/sketchshm.tmp");
+    assert(__LINE__, consumer != NULL);
+    closeRing(consumer);
+  }
+  closeRing(producer);
+}
+
+// Signals interrupting nextFrame in testTimeout need not do anything
+static void interrupted(int signal) {
+}
+
+// Milliseconds on a monotonic clock
+static double milliseconds() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+// Test that a consumer waits for a frame for the time given in all, when signals
+// interrupt the wait every 10ms
+void testTimeout() {
+  ring *producer = createRing("/sketchshm.tmp", 4, 4, 3);
+  ring *consumer = openRing("/sketchshm.tmp");
+  struct sigaction action = {0};
+  action.sa_handler = interrupted;
+  sigaction(SIGUSR1, &action, NULL);
+  struct sigevent event = {0};
+  event.sigev_notify = SIGEV_SIGNAL;
+  event.sigev_signo = SIGUSR1;
+  timer_t timer;
+  assert(__LINE__, timer_create(CLOCK_MONOTONIC, &event, &timer) == 0);
+  struct itimerspec every = {{0, 10000000}, {0, 10000000}};
+  timer_settime(timer, 0, &every, NULL);
+  ringFrame f;
+  double begin = milliseconds();
+  bool taken = nextFrame(consumer, &f, 100);
+  double waited = milliseconds() - begin;
+  timer_delete(timer);
+  assert(__LINE__, !taken && waited >= 100 && waited < 200);
+  closeRing(consumer);
+  closeRing(producer);
+}
+
+// Test playing sketch files into a ring: the images shown, their frames and pauses
+void testPlay() {
+  publisher *d = (publisher *) openDisplay(&shmBackend, "sketch08.sk", 200, 200);
+  d->realTime = false;
+  assert(__LINE__, startRing(d, "/sketchshm.tmp", 8));
+  ring *consumer = openRing("/sketchshm.tmp");
+  state *s = newState();
+  do processSketch(&d->base, s, 0);
+  while (s->start != 0);
+  ringFrame f;
+  int pauses = 0, images = 0;
+  while (nextFrame(consumer, &f, 0)) {
+    pauses += f.pause;
+    images++;
+  }
+  assert(__LINE__, images == 3 && pauses == 2 * 192);
+  freeState(s);
+  closeRing(consumer);
+  freeDisplay(&d->base);
+  d = (publisher *) openDisplay(&shmBackend, "sketch00.sk", 200, 200);
+  d->realTime = false;
+  assert(__LINE__, startRing(d, "/sketchshm.tmp", 8));
+  consumer = openRing("/sketchshm.tmp");
+  s = newState();
+  d->limit = 25;
+  run(&d->base, s, processSketch);
+  assert(__LINE__, nextFrame(consumer, &f, 0) && f.frame == 0);
+  assert(__LINE__, f.pixels[10 * 200 + 10] == 0xFFFFFFFF && f.pixels[10 * 200 + 20] == 0xFF);
+  assert(__LINE__, nextFrame(consumer, &f, 0) && f.frame == 1);
+  freeState(s);
+  closeRing(consumer);
+  freeDisplay(&d->base);
+}
+
+// Run tests
+void test() {
+  testRing();
+  testCorrupt();
+  testTimeout();
+  testPlay();
+  printf("All tests passed.\n");
+}
+
+int main(int n, char *args[n]) {
+  if (n == 1) {
+    test();
+    return 0;
+  }
+  if (strcmp(args[1], "-c") == 0 && (n == 4 || n == 5)) {
+    consume(args[2], atoi(args[3]), n == 5 ? args[4] : NULL);
+    return 0;
+  }
+  char *name = NULL, *filename = NULL;
+  int slots = 8;
+  double seconds = 0;
+  bool realTime = true;
+  for (int i = 1; i < n; i++) {
+    if (strcmp(args[i], "-n") == 0 && i + 1 < n) slots = atoi(args[++i]);
+    else if (strcmp(args[i], "-t") == 0 && i + 1 < n) seconds = atof(args[++i]);
+    else if (strcmp(args[i], "-f") == 0) realTime = false;
+    else if (name == NULL) name = args[i];
+    else filename = args[i];
+  }
+  if (filename == NULL) {
+    fprintf(stderr, "Use ./shm [-n slots] [-t seconds] [-f] name file or ./shm -c name count [prefix]\n");
+    exit(1);
+  }
+  FILE *sketchFile = fopen(filename, "rb");
+  if (sketchFile == NULL) {
+    fprintf(stderr, "Error: cannot open %s\n", filename);
+    exit(1);
+  }
+  fclose(sketchFile);
+  publisher *d = (publisher *) openDisplay(&shmBackend, filename, 200, 200);
+  d->realTime = realTime;
+  d->limit = seconds * 1000;
+  if (!startRing(d, name, slots)) {
+    fprintf(stderr, "Error: cannot create the ring %s\n", name);
+    exit(1);
+  }
+  state *s = newState();
+  run(&d->base, s, processSketch);
+  freeState(s);
+  freeDisplay(&d->base);
+  return 0;
+}
@@ -0,0 +1,175 @@
+// Frame cache for the sketch viewer, see framecache.h for how to use it.
+#include "framecache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// Number of hash buckets for frames and for snapshots
+#define BUCKETS 1024
+
+// Cache object: hash tables of frames and snapshots, and the frames in LRU order
+struct framecache {
+    int width, height;
+    long budget, used;
+    frame *frames[BUCKETS];
+    snapshot *shots[BUCKETS];
+    frame *newest, *oldest;
+};
+
+// Create a cache for images of width*height pixels using at most budget bytes.
+framecache *newFrameCache(int width, int height, long budget) {
+    framecache *c = calloc(1, sizeof(framecache));
+    c->width = width;
+    c->height = height;
+    c->budget = budget;
+    return c;
+}
+
+// Hash n bytes (FNV-1a), used to tell frames with different content apart.
+unsigned int hashBytes(unsigned char *bytes, int n) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < n; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Bucket of a frame in the frame table
+static int frameBucket(unsigned int start, unsigned int hash) {
+    return (start * 31 + hash) % BUCKETS;
+}
+
+// Bytes of pixel memory taken by one snapshot
+static long shotSize(framecache *c) {
+    return sizeof(snapshot) + sizeof(unsigned int) * c->width * c->height;
+}
+
+// Take a frame out of the LRU list
+static void detach(framecache *c, frame *f) {
+    if (f->newer != NULL) f->newer->older = f->older;
+    else c->newest = f->older;
+    if (f->older != NULL) f->older->newer = f->newer;
+    else c->oldest = f->newer;
+    f->newer = f->older = NULL;
+}
+
+// Put a frame at the front of the LRU list
+static void touch(framecache *c, frame *f) {
+    f->older = c->newest;
+    f->newer = NULL;
+    if (c->newest != NULL) c->newest->newer = f;
+    c->newest = f;
+    if (c->oldest == NULL) c->oldest = f;
+}
+
+// Drop one reference to a snapshot and free it once no frame uses it
+static void releaseShot(framecache *c, snapshot *shot) {
+    shot->refs--;
+    if (shot->refs > 0) return;
+    snapshot **p = &c->shots[shot->hash % BUCKETS];
+    while (*p != shot) p = &(*p)->next;
+    *p = shot->next;
+    c->used -= shotSize(c);
+    free(shot->pixels);
+    free(shot);
+}
+
+// Release the snapshots and memory of a frame that is not in the cache tables
+static void freeFrame(framecache *c, frame *f) {
+    for (int i = 0; i < f->count; i++) {
+        if (f->steps[i].shot != NULL) releaseShot(c, f->steps[i].shot);
+    }
+    c->used -= sizeof(frame) + sizeof(step) * f->capacity;
+    free(f->steps);
+    free(f);
+}
+
+// Remove a frame from the cache tables and free it
+static void evict(framecache *c, frame *f) {
+    frame **p = &c->frames[frameBucket(f->start, f->hash)];
+    while (*p != f) p = &(*p)->next;
+    *p = f->next;
+    detach(c, f);
+    freeFrame(c, f);
+}
+
+// Release the cache together with all frames and images in it.
+void freeFrameCache(framecache *c) {
+    while (c->oldest != NULL) evict(c, c->oldest);
+    free(c);
+}
+
+// Find the frame starting at start with the given content hash and colour,
+// and mark it as recently used. Returns NULL if the frame is not cached.
+frame *findFrame(framecache *c, unsigned int start, unsigned int hash, unsigned int colourIn) {
+    frame *f = c->frames[frameBucket(start, hash)];
+    while (f != NULL) {
+        if (f->start == start && f->hash == hash && f->colourIn == colourIn) {
+            detach(c, f);
+            touch(c, f);
+            return f;
+        }
+        f = f->next;
+    }
+    return NULL;
+}
+
+// Start recording a new frame. It only becomes visible to findFrame after endFrame.
+frame *beginFrame(framecache *c, unsigned int start, unsigned int hash, unsigned int colourIn) {
+    frame *f = calloc(1, sizeof(frame));
+    f->start = start;
+    f->hash = hash;
+    f->colourIn = colourIn;
+    c->used += sizeof(frame);
+    return f;
+}
+
+// Append a step to a frame, growing its step array as needed
+static void addStep(frame *f, snapshot *shot, int ms) {
+    if (f->count == f->capacity) {
+        f->capacity = f->capacity == 0 ? 4 : f->capacity * 2;
+        f->steps = realloc(f->steps, sizeof(step) * f->capacity);
+    }
+    f->steps[f->count] = (step) {shot, ms};
+    f->count++;
+}
+
+// Record an image of width*height packed RGBA ints presented by the frame (the pixels are copied).
+void addImage(framecache *c, frame *f, unsigned int *pixels) {
+    int n = c->width * c->height;
+    unsigned int hash = hashBytes((unsigned char *) pixels, sizeof(unsigned int) * n);
+    snapshot *shot = c->shots[hash % BUCKETS];
+    while (shot != NULL) {
+        if (shot->hash == hash && memcmp(shot->pixels, pixels, sizeof(unsigned int) * n) == 0) break;
+        shot = shot->next;
+    }
+    if (shot == NULL) {
+        shot = malloc(sizeof(snapshot));
+        shot->pixels = malloc(sizeof(unsigned int) * n);
+        memcpy(shot->pixels, pixels, sizeof(unsigned int) * n);
+        shot->hash = hash;
+        shot->refs = 0;
+        shot->next = c->shots[hash % BUCKETS];
+        c->shots[hash % BUCKETS] = shot;
+        c->used += shotSize(c);
+    }
+    shot->refs++;
+    addStep(f, shot, 0);
+}
+
+// Record a pause of ms milliseconds made by the frame.
+void addPause(frame *f, int ms) {
+    addStep(f, NULL, ms);
+}
+
+// Finish recording a frame, insert it into the cache and evict frames over the budget.
+void endFrame(framecache *c, frame *f, unsigned int colourOut) {
+    f->colourOut = colourOut;
+    c->used += sizeof(step) * f->capacity;
+    int bucket = frameBucket(f->start, f->hash);
+    f->next = c->frames[bucket];
+    c->frames[bucket] = f;
+    touch(c, f);
+    while (c->used > c->budget && c->oldest != NULL) evict(c, c->oldest);
+}
@@ -0,0 +1,57 @@
+// Frame cache for the sketch viewer.
+// -----------------------------------------------------------------
+// A looping animation plays the same frames again and again. The cache keeps the
+// rendered output of each frame (the images it presented and the pauses between
+// them) so that later loops can blit the images instead of decoding and drawing
+// the frame again. Frames are keyed by their start position in the sketch file,
+// a hash of their bytes and the drawing colour they start with. Identical images
+// are stored once and shared, and the least recently used frames are evicted
+// once the pixel memory goes over the budget given to newFrameCache.
+
+// A frame cache object, create it with newFrameCache and free it with freeFrameCache.
+struct framecache;
+typedef struct framecache framecache;
+
+// A rendered image held by the cache, shared by all frames that presented it.
+typedef struct snapshot {
+    unsigned int *pixels;
+    unsigned int hash;
+    int refs;
+    struct snapshot *next;
+} snapshot;
+
+// A step of a cached frame: either an image to present or (if shot is NULL) a pause in milliseconds.
+typedef struct step { snapshot *shot; int ms; } step;
+
+// A cached frame: the steps it produced and the drawing colour it left behind.
+typedef struct frame {
+    unsigned int start, hash, colourIn, colourOut;
+    int count, capacity;
+    step *steps;
+    struct frame *next, *newer, *older;
+} frame;
+
+// Create a cache for images of width*height pixels using at most budget bytes.
+framecache *newFrameCache(int width, int height, long budget);
+
+// Release the cache together with all frames and images in it.
+void freeFrameCache(framecache *c);
+
+// Hash n bytes (FNV-1a), used to tell frames with different content apart.
+unsigned int hashBytes(unsigned char *bytes, int n);
+
+// Find the frame starting at start with the given content hash and colour,
+// and mark it as recently used. Returns NULL if the frame is not cached.
+frame *findFrame(framecache *c, unsigned int start, unsigned int hash, unsigned int colourIn);
+
+// Start recording a new frame. It only becomes visible to findFrame after endFrame.
+frame *beginFrame(framecache *c, unsigned int start, unsigned int hash, unsigned int colourIn);
+
+// Record an image of width*height packed RGBA ints presented by the frame (the pixels are copied).
+void addImage(framecache *c, frame *f, unsigned int *pixels);
+
+// Record a pause of ms milliseconds made by the frame.
+void addPause(frame *f, int ms);
+
+// Finish recording a frame, insert it into the cache and evict frames over the budget.
+void endFrame(framecache *c, frame *f, unsigned int colourOut);
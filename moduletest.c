@@ -0,0 +1,489 @@
+// Module tests: tests of the library modules shared by the viewer and the tools, which
+// have no program of their own to test them. Each module's tests are in a section of
+// their own.
+// Usage: ./moduletest
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include "displayfull.h"
+#include "backend.h"
+#include "sketch.h"
+#include "tools.h"
+#include "canvas.h"
+#include "recorder.h"
+#include "framecache.h"
+#include "scene.h"
+#include "decoder.h"
+#include "wall.h"
+#include "trace.h"
+#include "scan.h"
+
+// Size of the display the example sketches are drawn on
+#define WIDTH 200
+#define HEIGHT 200
+
+// A replacement for the library assert function.
+void assert(int line, bool b) {
+    if (b) return;
+    printf("The test on line %d fails.\n", line);
+    exit(1);
+}
+
+// Read a whole file into a newly allocated array, storing its length in n
+static unsigned char *readBytes(char *filename, long *n) {
+    FILE *file = fopen(filename, "rb");
+    assert(__LINE__, file != NULL);
+    fseek(file, 0, SEEK_END);
+    *n = ftell(file);
+    unsigned char *bytes = malloc(*n);
+    rewind(file);
+    assert(__LINE__, fread(bytes, 1, *n, file) == *n);
+    fclose(file);
+    return bytes;
+}
+
+// Frame cache (framecache.c)
+// -----------------------------------------------------------------
+
+// Cache a frame at start (with start as its content hash) that presents a 4x4 image
+// filled with one value and then pauses
+static frame *cacheFrame(framecache *c, unsigned int start, unsigned int colourIn, unsigned int fill) {
+    unsigned int pixels[16];
+    for (int i = 0; i < 16; i++) pixels[i] = fill;
+    frame *f = beginFrame(c, start, start, colourIn);
+    addImage(c, f, pixels);
+    addPause(f, 40);
+    endFrame(c, f, colourIn + 1);
+    return f;
+}
+
+// Test that the frame cache finds frames by start, content and colour, shares identical
+// images between frames and evicts the least recently used frames over its budget
+void testFrameCache() {
+    long size = sizeof(frame) + 4 * sizeof(step) + sizeof(snapshot) + 16 * sizeof(unsigned int);
+    framecache *c = newFrameCache(4, 4, 3 * size);
+    frame *a = cacheFrame(c, 10, 0, 1), *b = cacheFrame(c, 20, 0, 2), *d = cacheFrame(c, 30, 0, 3);
+    assert(__LINE__, b != NULL && findFrame(c, 10, 11, 0) == NULL && findFrame(c, 10, 10, 5) == NULL);
+    assert(__LINE__, findFrame(c, 10, 10, 0) == a && a->colourOut == 1 && a->count == 2);
+    assert(__LINE__, a->steps[0].shot->pixels[15] == 1 && a->steps[1].shot == NULL && a->steps[1].ms == 40);
+    // The three frames fill the budget, so a fourth evicts b, used least recently
+    frame *e = cacheFrame(c, 40, 0, 4);
+    assert(__LINE__, findFrame(c, 20, 20, 0) == NULL);
+    assert(__LINE__, findFrame(c, 10, 10, 0) == a && findFrame(c, 30, 30, 0) == d && findFrame(c, 40, 40, 0) == e);
+    // The same frame starting with another colour is cached apart, sharing a's image,
+    // which outlives a when a is evicted to make room
+    snapshot *shot = a->steps[0].shot;
+    unsigned int pixels[16];
+    for (int i = 0; i < 16; i++) pixels[i] = 1;
+    frame *f = beginFrame(c, 10, 10, 7);
+    addImage(c, f, pixels);
+    assert(__LINE__, f->steps[0].shot == shot && shot->refs == 2);
+    endFrame(c, f, 8);
+    assert(__LINE__, findFrame(c, 10, 10, 0) == NULL && findFrame(c, 10, 10, 7) == f);
+    assert(__LINE__, shot->refs == 1 && shot->pixels[15] == 1);
+    assert(__LINE__, findFrame(c, 30, 30, 0) == d && findFrame(c, 40, 40, 0) == e);
+    freeFrameCache(c);
+}
+
+// Scenes (scene.c)
+// -----------------------------------------------------------------
+
+// The frames of a sketch held in memory, drawn through their scenes for the area from
+// (left,top) up to (right,bottom) excluded, where the next one starts and its colour
+typedef struct viewed { unsigned char *bytes; long n, start; int area[4]; unsigned int rgba; } viewed;
+
+// Draw the next frame through its scene like the viewer does once the view is moved,
+// returns true after the last one
+static bool drawViewed(display *d, void *data, const char key) {
+    viewed *v = data;
+    long end = v->start;
+    while (end < v->n && (getOpcode(v->bytes[end]) != TOOL || getOperand(v->bytes[end]) != NEXTFRAME)) end++;
+    bool last = (end == v->n);
+    if (!last) end++;
+    scene *sc = buildScene(v->bytes + v->start, end - v->start, v->rgba, last);
+    drawScene(d, sc, v->area[0], v->area[1], v->area[2], v->area[3]);
+    v->rgba = sceneColour(sc);
+    freeScene(sc);
+    v->start = end;
+    return last;
+}
+
+// Check that two recordings show as many images and the same pixels inside an area of them
+static bool sameInside(recording *a, recording *b, int area[4]) {
+    player pa = {a, newCanvas(WIDTH, HEIGHT), 0, 0, false}, pb = {b, newCanvas(WIDTH, HEIGHT), 0, 0, false};
+    bool same = true, moreA, moreB;
+    do {
+        moreA = nextImage(&pa);
+        moreB = nextImage(&pb);
+        same = moreA == moreB;
+        for (int y = area[1] < 0 ? 0 : area[1]; same && y < area[3] && y < HEIGHT; y++) {
+            for (int x = area[0] < 0 ? 0 : area[0]; x < area[2] && x < WIDTH; x++) {
+                same = same && pa.c->pixels[y * WIDTH + x] == pb.c->pixels[y * WIDTH + x];
+            }
+        }
+    } while (same && moreA);
+    freeCanvas(pa.c);
+    freeCanvas(pb.c);
+    return same;
+}
+
+// Test that the example sketches drawn through their scenes (scene.h) for several views
+// show the same pixels inside the view as the whole sketch obeyed command by command, and
+// that small views leave out primitives
+void testScenes() {
+    int areas[][4] = {{0, 0, 200, 200}, {50, 50, 150, 150}, {75, 87, 125, 137}, {81, 87, 106, 112},
+                      {-50, -50, 100, 100}, {150, 10, 400, 60}, {190, 190, 200, 200}, {0, 199, 200, 200},
+                      {37, 0, 38, 200}, {0, 113, 200, 114}};
+    int count = sizeof(areas) / sizeof(areas[0]);
+    long fullCalls = 0, smallCalls = 0;
+    char filename[12];
+    for (int i = 0; i < 10; i++) {
+        sprintf(filename, "sketch%02d.sk", i);
+        long n;
+        unsigned char *bytes = readBytes(filename, &n);
+        recording *full = recordSketch(filename, WIDTH, HEIGHT);
+        for (int k = 0; k < count; k++) {
+            viewed v = {bytes, n, 0, {areas[k][0], areas[k][1], areas[k][2], areas[k][3]}, 0xFFFFFFFF};
+            display *d = openDisplay(&recordBackend, filename, WIDTH, HEIGHT);
+            run(d, &v, drawViewed);
+            recording *r = displayRecording(d);
+            assert(__LINE__, r->frames == full->frames);
+            assert(__LINE__, sameInside(full, r, areas[k]));
+            if (k == 3) {
+                fullCalls += full->count;
+                smallCalls += r->count;
+            }
+            freeDisplay(d);
+        }
+        freeRecording(full);
+        free(bytes);
+    }
+    assert(__LINE__, smallCalls < fullCalls);
+}
+
+// Push decoder (decoder.c)
+// -----------------------------------------------------------------
+
+// Check that two recordings make the same calls, however they are split into frames
+static bool sameCalls(recording *a, recording *b) {
+    return a->count == b->count && memcmp(a->calls, b->calls, sizeof(call) * a->count) == 0;
+}
+
+// Push n bytes into a decoder drawing on a display of the record backend, in pieces of
+// the given size or, if size is 0, of random sizes from 1 to 64 bytes. Returns true if
+// the calls are the same as the ones of the recording.
+static bool samePushed(unsigned char *bytes, long n, int size, unsigned int *seed, recording *r) {
+    display *d = openDisplay(&recordBackend, "", WIDTH, HEIGHT);
+    decoder *p = newDecoder();
+    for (long i = 0; i < n; ) {
+        *seed = *seed * 1103515245 + 12345;
+        int piece = size > 0 ? size : (*seed >> 16) % 64 + 1;
+        if (piece > n - i) piece = n - i;
+        pushBytes(d, p, bytes + i, piece);
+        i += piece;
+    }
+    endSketch(d, p);
+    bool same = sameCalls(displayRecording(d), r);
+    freeDecoder(p);
+    freeDisplay(d);
+    return same;
+}
+
+// Test that the example sketches pushed into a decoder a byte at a time, and split at
+// random places, make the same calls as when played from their files
+void testPushed() {
+    char filename[12];
+    unsigned int seed = 1;
+    for (int i = 0; i < 10; i++) {
+        sprintf(filename, "sketch%02d.sk", i);
+        long n;
+        unsigned char *bytes = readBytes(filename, &n);
+        recording *r = recordSketch(filename, WIDTH, HEIGHT);
+        assert(__LINE__, samePushed(bytes, n, n, &seed, r));
+        assert(__LINE__, samePushed(bytes, n, 1, &seed, r));
+        for (int k = 0; k < 5; k++) assert(__LINE__, samePushed(bytes, n, 0, &seed, r));
+        freeRecording(r);
+        free(bytes);
+    }
+}
+
+// Wall (wall.c)
+// -----------------------------------------------------------------
+
+// Check that tile i of a wall (of 200x200 tiles) shows the image of a player
+static bool sameTile(wall *w, int i, player *p) {
+    int columns = wallWidth(w) / WIDTH;
+    unsigned int *tile = wallPixels(w) + (i / columns) * HEIGHT * wallWidth(w) + (i % columns) * WIDTH;
+    for (int y = 0; y < HEIGHT; y++) {
+        if (memcmp(tile + y * wallWidth(w), p->c->pixels + y * WIDTH, sizeof(unsigned int) * WIDTH) != 0) return false;
+    }
+    return true;
+}
+
+// Draw the next image of a player, going back to the first one after the last
+static void nextLooping(player *p) {
+    if (nextImage(p)) return;
+    p->i = p->frame = 0;
+    p->keep = false;
+    nextImage(p);
+}
+
+// Test that the tiles of a wall of the example sketches show the images of their sketches
+// in order, until every tile has been through all of its images
+void testWall() {
+    char filenames[10][12], *names[10];
+    player players[10];
+    int shows[10], seen[10];
+    for (int i = 0; i < 10; i++) {
+        sprintf(filenames[i], "sketch%02d.sk", i);
+        names[i] = filenames[i];
+        players[i] = (player) {recordSketch(names[i], WIDTH, HEIGHT), newCanvas(WIDTH, HEIGHT), 0, 0, false};
+        shows[i] = seen[i] = 0;
+        for (int k = 0; k < players[i].r->count; k++) shows[i] += players[i].r->calls[k].kind == SHOWCALL;
+    }
+    wall *w = newWall(10, names, 3);
+    assert(__LINE__, wallWidth(w) == 4 * WIDTH && wallHeight(w) == 3 * HEIGHT);
+    bool done = false;
+    for (int round = 0; round < 10000 && !done; round++) {
+        if (stepWall(w)) {
+            for (int i = 0; i < 10; i++) {
+                if (sameTile(w, i, &players[i])) continue;
+                // Images the same as the one before do not change the tile
+                unsigned int before[WIDTH * HEIGHT];
+                memcpy(before, players[i].c->pixels, sizeof(before));
+                do {
+                    nextLooping(&players[i]);
+                    seen[i]++;
+                } while (memcmp(before, players[i].c->pixels, sizeof(before)) == 0 && seen[i] < 2 * shows[i]);
+                assert(__LINE__, sameTile(w, i, &players[i]));
+            }
+        }
+        done = true;
+        for (int i = 0; i < 10; i++) done = done && seen[i] >= shows[i];
+        int ms = wallWait(w);
+        nanosleep(&(struct timespec) {ms / 1000, (ms % 1000) * 1000000L}, NULL);
+    }
+    assert(__LINE__, done);
+    freeWall(w);
+    for (int i = 0; i < 10; i++) {
+        freeRecording(players[i].r);
+        freeCanvas(players[i].c);
+    }
+}
+
+// Tracing (trace.c)
+// -----------------------------------------------------------------
+
+// Read the next span of a trace, false at the end of the events
+static bool readSpan(FILE *file, char *name, long span[4], bool *more) {
+    char line[256], after[4] = "";
+    if (fgets(line, sizeof(line), file) == NULL) return false;
+    int found = sscanf(line, "{\"name\":\"%15[^\"]\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%ld,\"dur\":%ld,"
+                       "\"args\":{\"commands\":%ld,\"pixels\":%ld}}%3s", name, &span[0], &span[1], &span[2], &span[3], after);
+    *more = strcmp(after, ",") == 0;
+    return found >= 5;
+}
+
+// Test the trace of playing a sketch file: a read span and then a frame span for every
+// frame, one after the other, the frame spans taking in all the commands of the file
+void testTrace() {
+    assert(__LINE__, !tracing && traceClock() == 0);
+    setenv("SKETCH_TRACE", "moduletesttmp.json", 1);
+    startTrace("moduletest");
+    unsetenv("SKETCH_TRACE");
+    assert(__LINE__, tracing);
+    display *d = openDisplay(&cpuBackend, "sketch08.sk", WIDTH, HEIGHT);
+    state *s = newState();
+    int frames = 0;
+    do {
+        processSketch(d, s, 0);
+        frames++;
+    } while (s->start != 0);
+    freeState(s);
+    freeDisplay(d);
+    endTrace();
+    assert(__LINE__, !tracing && traceClock() == 0);
+    long size;
+    free(readBytes("sketch08.sk", &size));
+    FILE *file = fopen("moduletesttmp.json", "r");
+    char line[256], name[16];
+    assert(__LINE__, fgets(line, sizeof(line), file) != NULL);
+    assert(__LINE__, strcmp(line, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"moduletest\"}},\n") == 0);
+    long read[4], played[4], end = 0, commands = 0;
+    bool more = true;
+    for (int i = 0; i < frames; i++) {
+        assert(__LINE__, more && readSpan(file, name, read, &more) && strcmp(name, "read") == 0);
+        assert(__LINE__, more && readSpan(file, name, played, &more) && strcmp(name, "frame") == 0);
+        assert(__LINE__, read[0] >= end && read[1] >= 0 && read[0] + read[1] <= played[0] && played[1] >= 0);
+        assert(__LINE__, read[2] == played[2] && read[3] == 0 && played[3] == 0);
+        end = played[0] + played[1];
+        commands += played[2];
+    }
+    assert(__LINE__, !more && commands == size);
+    assert(__LINE__, fgets(line, sizeof(line), file) != NULL && strcmp(line, "]\n") == 0);
+    assert(__LINE__, fgets(line, sizeof(line), file) == NULL);
+    fclose(file);
+    remove("moduletesttmp.json");
+}
+
+// Chunked decoding (scan.c)
+// -----------------------------------------------------------------
+
+// Next number from a pseudo random sequence
+static unsigned int randomNumber(unsigned int *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+// Make up a frame of n commands to test decoding it in chunks for count threads: moves
+// (DX and DY) with a TOOL every so often, and around every boundary between chunks some
+// DATA commands followed by a TOOL using them, so that chunks start in the middle of a value.
+// Without tools there is only one TOOL, after the last boundary, so the value is built
+// up over several chunks. The tools are any up to KEEP, so NEXTFRAME splits the commands
+// into several frames and KEEP switches keeping the canvas on and off.
+static void chunkTest(unsigned char *bytes, long n, int count, bool tools, unsigned int *seed) {
+    for (long i = 0; i < n; i++) {
+        unsigned int r = randomNumber(seed);
+        if (tools && r % 1024 == 0) bytes[i] = (TOOL << 6) | (r >> 10) % (KEEP + 1);
+        else bytes[i] = ((r & 1) << 6) | ((r >> 1) & 63);
+    }
+    for (int i = 1; i < count; i++) {
+        long b = n * i / count;
+        for (long j = b - 2; j <= b; j++) bytes[j] = (DATA << 6) | (randomNumber(seed) & 63);
+        bytes[b + 1] = (TOOL << 6) | (TARGETX + randomNumber(seed) % 2);
+        if (i % 3 == 0) bytes[b + 1] = (TOOL << 6) | randomNumber(seed) % (KEEP + 1);
+        if (!tools && i < count - 1) bytes[b + 1] = DX << 6;
+    }
+}
+
+// Check that decoding commands in chunks on some threads makes exactly the calls that
+// decoding them in one go makes, down to whether each show keeps the canvas. Adds the
+// number of shows keeping it to kept.
+static bool sameChunked(unsigned char *bytes, long n, int threads, long *kept) {
+    recording *a = recordParallel(bytes, n, WIDTH, HEIGHT, 1), *b = recordParallel(bytes, n, WIDTH, HEIGHT, threads);
+    for (int i = 0; i < a->count; i++) *kept += a->calls[i].kind == SHOWCALL && a->calls[i].a;
+    bool same = a->frames == b->frames && memcmp(a->ends, b->ends, sizeof(int) * a->frames) == 0;
+    same = same && a->count == b->count && memcmp(a->calls, b->calls, sizeof(call) * a->count) == 0;
+    freeRecording(a);
+    freeRecording(b);
+    return same;
+}
+
+// Test decoding long frames in chunks on any number of threads
+void testChunks() {
+    long n = 100000;
+    unsigned char *bytes = malloc(n);
+    unsigned int seed = 1;
+    long kept = 0;
+    for (int threads = 2; threads <= 24; threads++) {
+        chunkTest(bytes, n, threads, true, &seed);
+        assert(__LINE__, sameChunked(bytes, n, threads, &kept));
+        chunkTest(bytes, n, threads, false, &seed);
+        assert(__LINE__, sameChunked(bytes, n, threads, &kept));
+    }
+    // Two frames, each split into chunks
+    chunkTest(bytes, n, 3, true, &seed);
+    bytes[n / 3 - 10] = (TOOL << 6) | NEXTFRAME;
+    assert(__LINE__, sameChunked(bytes, n, 5, &kept) && kept > 0);
+    free(bytes);
+}
+
+// A recorder on a thread of testThreadLimit: a long frame, the calls it makes and whether
+// recording it in chunks made them
+typedef struct limitTest { unsigned char *bytes; long n; recording *r; bool same; } limitTest;
+
+// Record the frame of a limitTest in chunks a few times
+static void *recordLimited(void *data) {
+    limitTest *t = data;
+    t->same = true;
+    for (int i = 0; i < 4; i++) {
+        recording *r = recordParallel(t->bytes, t->n, WIDTH, HEIGHT, 8);
+        t->same = t->same && r->count == t->r->count && memcmp(r->calls, t->r->calls, sizeof(call) * r->count) == 0;
+        freeRecording(r);
+    }
+    return NULL;
+}
+
+// Test that recorders decoding in chunks on several threads at once start no more
+// threads between them than the limit, and still make the right calls
+void testThreadLimit() {
+    long n = 100000;
+    unsigned char *bytes = malloc(n);
+    unsigned int seed = 2;
+    chunkTest(bytes, n, 8, true, &seed);
+    limitTest t[6];
+    pthread_t ids[6];
+    recording *r = recordParallel(bytes, n, WIDTH, HEIGHT, 1);
+    limitChunkThreads(3);
+    for (int i = 0; i < 6; i++) {
+        t[i] = (limitTest) {bytes, n, r, false};
+        pthread_create(&ids[i], NULL, recordLimited, &t[i]);
+    }
+    int most = 0;
+    for (int i = 0; i < 100000; i++) {
+        int running = chunkThreads();
+        if (running > most) most = running;
+    }
+    for (int i = 0; i < 6; i++) {
+        pthread_join(ids[i], NULL);
+        assert(__LINE__, t[i].same);
+    }
+    assert(__LINE__, most <= 3 && chunkThreads() == 0);
+    limitChunkThreads(processors() - 1);
+    freeRecording(r);
+    free(bytes);
+}
+
+// Test that the shows of a sketch keeping the canvas, in frames long enough to be decoded
+// in chunks, keep it whenever they do when decoded in one go: while KEEP is on, after the
+// end of a chunked frame and at the end of the sketch
+void testKeptChunks() {
+    long n = 3 * 20000 + 6, i = 0;
+    unsigned char *bytes = calloc(n, 1);
+    bytes[i++] = (DATA << 6) | 1;
+    bytes[i++] = (TOOL << 6) | KEEP;
+    i += 20000;
+    bytes[i++] = (TOOL << 6) | SHOW;
+    i += 20000;
+    bytes[i++] = (TOOL << 6) | NEXTFRAME;
+    i += 10000;
+    bytes[i++] = (TOOL << 6) | SHOW;
+    bytes[i++] = (TOOL << 6) | KEEP;
+    assert(__LINE__, i + 10000 == n);
+    recording *r = recordParallel(bytes, n, WIDTH, HEIGHT, 1);
+    int shows[4], count = 0;
+    for (int k = 0; k < r->count; k++) {
+        if (r->calls[k].kind == SHOWCALL && count < 4) shows[count++] = r->calls[k].a;
+    }
+    assert(__LINE__, count == 4 && shows[0] == 1 && shows[1] == 1 && shows[2] == 1 && shows[3] == 0);
+    for (int threads = 2; threads <= 8; threads++) {
+        recording *chunked = recordParallel(bytes, n, WIDTH, HEIGHT, threads);
+        assert(__LINE__, chunked->count == r->count && memcmp(chunked->calls, r->calls, sizeof(call) * r->count) == 0);
+        assert(__LINE__, sameRendering(r, chunked, WIDTH, HEIGHT));
+        freeRecording(chunked);
+    }
+    freeRecording(r);
+    free(bytes);
+}
+
+// Run tests
+void test() {
+    testFrameCache();
+    testScenes();
+    testPushed();
+    testWall();
+    testTrace();
+    testChunks();
+    testThreadLimit();
+    testKeptChunks();
+    printf("All tests passed.\n");
+}
+
+int main(int n, char *args[n]) {
+    test();
+    return 0;
+}
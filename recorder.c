@@ -0,0 +1,345 @@
+// This display backend records display calls instead of drawing, see recorder.h for how to use it.
+#include "displayfull.h"
+#include "backend.h"
+#include "sketch.h"
+#include "canvas.h"
+#include "recorder.h"
+#include "decoder.h"
+#include "scan.h"
+
+// display object that appends every call to a recording
+typedef struct recorder {
+  display base;
+  recording *r;
+  bool keep;
+} recorder;
+
+// Append a call to the recording of a display
+static void add(display *d, int kind, int a, int b, int c, int e) {
+  recording *r = ((recorder *) d)->r;
+  if (r->count == r->capacity) {
+    r->capacity = r->capacity == 0 ? 64 : r->capacity * 2;
+    r->calls = realloc(r->calls, sizeof(call) * r->capacity);
+  }
+  r->calls[r->count] = (call) {kind, a, b, c, e};
+  r->count++;
+}
+
+// Mark the end of a frame at the current end of the recording
+static void endFrame(recording *r) {
+  if (r->frames == r->frameCapacity) {
+    r->frameCapacity = r->frameCapacity == 0 ? 16 : r->frameCapacity * 2;
+    r->ends = realloc(r->ends, sizeof(int) * r->frameCapacity);
+  }
+  r->ends[r->frames] = r->count;
+  r->frames++;
+}
+
+static void recordPause(display *d, int ms) {
+  add(d, PAUSECALL, ms, 0, 0, 0);
+}
+
+static void recordLine(display *d, int x0, int y0, int x1, int y1) {
+  add(d, LINECALL, x0, y0, x1, y1);
+}
+
+static void recordBlock(display *d, int x, int y, int w, int h) {
+  add(d, BLOCKCALL, x, y, w, h);
+}
+
+static void recordColour(display *d, int rgba) {
+  add(d, COLOURCALL, rgba, 0, 0, 0);
+}
+
+// Recordings do not keep pixels, so a capture is plain black and a blit is ignored.
+static void recordCapture(display *d, unsigned int *pixels) {
+  for (int i = 0; i < d->width * d->height; i++) pixels[i] = 0xFF;
+}
+
+static void recordBlit(display *d, unsigned int *pixels) {
+}
+
+static void recordShow(display *d) {
+  add(d, SHOWCALL, ((recorder *) d)->keep, 0, 0, 0);
+}
+
+// The view is not changed, the picture is drawn at the default view.
+static void recordSetViewport(display *d, int x, int y, int level) {
+}
+
+static void recordKeepCanvas(display *d, bool keep) {
+  add(d, KEEPCALL, keep, 0, 0, 0);
+  ((recorder *) d)->keep = keep;
+}
+
+// Frames are told apart by the show calls already.
+static void recordStartFrame(display *d, long frame) {
+}
+
+static recorder *newRecorder(char *name, int width, int height) {
+  recorder *d = malloc(sizeof(recorder));
+  d->base = (display) {&recordBackend, name, width, height};
+  d->r = calloc(1, sizeof(recording));
+  d->keep = false;
+  return d;
+}
+
+static display *recordNew(char *name, int width, int height) {
+  return &newRecorder(name, width, height)->base;
+}
+
+static void recordRun(display *d, void *data, bool action(display *, void*, const char)) {
+  bool quit = false;
+  while (!quit) {
+    quit = action(d, data, 0);
+    endFrame(((recorder *) d)->r);
+  }
+}
+
+static void recordFree(display *d) {
+  freeRecording(((recorder *) d)->r);
+  free(d);
+}
+
+const backend recordBackend = {
+  "record", true, recordNew, recordFree, recordPause, recordShow, recordLine, recordBlock,
+  recordColour, recordCapture, recordBlit, recordSetViewport, recordKeepCanvas,
+  recordStartFrame, recordRun
+};
+
+// The calls recorded so far by a display of the record backend.
+recording *displayRecording(display *d) {
+  return ((recorder *) d)->r;
+}
+
+// Record one pass of the given sketch file, drawn on a width*height display.
+recording *recordSketch(char *filename, int width, int height) {
+  recorder *d = newRecorder(filename, width, height);
+  state *s = newState();
+  do {
+    processSketch(&d->base, s, 0);
+    endFrame(d->r);
+  } while (s->start != 0);
+  recording *r = d->r;
+  freeState(s);
+  free(d);
+  return r;
+}
+
+// Frames are decoded in chunks on several threads once there are at least this many commands per thread
+#define CHUNK_MIN 4096
+
+// Append the calls of a recording to another one
+static void appendCalls(recording *r, recording *from) {
+  if (from->count == 0) return;
+  if (r->count + from->count > r->capacity) {
+    r->capacity = r->count + from->count;
+    r->calls = realloc(r->calls, sizeof(call) * r->capacity);
+  }
+  memcpy(r->calls + r->count, from->calls, sizeof(call) * from->count);
+  r->count += from->count;
+}
+
+// Record the n commands of a frame, decoded in up to threads chunks if it is long enough
+static void recordFrame(recorder *d, decoder *p, unsigned char *bytes, long n, int threads) {
+  int count = n / CHUNK_MIN < threads ? n / CHUNK_MIN : threads;
+  if (count < 2) {
+    pushBytes(&d->base, p, bytes, n);
+    return;
+  }
+  display *chunks[count];
+  for (int i = 0; i < count; i++) chunks[i] = recordNew("", d->base.width, d->base.height);
+  state s = {0, 0, 0, 0, LINE, 0, 0, false};
+  decodeChunks(count, chunks, bytes, n, &s);
+  // Chunk recorders start with the canvas cleared after shows, so their shows up to their
+  // first KEEP are given the keep state left by the chunks before them
+  bool keep = d->keep;
+  for (int i = 0; i < count; i++) {
+    recording *r = displayRecording(chunks[i]);
+    for (int k = 0; k < r->count; k++) {
+      if (r->calls[k].kind == KEEPCALL) keep = r->calls[k].a;
+      else if (r->calls[k].kind == SHOWCALL) r->calls[k].a = keep;
+    }
+    appendCalls(d->r, r);
+    recordFree(chunks[i]);
+  }
+  d->keep = keep;
+}
+
+// Record one pass of n sketch commands held in memory, drawn on a width*height display,
+// split into frames at every NEXTFRAME like processSketch does.
+recording *recordBytes(unsigned char *bytes, long n, int width, int height) {
+  return recordParallel(bytes, n, width, height, 0);
+}
+
+// Record one pass of n sketch commands held in memory like recordBytes, decoding long
+// frames in threads chunks (0 for one per processor).
+recording *recordParallel(unsigned char *bytes, long n, int width, int height, int threads) {
+  if (threads <= 0) threads = processors();
+  recorder *d = newRecorder("", width, height);
+  decoder *p = newDecoder();
+  long begin = 0;
+  for (long i = 0; i < n; i++) {
+    if (getOpcode(bytes[i]) != TOOL || getOperand(bytes[i]) != NEXTFRAME) continue;
+    recordFrame(d, p, bytes + begin, i + 1 - begin, threads);
+    endFrame(d->r);
+    begin = i + 1;
+  }
+  recordFrame(d, p, bytes + begin, n - begin, threads);
+  endSketch(&d->base, p);
+  endFrame(d->r);
+  recording *r = d->r;
+  freeDecoder(p);
+  free(d);
+  return r;
+}
+
+// Release a recording.
+void freeRecording(recording *r) {
+  free(r->calls);
+  free(r->ends);
+  free(r);
+}
+
+// Most opaque blocks kept while looking for the calls they cover
+#define COVERS 16
+
+// The pixels a line or block call draws, as the box from (box[0],box[1]) up to
+// (box[2],box[3]) excluded. If onDisplay is true only the ones on a width*height display
+// are counted, the box is empty if it draws nothing there.
+static void drawnBox(call *k, int width, int height, bool onDisplay, long long box[4]) {
+  if (k->kind == LINECALL) {
+    box[0] = k->a < k->c ? k->a : k->c;
+    box[1] = k->b < k->d ? k->b : k->d;
+    box[2] = (long long) (k->a < k->c ? k->c : k->a) + 1;
+    box[3] = (long long) (k->b < k->d ? k->d : k->b) + 1;
+  } else {
+    box[0] = k->c < 0 ? (long long) k->a + k->c : k->a;
+    box[1] = k->d < 0 ? (long long) k->b + k->d : k->b;
+    box[2] = box[0] + llabs((long long) k->c);
+    box[3] = box[1] + llabs((long long) k->d);
+  }
+  if (!onDisplay) return;
+  if (box[0] < 0) box[0] = 0;
+  if (box[1] < 0) box[1] = 0;
+  if (box[2] > width) box[2] = width;
+  if (box[3] > height) box[3] = height;
+}
+
+// Area of a box, 0 if it is empty
+static long long area(long long box[4]) {
+  if (box[2] <= box[0] || box[3] <= box[1]) return 0;
+  return (box[2] - box[0]) * (box[3] - box[1]);
+}
+
+// Check if box a contains box b
+static bool contains(long long a[4], long long b[4]) {
+  return a[0] <= b[0] && a[1] <= b[1] && a[2] >= b[2] && a[3] >= b[3];
+}
+
+// Drop the line and block calls hidden (on a width*height display if onDisplay is true).
+// Calls are visited from the last one back, keeping the largest opaque blocks drawn after
+// each call up to the next show or pause: a call is hidden if its pixels are all inside one
+// of them. Blocks of no size draw nothing anywhere.
+int dropCovered(recording *r, int width, int height, bool onDisplay) {
+  unsigned int *colours = malloc(sizeof(unsigned int) * (r->count + 1));
+  bool *hidden = calloc(r->count + 1, sizeof(bool));
+  unsigned int rgba = 0xFFFFFFFF;
+  for (int i = 0; i < r->count; i++) {
+    if (r->calls[i].kind == COLOURCALL) rgba = r->calls[i].a;
+    colours[i] = rgba;
+  }
+  long long covers[COVERS][4];
+  int n = 0;
+  for (int i = r->count - 1; i >= 0; i--) {
+    call *k = &r->calls[i];
+    if (k->kind == SHOWCALL || k->kind == PAUSECALL) n = 0;
+    if (k->kind != LINECALL && k->kind != BLOCKCALL) continue;
+    long long box[4];
+    drawnBox(k, width, height, onDisplay, box);
+    hidden[i] = (area(box) == 0);
+    for (int j = 0; j < n && !hidden[i]; j++) hidden[i] = contains(covers[j], box);
+    if (hidden[i] || k->kind != BLOCKCALL || (colours[i] & 0xFF) != 0xFF) continue;
+    int slot = n;
+    if (n == COVERS) {
+      slot = 0;
+      for (int j = 1; j < n; j++) if (area(covers[j]) < area(covers[slot])) slot = j;
+      if (area(covers[slot]) >= area(box)) continue;
+    } else n++;
+    memcpy(covers[slot], box, sizeof(box));
+  }
+  int kept = 0, f = 0;
+  for (int i = 0; i <= r->count; i++) {
+    while (f < r->frames && r->ends[f] == i) r->ends[f++] = kept;
+    if (i < r->count && !hidden[i]) r->calls[kept++] = r->calls[i];
+  }
+  int dropped = r->count - kept;
+  r->count = kept;
+  free(colours);
+  free(hidden);
+  return dropped;
+}
+
+// Draw the calls of a recording from call i up to the next show or pause call
+// (or up to end), and return the index of that call
+int drawUntilEvent(recording *r, int i, int end, canvas *c) {
+  while (i < end) {
+    call *k = &r->calls[i];
+    if (k->kind == LINECALL) canvasLine(c, k->a, k->b, k->c, k->d);
+    else if (k->kind == BLOCKCALL) canvasBlock(c, k->a, k->b, k->c, k->d);
+    else if (k->kind == COLOURCALL) c->rgba = k->a;
+    else if (k->kind != KEEPCALL) return i;
+    i++;
+  }
+  return end;
+}
+
+// Draw the next image the recording of a player shows on its canvas, returns false if
+// there is none. The canvas is cleared before drawing, like the display after a show,
+// unless that show kept it.
+bool nextImage(player *p) {
+  if (!p->keep) clearCanvas(p->c, 0xFF);
+  while (p->i < p->r->count) {
+    while (p->i >= p->r->ends[p->frame]) p->frame++;
+    p->i = drawUntilEvent(p->r, p->i, p->r->ends[p->frame], p->c);
+    if (p->i == p->r->ends[p->frame]) continue;
+    p->i++;
+    if (p->r->calls[p->i - 1].kind == SHOWCALL) {
+      p->keep = p->r->calls[p->i - 1].a;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Check that two recordings show the same images with the same pauses in the same
+// frames when drawn on a width*height canvas.
+bool sameRendering(recording *a, recording *b, int width, int height) {
+  if (a->frames != b->frames) return false;
+  canvas *ca = newCanvas(width, height), *cb = newCanvas(width, height);
+  bool same = true;
+  int i = 0, j = 0;
+  for (int f = 0; f < a->frames && same; f++) {
+    while (same) {
+      i = drawUntilEvent(a, i, a->ends[f], ca);
+      j = drawUntilEvent(b, j, b->ends[f], cb);
+      if (i == a->ends[f] || j == b->ends[f]) {
+        same = (i == a->ends[f] && j == b->ends[f]);
+        break;
+      }
+      call *x = &a->calls[i], *y = &b->calls[j];
+      if (x->kind != y->kind) same = false;
+      else if (x->kind == PAUSECALL) same = (x->a == y->a);
+      else {
+        same = (memcmp(ca->pixels, cb->pixels, sizeof(unsigned int) * width * height) == 0);
+        if (x->a == 0) clearCanvas(ca, 0xFF);
+        if (y->a == 0) clearCanvas(cb, 0xFF);
+      }
+      i++;
+      j++;
+    }
+  }
+  freeCanvas(ca);
+  freeCanvas(cb);
+  return same;
+}
@@ -0,0 +1,73 @@
+// Recorder: a display backend (see backend.h) that records the calls made to it instead of drawing.
+// -----------------------------------------------------------------
+// recordSketch plays one pass of a sketch file through processSketch and returns the
+// display calls it made, split into frames (one frame per call of processSketch).
+// recordBytes does the same for sketch commands held in memory, decoding long frames on
+// several threads.
+// Primitives hidden under later opaque blocks can be dropped from a recording before it is
+// drawn or encoded again. A recording can be drawn on a software canvas, which lets tools compare what two
+// sketch files show without a window.
+
+// Kinds of recorded display calls
+enum { LINECALL, BLOCKCALL, COLOURCALL, SHOWCALL, PAUSECALL, KEEPCALL };
+
+// A recorded call: line(a,b,c,d), block(a,b,c,d), colour(a), show(), pause(a) or
+// keepCanvas(a). For show() a is 1 if the canvas is kept after it, 0 if it is cleared.
+typedef struct call { int kind, a, b, c, d; } call;
+
+// The calls of one pass of a sketch file, frame f being calls[ends[f-1]] to calls[ends[f]-1]
+typedef struct recording {
+    int count, capacity;
+    call *calls;
+    int frames, frameCapacity;
+    int *ends;
+} recording;
+
+// Record one pass of the given sketch file, drawn on a width*height display.
+recording *recordSketch(char *filename, int width, int height);
+
+// Record one pass of n sketch commands held in memory, drawn on a width*height display.
+recording *recordBytes(unsigned char *bytes, long n, int width, int height);
+
+// Record like recordBytes, decoding long frames in threads chunks (0 for one per
+// processor, which is what recordBytes does) on as many threads as scan.h allows.
+recording *recordParallel(unsigned char *bytes, long n, int width, int height, int threads);
+
+// Displays, see displayfull.h
+struct display;
+
+// The calls recorded so far by a display of the record backend (see backend.h), split into
+// frames by every call of run()'s action.
+recording *displayRecording(struct display *d);
+
+// Release a recording.
+void freeRecording(recording *r);
+
+// Drop the line and block calls that draw nothing because they are covered, before the next
+// show or pause, by a later block in an opaque colour (alpha 0xFF). If onDisplay is true
+// only what is on a width*height display counts, so calls off it are dropped too and blocks
+// cover just their part on it. Otherwise the pixels are those of the whole picture, as in a
+// sketch file which may be viewed panned or zoomed out. The recording still shows the same
+// images. Returns the number of calls dropped.
+int dropCovered(recording *r, int width, int height, bool onDisplay);
+
+// Canvas to draw recordings on, see canvas.h
+struct canvas;
+
+// Draw the calls of a recording from call i on a canvas, up to the next show or pause call
+// or up to call end, and return the index of the call it stopped at. The canvas is to be
+// cleared after a show call unless that keeps it.
+int drawUntilEvent(recording *r, int i, int end, struct canvas *c);
+
+// A recording being drawn image by image on a canvas (starting with i, frame and keep at
+// 0), and whether the last show kept the canvas
+typedef struct player { recording *r; struct canvas *c; int i, frame; bool keep; } player;
+
+// Draw the next image the recording of a player shows on its canvas, returns false if
+// there is none. The canvas is cleared before drawing, like the display after a show,
+// unless that show kept it.
+bool nextImage(player *p);
+
+// Check that two recordings show the same images with the same pauses in the same
+// frames when drawn on a width*height canvas.
+bool sameRendering(recording *a, recording *b, int width, int height);
@@ -0,0 +1,195 @@
+// Chunked decoding, see scan.h for how to use it.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Chunks are obeyed on displays of any kind, only the decoding helpers of sketch.h are used
+struct display;
+typedef struct display display;
+#include "sketch.h"
+#include "tools.h"
+#include "scan.h"
+
+// Where a field of the state at the end of a chunk comes from: a field of the state at its
+// start, the value of the chunk's first TOOL command (when that uses DATA commands from
+// before the chunk) or nothing, plus an offset
+enum { FROMX, FROMY, FROMTX, FROMTY, FROMTOOL, FIXED };
+typedef struct source { int from; unsigned int offset; } source;
+
+// Effect of a chunk of commands on the drawing state. The data field at the end is bits,
+// following the start's data shifted by shift DATA commands unless a TOOL command cleared
+// it. The first TOOL command uses the start's data shifted by firstShift, then firstBits.
+typedef struct summary {
+    source x, y, tx, ty;
+    bool toolSet, dataSet;
+    unsigned char tool;
+    int shift, firstShift;
+    unsigned int bits, firstBits;
+} summary;
+
+// A chunk of a frame: its commands, the display they are obeyed on, their summary and the
+// state they start from
+typedef struct chunk { byte *bytes; long n; display *d; summary m; state s; } chunk;
+
+// Number of processors online.
+int processors() {
+    int n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n;
+}
+
+// Threads started for chunks and running now, and how many may run at once (-1 until set
+// or first needed), shared by every caller in the process
+static int started = 0, limit = -1;
+static pthread_mutex_t startLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Limit the threads decodeChunks starts, across all its callers at once.
+void limitChunkThreads(int threads) {
+    pthread_mutex_lock(&startLock);
+    limit = threads;
+    pthread_mutex_unlock(&startLock);
+}
+
+// Number of threads started by decodeChunks that are running now.
+int chunkThreads() {
+    pthread_mutex_lock(&startLock);
+    int n = started;
+    pthread_mutex_unlock(&startLock);
+    return n;
+}
+
+// Take up to wanted threads from those that may still be started, returning how many
+static int takeThreads(int wanted) {
+    pthread_mutex_lock(&startLock);
+    if (limit < 0) limit = processors() - 1;
+    int taken = limit - started < wanted ? limit - started : wanted;
+    if (taken < 0) taken = 0;
+    started += taken;
+    pthread_mutex_unlock(&startLock);
+    return taken;
+}
+
+// Give back threads taken with takeThreads once they have finished
+static void giveThreads(int count) {
+    pthread_mutex_lock(&startLock);
+    started -= count;
+    pthread_mutex_unlock(&startLock);
+}
+
+// Shift a data value as count DATA commands do (six bits each, dropping the top bits)
+static unsigned int shifted(unsigned int data, int count) {
+    for (int i = 0; i < count && data != 0; i++) data = data << 6;
+    return data;
+}
+
+// Summarise the effect of the commands of a chunk on the drawing state
+static void *summarise(void *data) {
+    chunk *c = data;
+    summary m = {{FROMX, 0}, {FROMY, 0}, {FROMTX, 0}, {FROMTY, 0}, false, false, 0, 0, 0, 0, 0};
+    for (long i = 0; i < c->n; i++) {
+        int opcode = getOpcode(c->bytes[i]), operand = getOperand(c->bytes[i]);
+        if (opcode == DX) m.tx.offset += operand;
+        else if (opcode == DY) {
+            m.ty.offset += operand;
+            m.x = m.tx;
+            m.y = m.ty;
+        } else if (opcode == DATA) {
+            m.bits = (m.bits << 6) | (c->bytes[i] & 63);
+            if (!m.dataSet) m.shift++;
+        } else {
+            source value = {FIXED, m.bits};
+            if (!m.dataSet) {
+                value = (source) {FROMTOOL, 0};
+                m.firstShift = m.shift;
+                m.firstBits = m.bits;
+            }
+            if (operand == TARGETX) m.tx = value;
+            else if (operand == TARGETY) m.ty = value;
+            else if (operand != COLOUR && operand != SHOW && operand != PAUSE && operand != NEXTFRAME && operand != KEEP) {
+                m.toolSet = true;
+                m.tool = operand;
+            }
+            m.dataSet = true;
+            m.bits = 0;
+        }
+    }
+    c->m = m;
+    return NULL;
+}
+
+// Value of a field at the end of a chunk started in state s, first being the value of its first TOOL command
+static unsigned int resolve(source v, state *s, unsigned int first) {
+    unsigned int base = 0;
+    if (v.from == FROMX) base = s->x;
+    else if (v.from == FROMY) base = s->y;
+    else if (v.from == FROMTX) base = s->tx;
+    else if (v.from == FROMTY) base = s->ty;
+    else if (v.from == FROMTOOL) base = first;
+    return base + v.offset;
+}
+
+// Change a state into the state after a chunk with the given summary
+static void apply(summary *m, state *s) {
+    state start = *s;
+    unsigned int first = shifted(start.data, m->firstShift) | m->firstBits;
+    s->x = resolve(m->x, &start, first);
+    s->y = resolve(m->y, &start, first);
+    s->tx = resolve(m->tx, &start, first);
+    s->ty = resolve(m->ty, &start, first);
+    if (m->toolSet) s->tool = m->tool;
+    s->data = m->dataSet ? m->bits : shifted(start.data, m->shift) | m->bits;
+}
+
+// Obey the commands of a chunk on its display, from its start state
+static void *obeyChunk(void *data) {
+    chunk *c = data;
+    for (long i = 0; i < c->n; i++) obey(c->d, &c->s, c->bytes[i]);
+    return NULL;
+}
+
+// A run of chunks for one thread to do some work on, one after the other
+typedef struct share { chunk *chunks; int count; void *(*work)(void *); } share;
+
+// Do the work of a share on each of its chunks
+static void *workShare(void *data) {
+    share *s = data;
+    for (int i = 0; i < s->count; i++) s->work(&s->chunks[i]);
+    return NULL;
+}
+
+// Do some work on every chunk, on as many threads as may be started (up to one per chunk)
+// and on the calling thread, each taking a run of neighbouring chunks
+static void runChunks(int count, chunk *chunks, void *work(void *)) {
+    int threads = 1 + takeThreads(count - 1);
+    pthread_t ids[threads];
+    share shares[threads];
+    for (int i = 0; i < threads; i++) {
+        int begin = count * i / threads, end = count * (i + 1) / threads;
+        shares[i] = (share) {chunks + begin, end - begin, work};
+    }
+    for (int i = 1; i < threads; i++) pthread_create(&ids[i], NULL, workShare, &shares[i]);
+    workShare(&shares[0]);
+    for (int i = 1; i < threads; i++) pthread_join(ids[i], NULL);
+    giveThreads(threads - 1);
+}
+
+// Decode n commands starting from state s, split into count chunks each obeyed on its own
+// display by its own thread, chunk i on displays[i]. s is left at the state after the commands.
+void decodeChunks(int count, display *displays[count], byte *bytes, long n, state *s) {
+    chunk *chunks = malloc(sizeof(chunk) * count);
+    for (int i = 0; i < count; i++) {
+        long begin = n * i / count, end = n * (i + 1) / count;
+        chunks[i] = (chunk) {bytes + begin, end - begin, displays[i]};
+    }
+    runChunks(count, chunks, summarise);
+    for (int i = 0; i < count; i++) {
+        chunks[i].s = *s;
+        apply(&chunks[i].m, s);
+    }
+    runChunks(count, chunks, obeyChunk);
+    *s = chunks[count - 1].s;
+    free(chunks);
+}
@@ -0,0 +1,28 @@
+// Chunked decoding: one long frame of a sketch decoded on several threads.
+// -----------------------------------------------------------------
+// Commands change the drawing state in simple ways: DX and DY add to tx and ty (DY also
+// moves x and y there), DATA shifts bits into the data field, and TOOL commands set the
+// tool, tx or ty outright and clear the data field. So the effect of a run of commands can
+// be summarised without knowing the state it starts from, as where every field ends up
+// coming from (a field at the start, a fixed value, or the value of the first TOOL command
+// when it is built from DATA commands before the run) plus an offset.
+// A frame is split into chunks which are summarised in parallel. Applying the summaries
+// one after another (a prefix scan, cheap as there are only a few chunks) gives the state
+// at the start of every chunk, and the chunks are then obeyed in parallel from those states.
+// The threads started for chunks are limited across the whole process (to one fewer than
+// the number of processors, as every caller works on chunks too), so that callers decoding
+// on several threads at once, like the workers of sketchd, do not start a thread per
+// processor each. Chunks without a thread of their own are done by the threads there are.
+
+// Number of processors online.
+int processors();
+
+// Limit the threads decodeChunks starts, across all its callers at once.
+void limitChunkThreads(int threads);
+
+// Number of threads started by decodeChunks that are running now.
+int chunkThreads();
+
+// Decode n commands starting from state s, split into count chunks each obeyed on its own
+// display, chunk i on displays[i], on up to count threads. s is left at the state after the commands.
+void decodeChunks(int count, display *displays[count], byte *bytes, long n, state *s);
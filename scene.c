@@ -0,0 +1,204 @@
+// Scenes, see scene.h for how to use them.
+#include "displayfull.h"
+#include "sketch.h"
+#include "tools.h"
+#include "scene.h"
+
+// Number of grid cells along each side of the area covered by a scene
+#define GRID 64
+
+// A list of item numbers, in increasing order
+typedef struct list { int count, capacity; int *items; } list;
+
+// The items of a frame, the colour it ends with, the numbers of its show, pause and keep items,
+// and the grid: the area covered by primitives starting at (left,top), in cells of
+// size*size. Primitives covering more than a quarter of the grid are kept in large.
+struct scene {
+    int count, capacity;
+    item *items;
+    unsigned int colourOut;
+    list events, large;
+    long long left, top, size;
+    list cells[GRID * GRID];
+    int *seen, query;
+};
+
+// Append an item number to a list
+static void addNumber(list *l, int i) {
+    if (l->count == l->capacity) {
+        l->capacity = l->capacity == 0 ? 8 : l->capacity * 2;
+        l->items = realloc(l->items, sizeof(int) * l->capacity);
+    }
+    l->items[l->count++] = i;
+}
+
+// Append an item to a scene
+static void addItem(scene *s, item it) {
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity == 0 ? 64 : s->capacity * 2;
+        s->items = realloc(s->items, sizeof(item) * s->capacity);
+    }
+    s->items[s->count++] = it;
+}
+
+// Bounding box of a primitive, with right and bottom included
+static void bounds(item *it, long long box[4]) {
+    if (it->kind == LINEITEM) {
+        box[0] = it->a < it->c ? it->a : it->c;
+        box[1] = it->b < it->d ? it->b : it->d;
+        box[2] = it->a < it->c ? it->c : it->a;
+        box[3] = it->b < it->d ? it->d : it->b;
+    } else {
+        long long x = it->a, y = it->b, w = it->c, h = it->d;
+        box[0] = w < 0 ? x + w : x;
+        box[1] = h < 0 ? y + h : y;
+        box[2] = (w < 0 ? x : x + w) - 1;
+        box[3] = (h < 0 ? y : y + h) - 1;
+    }
+}
+
+// Index the primitives of a scene in a grid over the area they cover
+static void buildGrid(scene *s) {
+    long long area[4] = {0, 0, -1, -1};
+    for (int i = 0; i < s->count; i++) {
+        if (s->items[i].kind != LINEITEM && s->items[i].kind != BLOCKITEM) continue;
+        long long box[4];
+        bounds(&s->items[i], box);
+        if (box[2] < box[0] || box[3] < box[1]) continue;
+        if (area[2] < area[0]) memcpy(area, box, sizeof(area));
+        for (int k = 0; k < 2; k++) {
+            if (box[k] < area[k]) area[k] = box[k];
+            if (box[k + 2] > area[k + 2]) area[k + 2] = box[k + 2];
+        }
+    }
+    long long span = area[2] - area[0] > area[3] - area[1] ? area[2] - area[0] : area[3] - area[1];
+    s->left = area[0];
+    s->top = area[1];
+    s->size = span / GRID + 1;
+    for (int i = 0; i < s->count; i++) {
+        if (s->items[i].kind != LINEITEM && s->items[i].kind != BLOCKITEM) continue;
+        long long box[4];
+        bounds(&s->items[i], box);
+        if (box[2] < box[0] || box[3] < box[1]) continue;
+        int x0 = (box[0] - s->left) / s->size, y0 = (box[1] - s->top) / s->size;
+        int x1 = (box[2] - s->left) / s->size, y1 = (box[3] - s->top) / s->size;
+        if ((long long) (x1 - x0 + 1) * (y1 - y0 + 1) > GRID * GRID / 4) {
+            addNumber(&s->large, i);
+            continue;
+        }
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) addNumber(&s->cells[y * GRID + x], i);
+        }
+    }
+    s->seen = calloc(s->count + 1, sizeof(int));
+}
+
+// Decode the n commands of a frame into a scene, starting with the drawing colour rgba.
+// The last frame of a sketch (not ended by NEXTFRAME) is shown at its end.
+scene *buildScene(byte *bytes, int n, unsigned int rgba, bool last) {
+    scene *sc = calloc(1, sizeof(scene));
+    state s = {0, 0, 0, 0, LINE, 0, 0, false};
+    for (int i = 0; i < n; i++) {
+        int opcode = getOpcode(bytes[i]), operand = getOperand(bytes[i]);
+        if (opcode == DX) s.tx += operand;
+        else if (opcode == DY) {
+            s.ty += operand;
+            if (s.tool == LINE) addItem(sc, (item) {LINEITEM, s.x, s.y, s.tx, s.ty, rgba});
+            else if (s.tool == BLOCK) addItem(sc, (item) {BLOCKITEM, s.x, s.y, s.tx - s.x, s.ty - s.y, rgba});
+            s.x = s.tx;
+            s.y = s.ty;
+        } else if (opcode == DATA) s.data = (s.data << 6) | (bytes[i] & 63);
+        else {
+            if (operand == COLOUR) rgba = s.data;
+            else if (operand == TARGETX) s.tx = s.data;
+            else if (operand == TARGETY) s.ty = s.data;
+            else if (operand == SHOW || operand == NEXTFRAME) addItem(sc, (item) {SHOWITEM, 0, 0, 0, 0, rgba});
+            else if (operand == PAUSE) addItem(sc, (item) {PAUSEITEM, s.data, 0, 0, 0, rgba});
+            else if (operand == KEEP) addItem(sc, (item) {KEEPITEM, s.data != 0, 0, 0, 0, rgba});
+            else s.tool = operand;
+            s.data = 0;
+        }
+    }
+    if (last) addItem(sc, (item) {SHOWITEM, 0, 0, 0, 0, rgba});
+    sc->colourOut = rgba;
+    for (int i = 0; i < sc->count; i++) {
+        int kind = sc->items[i].kind;
+        if (kind == SHOWITEM || kind == PAUSEITEM || kind == KEEPITEM) addNumber(&sc->events, i);
+    }
+    buildGrid(sc);
+    return sc;
+}
+
+// Release a scene.
+void freeScene(scene *s) {
+    for (int i = 0; i < GRID * GRID; i++) free(s->cells[i].items);
+    free(s->events.items);
+    free(s->large.items);
+    free(s->items);
+    free(s->seen);
+    free(s);
+}
+
+// The drawing colour at the end of the frame of a scene.
+unsigned int sceneColour(scene *s) {
+    return s->colourOut;
+}
+
+// Compare item numbers for sorting
+static int compareNumbers(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+// Add the primitives of a list that touch an area to the found ones, unless already found
+static void collect(scene *s, list *l, long long area[4], list *found) {
+    for (int j = 0; j < l->count; j++) {
+        int i = l->items[j];
+        if (s->seen[i] == s->query) continue;
+        s->seen[i] = s->query;
+        long long box[4];
+        bounds(&s->items[i], box);
+        if (box[2] < area[0] || box[0] > area[2] || box[3] < area[1] || box[1] > area[3]) continue;
+        addNumber(found, i);
+    }
+}
+
+// Play a scene on a display, drawing only the primitives that touch the area from
+// (left,top) up to (right,bottom), excluded.
+void drawScene(display *d, scene *s, int left, int top, int right, int bottom) {
+    long long area[4] = {left, top, (long long) right - 1, (long long) bottom - 1};
+    list found = {0, 0, NULL};
+    s->query++;
+    collect(s, &s->large, area, &found);
+    long long x0 = (area[0] - s->left) / s->size, y0 = (area[1] - s->top) / s->size;
+    long long x1 = (area[2] - s->left) / s->size, y1 = (area[3] - s->top) / s->size;
+    if (area[2] >= s->left && area[3] >= s->top) {
+        if (x0 < 0) x0 = 0;
+        if (y0 < 0) y0 = 0;
+        if (x1 >= GRID) x1 = GRID - 1;
+        if (y1 >= GRID) y1 = GRID - 1;
+        for (long long y = y0; y <= y1; y++) {
+            for (long long x = x0; x <= x1; x++) collect(s, &s->cells[y * GRID + x], area, &found);
+        }
+    }
+    if (found.count > 1) qsort(found.items, found.count, sizeof(int), compareNumbers);
+    // Merge the visible primitives with the shows and pauses, keeping the order of the frame
+    int p = 0, e = 0;
+    bool coloured = false;
+    unsigned int current = 0;
+    while (p < found.count || e < s->events.count) {
+        bool primitive = e == s->events.count || (p < found.count && found.items[p] < s->events.items[e]);
+        item *it = &s->items[primitive ? found.items[p++] : s->events.items[e++]];
+        if (it->kind == SHOWITEM) show(d);
+        else if (it->kind == PAUSEITEM) pause(d, it->a);
+        else if (it->kind == KEEPITEM) keepCanvas(d, it->a);
+        else {
+            if (!coloured || it->rgba != current) colour(d, it->rgba);
+            coloured = true;
+            current = it->rgba;
+            if (it->kind == LINEITEM) line(d, it->a, it->b, it->c, it->d);
+            else block(d, it->a, it->b, it->c, it->d);
+        }
+    }
+    colour(d, s->colourOut);
+    free(found.items);
+}
@@ -0,0 +1,32 @@
+// Scenes: the decoded primitives of a sketch frame with a spatial index, for panning and zooming.
+// -----------------------------------------------------------------
+// A scene holds the lines and blocks a frame draws, each with its colour, in the order
+// they are drawn, together with the shows and pauses between them. A grid over the area
+// the primitives cover maps every cell to the primitives touching it, so drawing the part
+// of a frame inside a viewport only visits the primitives near it. Visible primitives are
+// drawn in their original order, so the pixels are the same as drawing every primitive.
+
+// Kinds of items in a scene
+enum { LINEITEM, BLOCKITEM, SHOWITEM, PAUSEITEM, KEEPITEM };
+
+// An item of a scene: line(a,b,c,d) or block(a,b,c,d) in colour rgba, show(), pause(a)
+// or keepCanvas(a)
+typedef struct item { int kind, a, b, c, d; unsigned int rgba; } item;
+
+// A scene object, create it with buildScene and free it with freeScene.
+struct scene;
+typedef struct scene scene;
+
+// Decode the n commands of a frame into a scene, starting with the drawing colour rgba.
+// The last frame of a sketch (not ended by NEXTFRAME) is shown at its end.
+scene *buildScene(byte *bytes, int n, unsigned int rgba, bool last);
+
+// Release a scene.
+void freeScene(scene *s);
+
+// The drawing colour at the end of the frame of a scene.
+unsigned int sceneColour(scene *s);
+
+// Play a scene on a display, drawing only the primitives that touch the area from
+// (left,top) up to (right,bottom), excluded.
+void drawScene(display *d, scene *s, int left, int top, int right, int bottom);
@@ -0,0 +1,209 @@
+// Shared-memory frame ring, see shmring.h for how to use it.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+
+// Tag at the start of the shared memory of a ring
+#define MAGIC 0x534b5231
+
+// Start of the shared memory: the frame size, the number of frames published (also
+// counted in a 32 bit word for the futex), followed by the slots and then the pixels
+struct header {
+    unsigned int magic;
+    int width, height, slots;
+    _Atomic unsigned int published;
+    _Atomic unsigned long long written;
+};
+
+// Description of the frame in a slot. The sequence is the frame index plus one, or 0
+// while the producer is drawing into the slot.
+struct slot {
+    _Atomic unsigned long long sequence;
+    unsigned int frame, pause;
+};
+
+struct ring {
+    char *name;
+    bool owner;
+    size_t size;
+    struct header *h;
+    struct slot *slots;
+    unsigned int *pixels;
+    unsigned long long next;
+};
+
+// Size of the shared memory of a ring
+static size_t ringSize(int width, int height, int slots) {
+    return sizeof(struct header) + sizeof(struct slot) * slots + sizeof(unsigned int) * width * height * slots;
+}
+
+// Check that the header of a ring describes frames that fit into its shared memory of the
+// given size (which a header written by anything else than createRing need not do)
+static bool fits(struct header *h, off_t size) {
+    if (h->width <= 0 || h->height <= 0 || h->slots < 2 || size < (off_t) sizeof(struct header)) return false;
+    size_t pixels = (size_t) h->width * h->height;
+    if (pixels > (size_t) size / sizeof(unsigned int)) return false;
+    size_t frame = sizeof(struct slot) + sizeof(unsigned int) * pixels;
+    return (size_t) h->slots <= (size - sizeof(struct header)) / frame;
+}
+
+// Map the shared memory of a ring and set up the pointers into it
+static ring *mapRing(char *name, int fd, size_t size, bool owner) {
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) return NULL;
+    ring *r = malloc(sizeof(ring));
+    r->name = malloc(strlen(name) + 1);
+    strcpy(r->name, name);
+    r->owner = owner;
+    r->size = size;
+    r->h = memory;
+    r->slots = (struct slot *) (r->h + 1);
+    r->pixels = (unsigned int *) (r->slots + r->h->slots);
+    r->next = 0;
+    return r;
+}
+
+// Create a ring of slots frame buffers of width*height pixels under the given name
+// (like "/sketch"), returns NULL if the shared memory cannot be set up.
+ring *createRing(char *name, int width, int height, int slots) {
+    if (width <= 0 || height <= 0 || slots < 2) return NULL;
+    size_t size = ringSize(width, height, slots);
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    ring *r = mapRing(name, fd, size, true);
+    if (r == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+    r->h->width = width;
+    r->h->height = height;
+    r->h->slots = slots;
+    r->slots = (struct slot *) (r->h + 1);
+    r->pixels = (unsigned int *) (r->slots + slots);
+    atomic_store(&r->h->published, 0);
+    atomic_store(&r->h->written, 0);
+    for (int i = 0; i < slots; i++) atomic_store(&r->slots[i].sequence, 0);
+    atomic_thread_fence(memory_order_release);
+    r->h->magic = MAGIC;
+    return r;
+}
+
+// Open an existing ring for reading, returns NULL if there is none under that name.
+ring *openRing(char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    struct header h;
+    struct stat st;
+    if (read(fd, &h, sizeof(h)) != sizeof(h) || h.magic != MAGIC || fstat(fd, &st) != 0 || !fits(&h, st.st_size)) {
+        close(fd);
+        return NULL;
+    }
+    ring *r = mapRing(name, fd, ringSize(h.width, h.height, h.slots), false);
+    if (r != NULL) r->next = atomic_load(&r->h->written);
+    return r;
+}
+
+// Unmap a ring, the producer also removes its name.
+void closeRing(ring *r) {
+    munmap(r->h, r->size);
+    if (r->owner) shm_unlink(r->name);
+    free(r->name);
+    free(r);
+}
+
+// Width of the frames of a ring.
+int ringWidth(ring *r) {
+    return r->h->width;
+}
+
+// Height of the frames of a ring.
+int ringHeight(ring *r) {
+    return r->h->height;
+}
+
+// Pixels of slot i
+static unsigned int *slotPixels(ring *r, long i) {
+    return r->pixels + (size_t) i * r->h->width * r->h->height;
+}
+
+// Producer: the buffer to draw the next frame into, taken away from consumers until published.
+unsigned int *ringBuffer(ring *r) {
+    unsigned long long n = atomic_load_explicit(&r->h->written, memory_order_relaxed);
+    struct slot *s = &r->slots[n % r->h->slots];
+    atomic_store_explicit(&s->sequence, 0, memory_order_relaxed);
+    // Consumers checking the sequence after reading must see it cleared before any pixel changes
+    atomic_thread_fence(memory_order_seq_cst);
+    return slotPixels(r, n % r->h->slots);
+}
+
+// Producer: publish the buffer returned by ringBuffer as the next frame and wake the consumers.
+void publishFrame(ring *r, unsigned int frame, unsigned int pause) {
+    unsigned long long n = atomic_load_explicit(&r->h->written, memory_order_relaxed);
+    struct slot *s = &r->slots[n % r->h->slots];
+    s->frame = frame;
+    s->pause = pause;
+    atomic_store_explicit(&s->sequence, n + 1, memory_order_release);
+    atomic_store_explicit(&r->h->written, n + 1, memory_order_release);
+    atomic_fetch_add_explicit(&r->h->published, 1, memory_order_release);
+    syscall(SYS_futex, &r->h->published, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Consumer: wait up to ms milliseconds for the next frame not yet taken (skipping the ones
+// already overwritten) and fill in f. Returns false if no frame arrived in time. Waking up
+// without a frame to take (for a signal, say) waits again for the rest of the time only.
+bool nextFrame(ring *r, ringFrame *f, int ms) {
+    struct timespec deadline, now;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    long long end = deadline.tv_sec * 1000000000LL + deadline.tv_nsec + ms * 1000000LL;
+    while (true) {
+        unsigned int published = atomic_load_explicit(&r->h->published, memory_order_acquire);
+        unsigned long long written = atomic_load_explicit(&r->h->written, memory_order_acquire);
+        // The oldest slot may already be taken for drawing the next frame
+        if (written >= (unsigned long long) r->h->slots && r->next < written - r->h->slots + 1) {
+            r->next = written - r->h->slots + 1;
+        }
+        while (r->next < written) {
+            struct slot *s = &r->slots[r->next % r->h->slots];
+            if (atomic_load_explicit(&s->sequence, memory_order_acquire) == r->next + 1) {
+                f->index = r->next;
+                f->frame = s->frame;
+                f->pause = s->pause;
+                f->pixels = slotPixels(r, r->next % r->h->slots);
+                r->next++;
+                return true;
+            }
+            r->next++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long left = end - (now.tv_sec * 1000000000LL + now.tv_nsec);
+        if (left <= 0) return false;
+        struct timespec timeout = {left / 1000000000LL, left % 1000000000LL};
+        syscall(SYS_futex, &r->h->published, FUTEX_WAIT, published, &timeout, NULL, 0);
+    }
+}
+
+// Consumer: check that a frame has not been overwritten since nextFrame returned it.
+bool frameValid(ring *r, ringFrame *f) {
+    atomic_thread_fence(memory_order_seq_cst);
+    struct slot *s = &r->slots[f->index % r->h->slots];
+    return atomic_load_explicit(&s->sequence, memory_order_acquire) == f->index + 1;
+}
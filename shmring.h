@@ -0,0 +1,48 @@
+// Shared-memory frame ring: hands rendered frames to other processes without copying.
+// -----------------------------------------------------------------
+// A producer creates a named POSIX shared-memory object holding a ring of frame buffers,
+// draws each image straight into the next free buffer and publishes it when it is shown.
+// Consumers map the same object and read the buffers in place. Every publish wakes the
+// waiting consumers through a futex in the shared memory. A slow consumer is not waited
+// for: frames it has not taken before the producer comes round again are skipped.
+// Frames are numbered from 0 in the order they are published; each carries the number
+// of the sketch frame it belongs to and the milliseconds paused before it was shown.
+
+// An open ring, create it with createRing (producer) or openRing (consumer), close it with closeRing.
+struct ring;
+typedef struct ring ring;
+
+// A frame taken from a ring. The pixels (packed rgba ints, row by row) point into the
+// shared memory, so they are only reliable while frameValid says so.
+typedef struct ringFrame {
+    unsigned long long index;
+    unsigned int frame, pause;
+    unsigned int *pixels;
+} ringFrame;
+
+// Create a ring of slots frame buffers of width*height pixels under the given name
+// (like "/sketch"), returns NULL if the shared memory cannot be set up.
+ring *createRing(char *name, int width, int height, int slots);
+
+// Open an existing ring for reading, returns NULL if there is none under that name.
+ring *openRing(char *name);
+
+// Unmap a ring, the producer also removes its name.
+void closeRing(ring *r);
+
+// Width and height of the frames of a ring.
+int ringWidth(ring *r);
+int ringHeight(ring *r);
+
+// Producer: the buffer to draw the next frame into, taken away from consumers until published.
+unsigned int *ringBuffer(ring *r);
+
+// Producer: publish the buffer returned by ringBuffer as the next frame and wake the consumers.
+void publishFrame(ring *r, unsigned int frame, unsigned int pause);
+
+// Consumer: wait up to ms milliseconds for the next frame not yet taken (skipping the ones
+// already overwritten) and fill in f. Returns false if no frame arrived in time.
+bool nextFrame(ring *r, ringFrame *f, int ms);
+
+// Consumer: check that a frame has not been overwritten since nextFrame returned it.
+bool frameValid(ring *r, ringFrame *f);
@@ -1,9 +1,20 @@
 // Basic program skeleton for a Sketch File (.sk) Viewer
 #include "displayfull.h"
+#include "backend.h"
 #include "sketch.h"
+#include "tools.h"
+#include "framecache.h"
+#include "compiled.h"
+#include "wall.h"
+#include "decoder.h"
+#include "trace.h"
+#include "scene.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include "skz.h"
 
 // Allocate memory for a drawing state and initialise it
 state *newState() {
@@ -68,6 +79,7 @@ void obey(display *d, state *s, byte op) {
         else if (operand == SHOW) show(d);
         else if (operand == PAUSE) pause(d, s->data);
         else if (operand == NEXTFRAME) show(d);
+        else if (operand == KEEP) keepCanvas(d, s->data != 0);
         else s->tool = operand;
         s->data = 0;
     } else if (opcode == DATA) {
@@ -76,71 +88,362 @@ void obey(display *d, state *s, byte op) {
     }
 }
 
+// Frame cache used by processSketch, NULL unless switched on in view()
+static framecache *cache = NULL;
+
+// Drawing colour at the start of the next frame, part of the key of cached frames
+static unsigned int cacheColour = 0xFFFFFFFF;
+
+// Reset the drawing state apart from the 'start' field
+static void resetState(state *s) {
+    s->end = false;
+    s->data = 0;
+    s->tool = 1;
+    s->tx = 0;
+    s->ty = 0;
+    s->x = 0;
+    s->y = 0;
+}
+
+// Check if a byte is the NEXTFRAME command
+static bool isNextFrame(byte b) {
+    return (getOpcode(b) == TOOL && getOperand(b) == NEXTFRAME);
+}
+
+// Read the commands of the current frame, up to and including NEXTFRAME or up to
+// the end of the file, into a newly allocated array. Returns the number of commands.
+static int readFrame(FILE *sketchFile, byte **bytes) {
+    int n = 0, capacity = 256;
+    *bytes = malloc(capacity);
+    int ch = fgetc(sketchFile);
+    while (ch != EOF) {
+        if (n == capacity) {
+            capacity = capacity * 2;
+            *bytes = realloc(*bytes, capacity);
+        }
+        (*bytes)[n] = ch;
+        n++;
+        if (isNextFrame(ch)) break;
+        ch = fgetc(sketchFile);
+    }
+    return n;
+}
+
+// Container of the .skz file being played, kept open between frames, and its file name
+static skz *packed = NULL;
+static char *packedName = NULL;
+
+// Close the container kept open by readPackedFrame
+static void closePacked() {
+    if (packed != NULL) closeSkz(packed);
+    free(packedName);
+    packed = NULL;
+    packedName = NULL;
+}
+
+// Read the commands of the frame starting at position start of a .skz container
+// into a newly allocated array. Returns the number of commands.
+static int readPackedFrame(char *filename, long start, byte **bytes) {
+    if (packed == NULL || strcmp(packedName, filename) != 0) {
+        closePacked();
+        packed = openSkz(filename);
+        if (packed == NULL) {
+            fprintf(stderr, "Error: %s is not a valid .skz file\n", filename);
+            exit(1);
+        }
+        packedName = malloc(strlen(filename) + 1);
+        strcpy(packedName, filename);
+    }
+    return readSkzFrame(packed, start, bytes);
+}
+
+// Check if a frame has a KEEP command. Frames of sketches keeping the canvas draw over
+// what the frames before them left, so the frame cache is switched off for them.
+static bool keepsCanvas(byte *bytes, int n) {
+    for (int i = 0; i < n; i++) {
+        if (getOpcode(bytes[i]) == TOOL && getOperand(bytes[i]) == KEEP) return true;
+    }
+    return false;
+}
+
+// Play a frame from the cache if it is there, otherwise draw it and record what it
+// shows (by capturing the display before every show) so later loops can blit it.
+static void playCached(display *d, state *s, byte *bytes, int n, bool last) {
+    unsigned int hash = hashBytes(bytes, n);
+    frame *f = findFrame(cache, s->start, hash, cacheColour);
+    if (f != NULL) {
+        for (int i = 0; i < f->count; i++) {
+            if (f->steps[i].shot == NULL) pause(d, f->steps[i].ms);
+            else {
+                blit(d, f->steps[i].shot->pixels);
+                show(d);
+            }
+        }
+        colour(d, f->colourOut);
+        cacheColour = f->colourOut;
+        return;
+    }
+    f = beginFrame(cache, s->start, hash, cacheColour);
+    unsigned int *pixels = malloc(sizeof(unsigned int) * getWidth(d) * getHeight(d));
+    for (int i = 0; i < n; i++) {
+        if (getOpcode(bytes[i]) == TOOL) {
+            int operand = getOperand(bytes[i]);
+            if (operand == SHOW || operand == NEXTFRAME) {
+                capture(d, pixels);
+                addImage(cache, f, pixels);
+            }
+            else if (operand == PAUSE) addPause(f, s->data);
+            else if (operand == COLOUR) cacheColour = s->data;
+        }
+        obey(d, s, bytes[i]);
+    }
+    if (last) {
+        capture(d, pixels);
+        addImage(cache, f, pixels);
+        show(d);
+    }
+    free(pixels);
+    endFrame(cache, f, cacheColour);
+}
+
+// View of the picture, changed with keys: w, a, s and d pan, + and - zoom in and out,
+// 0 goes back to the default view
+static int viewX = 0, viewY = 0, viewLevel = 0;
+
+// A scene of a frame drawn while the view is not the default one, found by the frame's
+// start position, the hash of its bytes and the drawing colour it starts with
+typedef struct sceneEntry { scene *sc; unsigned int start, hash, colourIn; } sceneEntry;
+
+// Scenes of recently drawn frames (the oldest is replaced by the next one built),
+// and the drawing colour at the start of the next frame
+#define SCENES 64
+static sceneEntry scenes[SCENES];
+static int nextScene = 0;
+static unsigned int sceneColourIn = 0xFFFFFFFF;
+
+// Size of the part of the picture in view along a side of the display of the given size
+static int visible(int size) {
+    return viewLevel >= 0 ? size >> viewLevel : size << -viewLevel;
+}
+
+// Pan or zoom the view for a pressed key (zooming keeps the middle of the view in place)
+static void moveView(display *d, char key) {
+    int w = visible(getWidth(d)), h = visible(getHeight(d));
+    if (key == 'a') viewX -= w / 4;
+    else if (key == 'd') viewX += w / 4;
+    else if (key == 'w') viewY -= h / 4;
+    else if (key == 's') viewY += h / 4;
+    else if ((key == '+' || key == '=') && viewLevel < 6) {
+        viewX += w / 4;
+        viewY += h / 4;
+        viewLevel++;
+    } else if (key == '-' && viewLevel > -4) {
+        viewX -= w / 2;
+        viewY -= h / 2;
+        viewLevel--;
+    } else if (key == '0') viewX = viewY = viewLevel = 0;
+    else return;
+    setViewport(d, viewX, viewY, viewLevel);
+}
+
+// Play a frame through its scene, drawing only the primitives in view. The scene is
+// built from the frame's bytes unless it is one of the recently drawn ones.
+static void playScene(display *d, state *s, byte *bytes, int n, bool last) {
+    unsigned int hash = hashBytes(bytes, n);
+    sceneEntry *e = NULL;
+    for (int i = 0; i < SCENES && e == NULL; i++) {
+        sceneEntry *x = &scenes[i];
+        if (x->sc != NULL && x->start == s->start && x->hash == hash && x->colourIn == sceneColourIn) e = x;
+    }
+    if (e == NULL) {
+        e = &scenes[nextScene];
+        nextScene = (nextScene + 1) % SCENES;
+        if (e->sc != NULL) freeScene(e->sc);
+        *e = (sceneEntry) {buildScene(bytes, n, sceneColourIn, last), s->start, hash, sceneColourIn};
+    }
+    drawScene(d, e->sc, viewX, viewY, viewX + visible(getWidth(d)), viewY + visible(getHeight(d)));
+    sceneColourIn = sceneColour(e->sc);
+}
+
+// Release the scenes of recently drawn frames
+static void freeScenes() {
+    for (int i = 0; i < SCENES; i++) {
+        if (scenes[i].sc != NULL) freeScene(scenes[i].sc);
+        scenes[i].sc = NULL;
+    }
+}
+
 // Draw a frame of the sketch file. For basic and intermediate sketch files
 // this means drawing the full sketch whenever this function is called.
 // For advanced sketch files this means drawing the current frame whenever
 // this function is called.
 bool processSketch(display *d, void *data, const char pressedKey) {
     if (data == NULL) return (pressedKey == 27);
+    if (pressedKey != 0) moveView(d, pressedKey);
     char *filename = getName(d);
-    FILE *sketchFile = fopen(filename, "rb");
-    byte ch;
     state *s = (state*) data;
-    for (int i = 0; i < s->start; i++) {
-        ch = fgetc(sketchFile);
+    byte *bytes;
+    int n;
+    long begin = traceClock();
+    if (isSkz(filename)) n = readPackedFrame(filename, s->start, &bytes);
+    else {
+        FILE *sketchFile = fopen(filename, "rb");
+        fseek(sketchFile, s->start, SEEK_SET);
+        n = readFrame(sketchFile, &bytes);
+        fclose(sketchFile);
     }
-    while (!feof(sketchFile)) {
-        ch = fgetc(sketchFile);
-        obey(d, s, ch);
-        if (getOpcode(ch) == TOOL && getOperand(ch) == NEXTFRAME) {
-            s->start++;
-            s->end = false;
-            s->data = 0;
-            s->tool = 1;
-            s->tx = 0;
-            s->ty = 0;
-            s->x = 0;
-            s->y = 0;
-            return (pressedKey == 27);
-        }
-        s->start++;
+    traceSpan("read", begin, n, 0);
+    startFrame(d, s->start);
+    // The frame is the last one if the end of the file was reached before NEXTFRAME
+    bool last = (n == 0 || !isNextFrame(bytes[n-1]));
+    begin = traceClock();
+    long pixels = tracedPixels;
+    if (cache != NULL && keepsCanvas(bytes, n)) {
+        freeFrameCache(cache);
+        cache = NULL;
     }
-    fclose(sketchFile);
-    s->data = 0;
-    s->x = 0;
-    s->y = 0;
-    s->tx = 0;
-    s->ty = 0;
-    s->tool = 1;
-    s->start = 0;
-    show(d);
-    //TO DO: OPEN, PROCESS/DRAW A SKETCH FILE BYTE BY BYTE, THEN CLOSE IT
-    //NOTE: CHECK DATA HAS BEEN INITIALISED... if (data == NULL) return (pressedKey == 27);
-    //NOTE: TO GET ACCESS TO THE DRAWING STATE USE... state *s = (state*) data;
-    //NOTE: TO GET THE FILENAME... char *filename = getName(d);
-    //NOTE: DO NOT FORGET TO CALL show(d); AND TO RESET THE DRAWING STATE APART FROM
-    //      THE 'START' FIELD AFTER CLOSING THE FILE
-
+    if (viewX != 0 || viewY != 0 || viewLevel != 0) playScene(d, s, bytes, n, last);
+    else if (cache != NULL) playCached(d, s, bytes, n, last);
+    else {
+        for (int i = 0; i < n; i++) obey(d, s, bytes[i]);
+        if (last) show(d);
+    }
+    traceSpan("frame", begin, n, tracedPixels - pixels);
+    free(bytes);
+    resetState(s);
+    if (last) s->start = 0;
+    else s->start += n;
     return (pressedKey == 27);
 }
 
-// View a sketch file in a 200x200 pixel window given the filename
+// View a sketch file (or a .skz container of one) in a 200x200 pixel window given the filename.
+// Setting the SKETCH_CACHE environment variable to a number of megabytes
+// keeps that much of rendered frames in memory to replay looping animations.
 void view(char *filename) {
   display *d = newDisplay(filename, 200, 200);
   state *s = newState();
+  char *budget = getenv("SKETCH_CACHE");
+  if (budget != NULL) {
+    cache = newFrameCache(getWidth(d), getHeight(d), atol(budget) * 1024 * 1024);
+    cacheColour = 0xFFFFFFFF;
+  }
   run(d, s, processSketch);
+  if (cache != NULL) freeFrameCache(cache);
+  cache = NULL;
+  closePacked();
+  freeScenes();
   freeState(s);
   freeDisplay(d);
 }
 
 // Include a main function only if we are not testing (make sketch),
-// otherwise use the main function of the test.c file (make test).
-#ifndef TESTING
+// otherwise use the main function of the test.c file (make test), or of
+// the program using this file as a library (make export, make sketchopt).
+#if !defined(TESTING) && !defined(LIBRARY)
+// A sketch played while it is read from a file like stdin, whether that has ended and
+// the number of calls that took input
+typedef struct stream { feed *f; decoder *p; bool ended; long calls; } stream;
+
+// Decode the bytes that arrived since the last call, drawing frames as soon as they are
+// complete. Once the input has ended its last frame is shown again whenever called.
+static bool processStream(display *d, void *data, const char pressedKey) {
+  stream *st = (stream*) data;
+  if (st->ended) replayFrame(d, st->p);
+  else {
+    startFrame(d, ++st->calls);
+    byte *bytes;
+    int n = takeBytes(st->f, &bytes, &st->ended);
+    pushBytes(d, st->p, bytes, n);
+    free(bytes);
+    if (st->ended) endSketch(d, st->p);
+    else if (n == 0) pause(d, 5); // wait for input while still handling window events
+  }
+  return (pressedKey == 27);
+}
+
+// View a sketch read from stdin in a 200x200 pixel window, as it arrives.
+void viewStream() {
+  stream st = {startFeed(stdin), newDecoder(), false, 0};
+  display *d = newDisplay("stdin", 200, 200);
+  run(d, &st, processStream);
+  freeDisplay(d);
+  freeDecoder(st.p);
+  stopFeed(st.f);
+}
+
+// Show the next image of a wall of sketches when it changes, and wait until a tile is due
+static bool processWall(display *d, void *data, const char pressedKey) {
+  wall *w = (wall*) data;
+  if (stepWall(w) || pressedKey != 0) {
+    blit(d, wallPixels(w));
+    show(d);
+  }
+  pause(d, wallWait(w));
+  return (pressedKey == 27);
+}
+
+// View n sketch files at once as a grid of 200x200 tiles in one window, decoded and
+// drawn by a shared pool of worker threads (SKETCH_THREADS of them, default one per processor).
+void viewWall(int n, char *filenames[n]) {
+  char *threads = getenv("SKETCH_THREADS");
+  wall *w = newWall(n, filenames, threads == NULL ? 0 : atoi(threads));
+  display *d = newDisplay("sketch wall", wallWidth(w), wallHeight(w));
+  run(d, w, processWall);
+  freeDisplay(d);
+  freeWall(w);
+}
+
+// Play a sketch file on a headless display as fast as it decodes, SKETCH_PASSES times
+// (default once), and print how long a pass takes.
+void playHeadless(char *filename) {
+  char *count = getenv("SKETCH_PASSES");
+  int passes = (count == NULL || atoi(count) < 1) ? 1 : atoi(count), frames = 0;
+  display *d = newDisplay(filename, 200, 200);
+  state *s = newState();
+  clock_t begin = clock();
+  for (int i = 0; i < passes; i++) {
+    do {
+      processSketch(d, s, 0);
+      frames++;
+    } while (s->start != 0);
+  }
+  double ms = 1000.0 * (clock() - begin) / CLOCKS_PER_SEC;
+  printf("%s: %d frames in %.3f ms per pass on the %s display\n", filename, frames / passes,
+         ms / passes, displayBackend(d)->name);
+  closePacked();
+  freeScenes();
+  freeState(s);
+  freeDisplay(d);
+}
+
+// Display backends the viewer can play on, chosen by the SKETCH_DISPLAY environment variable
+static const backend *backends[] = {&windowBackend, &cpuBackend, &nullBackend, &recordBackend};
+
+// The backend called name, the window if name is NULL. Stops the program if there is none.
+static const backend *chooseBackend(char *name) {
+  if (name == NULL) return &windowBackend;
+  for (int i = 0; i < (int) (sizeof(backends) / sizeof(backends[0])); i++) {
+    if (strcmp(name, backends[i]->name) == 0) return backends[i];
+  }
+  fprintf(stderr, "Error: no display called %s, use window, cpu, null or record\n", name);
+  exit(1);
+}
+
 int main(int n, char *args[n]) {
-  if (n != 2) { // return usage hint if not exactly one argument
-    printf("Use ./sketch file\n");
+  startTrace("sketch");
+  const backend *b = chooseBackend(getenv("SKETCH_DISPLAY"));
+  useBackend(b);
+  if (n < 2) { // return usage hint if there is no argument
+    printf("Use ./sketch file [file...] or ./sketch - to read stdin\n");
+    exit(1);
+  } else if (b->headless && (n > 2 || strcmp(args[1], "-") == 0 || isCompiled(args[1]))) {
+    fprintf(stderr, "Error: the %s display plays single sketch files only\n", b->name);
     exit(1);
-  } else view(args[1]); // otherwise view sketch file in argument
+  } else if (n > 2) viewWall(n - 1, args + 1); // view several sketch files side by side
+  else if (strcmp(args[1], "-") == 0) viewStream(); // play a sketch piped into stdin
+  else if (isCompiled(args[1])) viewCompiled(args[1]); // play a compiled sketch
+  else if (b->headless) playHeadless(args[1]); // time the decoding without a window
+  else view(args[1]); // otherwise view sketch file in argument
   return 0;
 }
 #endif
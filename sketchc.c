@@ -0,0 +1,140 @@
+// Sketch compiler: translates a sketch file into C source with one function per frame,
+// each making the display calls of that frame with constant arguments, so that nothing
+// has to be decoded when the sketch is played. The generated file only needs the display
+// functions, which the viewer provides when it loads the compiled sketch:
+//   ./sketchc file.sk file.c && make file.so && ./sketch file.so
+// Usage: ./sketchc in.sk out.c (without arguments the tests are run)
+#include "displayfull.h"
+#include "backend.h"
+#include "sketch.h"
+#include "recorder.h"
+#include "compiled.h"
+
+// Write the C code for one recorded call
+void writeCall(FILE *out, call *k) {
+    if (k->kind == LINECALL) fprintf(out, "  line(d, %d, %d, %d, %d);\n", k->a, k->b, k->c, k->d);
+    else if (k->kind == BLOCKCALL) fprintf(out, "  block(d, %d, %d, %d, %d);\n", k->a, k->b, k->c, k->d);
+    else if (k->kind == COLOURCALL) fprintf(out, "  colour(d, (int) 0x%08xu);\n", (unsigned int) k->a);
+    else if (k->kind == SHOWCALL) fprintf(out, "  show(d);\n");
+    else if (k->kind == PAUSECALL) fprintf(out, "  pause(d, %d);\n", k->a);
+    else if (k->kind == KEEPCALL) fprintf(out, "  keepCanvas(d, %d);\n", k->a);
+}
+
+// Compile a sketch file into C source, returns the number of frame functions written
+int compile(char *input, char *output) {
+    FILE *in = fopen(input, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Error: cannot open %s\n", input);
+        exit(1);
+    }
+    fclose(in);
+    recording *r = recordSketch(input, 200, 200);
+    FILE *out = fopen(output, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error: cannot open %s\n", output);
+        exit(1);
+    }
+    fprintf(out, "// Compiled from %s by sketchc, build with: clang -shared -fPIC -O2 file.c -o file.so\n", input);
+    fprintf(out, "struct display;\ntypedef struct display display;\n");
+    fprintf(out, "void pause(display *d, int ms);\nvoid show(display *d);\n");
+    fprintf(out, "void line(display *d, int x0, int y0, int x1, int y1);\n");
+    fprintf(out, "void block(display *d, int x, int y, int w, int h);\n");
+    fprintf(out, "void colour(display *d, int rgba);\n");
+    fprintf(out, "void keepCanvas(display *d, _Bool keep);\n");
+    int begin = 0;
+    for (int f = 0; f < r->frames; f++) {
+        fprintf(out, "\nstatic void frame%d(display *d) {\n", f);
+        for (int i = begin; i < r->ends[f]; i++) writeCall(out, &r->calls[i]);
+        fprintf(out, "}\n");
+        begin = r->ends[f];
+    }
+    fprintf(out, "\nvoid (*const sketchFrames[])(display *d) = {");
+    for (int f = 0; f < r->frames; f++) fprintf(out, "%s frame%d", f == 0 ? "" : ",", f);
+    fprintf(out, " };\nconst int sketchFrameCount = %d;\n", r->frames);
+    fclose(out);
+    int frames = r->frames;
+    freeRecording(r);
+    return frames;
+}
+
+// A replacement for the library assert function.
+void assert(int line, bool b) {
+    if (b) return;
+    printf("The test on line %d fails.\n", line);
+    exit(1);
+}
+
+// Count the lines of a file starting with the given text
+int countLines(char *filename, char *start) {
+    FILE *file = fopen(filename, "r");
+    char text[256];
+    int n = 0;
+    while (fgets(text, sizeof(text), file) != NULL) {
+        if (strncmp(text, start, strlen(start)) == 0) n++;
+    }
+    fclose(file);
+    return n;
+}
+
+// Test that the example sketch files compile into one function per frame with the right calls
+void testCompile() {
+    assert(__LINE__, compile("sketch00.sk", "sketchc.tmp") == 1);
+    assert(__LINE__, countLines("sketchc.tmp", "  line(d, 0, 0, 30, 30);") == 1);
+    assert(__LINE__, compile("sketch08.sk", "sketchc.tmp") == 1);
+    assert(__LINE__, countLines("sketchc.tmp", "  show(d);") == 3);
+    assert(__LINE__, countLines("sketchc.tmp", "  pause(d, 192);") == 2);
+    assert(__LINE__, compile("sketch09.sk", "sketchc.tmp") == 3);
+    assert(__LINE__, countLines("sketchc.tmp", "static void frame") == 3);
+    assert(__LINE__, countLines("sketchc.tmp", "  colour(d, (int) 0xff00ffffu);") == 1);
+    assert(__LINE__, countLines("sketchc.tmp", "const int sketchFrameCount = 3;") == 1);
+    remove("sketchc.tmp");
+}
+
+// Play one pass of a compiled sketch, a frame per call
+static bool passCompiled(display *d, void *data, const char pressedKey) {
+    return playCompiled(d, (compiled*) data);
+}
+
+// Test that compiled example sketches, built into shared objects and loaded like the
+// viewer loads them, make the same display calls as the sketch files
+void testLoad() {
+    char *sketches[] = {"sketch00.sk", "sketch08.sk", "sketch09.sk"};
+    char source[32], library[32], command[64];
+    for (int i = 0; i < 3; i++) {
+        sprintf(source, "sketchctmp%d.c", i);
+        sprintf(library, "sketchctmp%d.so", i);
+        sprintf(command, "make -s %s", library);
+        int frames = compile(sketches[i], source);
+        assert(__LINE__, system(command) == 0);
+        compiled *c = loadCompiled(library);
+        display *d = openDisplay(&recordBackend, library, 200, 200);
+        run(d, c, passCompiled);
+        recording *r = recordSketch(sketches[i], 200, 200), *played = displayRecording(d);
+        assert(__LINE__, played->frames == frames && sameRendering(r, played, 200, 200));
+        assert(__LINE__, r->count == played->count && memcmp(r->calls, played->calls, sizeof(call) * r->count) == 0);
+        freeRecording(r);
+        freeDisplay(d);
+        freeCompiled(c);
+        remove(source);
+        remove(library);
+    }
+}
+
+// Run tests
+void test() {
+    testCompile();
+    testLoad();
+    printf("All tests passed.\n");
+}
+
+int main(int n, char *args[n]) {
+    if (n == 1) test();
+    else if (n == 3) {
+        int frames = compile(args[1], args[2]);
+        printf("%s: %d frames compiled into %s.\n", args[1], frames, args[2]);
+    } else {
+        fprintf(stderr, "Usage: ./sketchc in.sk out.c\n");
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,606 @@
+// Sketch render daemon (sketchd): a long-lived process rendering sketches for other local
+// processes over a Unix domain socket, so that they do not pay for starting a converter,
+// allocating and freeing for every render. A pool of worker threads is started up front,
+// each with its own canvas and output buffer that are reused from request to request (every
+// image is sent as soon as it is drawn, so the buffer holds one image at most), and
+// decoded sketches (recordings of their display calls) are cached by the hash of their bytes,
+// without the lines and blocks covered by later opaque blocks, which are never rasterised.
+//
+// Protocol: a client sends the line "render <length> [ppm|rgba] [scale]" followed by that
+// many bytes of sketch commands. The answer is the line "ok <images>" followed, for every
+// image the sketch shows, by the line "image <frame> <pause>" (the frame it is shown in and
+// the milliseconds paused after it) and the 200x200 image as a binary PPM (P6) or as raw
+// RGBA, 4 bytes per pixel. A scale of 2, 4 or 8 asks for thumbnails that many times
+// smaller (100x100, 50x50 or 25x25), drawn straight at that size (see canvas.h).
+// A bad request is answered by "error <reason>". Several requests can be sent over one
+// connection.
+// Usage: ./sketchd [-j threads] socket                (serve until killed)
+//        ./sketchd -r socket file.sk prefix [scale]   (render through a daemon into prefix000.ppm, ...)
+//        (without arguments the tests are run)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "canvas.h"
+#include "framecache.h"
+#include "recorder.h"
+
+// Size of the display the sketches are drawn on
+#define WIDTH 200
+#define HEIGHT 200
+
+// Largest sketch accepted, number of cached recordings and of connections waiting for a worker
+#define MAX_LENGTH (64L * 1024 * 1024)
+#define CACHE_SIZE 64
+#define QUEUE_SIZE 64
+
+// A cached recording of a sketch, with a copy of its bytes to tell hash collisions apart.
+// Entries in use by a worker (refs > 0) are not evicted.
+typedef struct entry {
+    unsigned int hash;
+    long n;
+    unsigned char *bytes;
+    recording *r;
+    int refs;
+    long used;
+} entry;
+
+// The daemon: its listening socket, the connections waiting for a worker, and the cache
+typedef struct server {
+    int socket;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t waiting;
+    int queue[QUEUE_SIZE], head, count;
+    entry cache[CACHE_SIZE];
+    long clock, hits, misses;
+    int threads;
+    pthread_t *workers;
+} server;
+
+// Reusable memory of a worker: the canvases it draws on, one per scale (made when first
+// needed), and the answer it builds
+typedef struct arena {
+    canvas *c[4];
+    unsigned char *out;
+    long size, capacity;
+} arena;
+
+// Write n bytes to a socket, returns false if the connection is gone
+static bool writeAll(int fd, void *data, long n) {
+    unsigned char *bytes = data;
+    while (n > 0) {
+        long done = send(fd, bytes, n, MSG_NOSIGNAL);
+        if (done <= 0) return false;
+        bytes += done;
+        n -= done;
+    }
+    return true;
+}
+
+// Read n bytes from a socket, returns false if the connection ends before
+static bool readAll(int fd, void *data, long n) {
+    unsigned char *bytes = data;
+    while (n > 0) {
+        long done = read(fd, bytes, n);
+        if (done <= 0) return false;
+        bytes += done;
+        n -= done;
+    }
+    return true;
+}
+
+// Read a line of at most size-1 characters from a socket (without the newline)
+static bool readLine(int fd, char *line, int size) {
+    for (int i = 0; i < size - 1; i++) {
+        if (!readAll(fd, &line[i], 1)) return false;
+        if (line[i] == '\n') {
+            line[i] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+// Make room for n more bytes of the answer in an arena, returns where they go or NULL if
+// there is no memory for them
+static unsigned char *reserve(arena *a, long n) {
+    if (a->size + n > a->capacity) {
+        long capacity = a->capacity == 0 ? 65536 : a->capacity;
+        while (a->size + n > capacity) capacity *= 2;
+        unsigned char *out = realloc(a->out, capacity);
+        if (out == NULL) return NULL;
+        a->out = out;
+        a->capacity = capacity;
+    }
+    a->size += n;
+    return a->out + a->size - n;
+}
+
+// Append n bytes to the answer in an arena, returns false if there is no memory for them
+static bool append(arena *a, void *data, long n) {
+    unsigned char *to = reserve(a, n);
+    if (to != NULL) memcpy(to, data, n);
+    return to != NULL;
+}
+
+// Find the recording of a sketch in the cache, or record it and cache it in place of the
+// least recently used entry not in use. The entry must be released with releaseEntry.
+static entry *findEntry(server *s, unsigned char *bytes, long n) {
+    unsigned int hash = hashBytes(bytes, n);
+    pthread_mutex_lock(&s->lock);
+    s->clock++;
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        entry *e = &s->cache[i];
+        if (e->r != NULL && e->hash == hash && e->n == n && memcmp(e->bytes, bytes, n) == 0) {
+            e->refs++;
+            e->used = s->clock;
+            s->hits++;
+            pthread_mutex_unlock(&s->lock);
+            return e;
+        }
+    }
+    s->misses++;
+    pthread_mutex_unlock(&s->lock);
+    recording *r = recordBytes(bytes, n, WIDTH, HEIGHT);
+    dropCovered(r, WIDTH, HEIGHT, true);
+    pthread_mutex_lock(&s->lock);
+    entry *oldest = NULL;
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        entry *e = &s->cache[i];
+        if (e->refs == 0 && (oldest == NULL || e->used < oldest->used)) oldest = e;
+    }
+    entry *e = oldest;
+    if (e == NULL) e = calloc(1, sizeof(entry)); // every entry is in use, do not cache
+    else if (e->r != NULL) {
+        freeRecording(e->r);
+        free(e->bytes);
+    }
+    *e = (entry) {hash, n, malloc(n + 1), r, 1, s->clock};
+    memcpy(e->bytes, bytes, n);
+    pthread_mutex_unlock(&s->lock);
+    return e;
+}
+
+// Release an entry found with findEntry
+static void releaseEntry(server *s, entry *e) {
+    pthread_mutex_lock(&s->lock);
+    e->refs--;
+    bool cached = (e >= s->cache && e < s->cache + CACHE_SIZE);
+    pthread_mutex_unlock(&s->lock);
+    if (cached) return;
+    freeRecording(e->r);
+    free(e->bytes);
+    free(e);
+}
+
+// The shift of the canvases drawing at 1/scale of the size, or -1 for other scales
+static int scaleShift(int scale) {
+    for (int shift = 0; shift < 4; shift++) {
+        if (scale == 1 << shift) return shift;
+    }
+    return -1;
+}
+
+// Append the image on a canvas to the answer in an arena, as a binary PPM or as raw RGBA,
+// returns false if there is no memory for it
+static bool appendImage(arena *a, canvas *c, bool ppm) {
+    int n = c->width * c->height, channels = ppm ? 3 : 4;
+    unsigned int *pixels = canvasPixels(c);
+    if (ppm) {
+        char header[32];
+        if (!append(a, header, sprintf(header, "P6\n%d %d\n255\n", c->width, c->height))) return false;
+    }
+    unsigned char *to = reserve(a, (long) n * channels);
+    if (to == NULL) return false;
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < channels; c++) to[channels * i + c] = pixels[i] >> (24 - 8 * c);
+    }
+    return true;
+}
+
+// The milliseconds paused after the show at call i of a recording, up to the next show
+static int pauseAfter(recording *r, int i) {
+    int pause = 0;
+    for (i++; i < r->count && r->calls[i].kind != SHOWCALL; i++) {
+        if (r->calls[i].kind == PAUSECALL) pause += r->calls[i].a;
+    }
+    return pause;
+}
+
+// Render a recording at 1/2^shift of its size and send it over a connection: the images it
+// shows with the frame each is shown in and the pause after it. Every image is sent as soon
+// as it is drawn, so the arena never holds more than one. Returns false if the connection
+// is gone or there is no memory for an image.
+static bool render(arena *a, int fd, recording *r, bool ppm, int shift) {
+    int images = 0;
+    for (int i = 0; i < r->count; i++) {
+        if (r->calls[i].kind == SHOWCALL) images++;
+    }
+    char line[64];
+    if (!append(a, line, sprintf(line, "ok %d\n", images))) return false;
+    if (a->c[shift] == NULL) a->c[shift] = newScaledCanvas(WIDTH, HEIGHT, shift);
+    canvas *c = a->c[shift];
+    clearCanvas(c, 0xFF);
+    c->rgba = 0xFFFFFFFF;
+    int i = 0;
+    for (int f = 0; f < r->frames; f++) {
+        while (true) {
+            i = drawUntilEvent(r, i, r->ends[f], c);
+            if (i == r->ends[f]) break;
+            if (r->calls[i].kind == SHOWCALL) {
+                if (!append(a, line, sprintf(line, "image %d %d\n", f, pauseAfter(r, i)))) return false;
+                if (!appendImage(a, c, ppm) || !writeAll(fd, a->out, a->size)) return false;
+                a->size = 0;
+                if (r->calls[i].a == 0) clearCanvas(c, 0xFF);
+            }
+            i++;
+        }
+    }
+    return true;
+}
+
+// Answer the requests sent over a connection until it is closed
+static void serve(server *s, arena *a, int fd) {
+    char line[128], format[8] = "ppm";
+    long n;
+    int scale;
+    while (readLine(fd, line, sizeof(line))) {
+        a->size = 0;
+        int fields = sscanf(line, "render %ld %7s %d", &n, format, &scale);
+        if (fields < 1 || n < 0 || n > MAX_LENGTH) {
+            char *error = "error bad request\n";
+            writeAll(fd, error, strlen(error));
+            break;
+        }
+        if (fields == 1) strcpy(format, "ppm");
+        if (fields < 3) scale = 1;
+        unsigned char *bytes = malloc(n + 1);
+        if (!readAll(fd, bytes, n)) {
+            free(bytes);
+            break;
+        }
+        bool sent = true;
+        if (strcmp(format, "ppm") != 0 && strcmp(format, "rgba") != 0) {
+            char *error = "error unknown format\n";
+            sent = writeAll(fd, error, strlen(error));
+        } else if (scaleShift(scale) < 0) {
+            char *error = "error unknown scale\n";
+            sent = writeAll(fd, error, strlen(error));
+        } else {
+            entry *e = findEntry(s, bytes, n);
+            sent = render(a, fd, e->r, strcmp(format, "ppm") == 0, scaleShift(scale));
+            releaseEntry(s, e);
+        }
+        free(bytes);
+        if (!sent || !writeAll(fd, a->out, a->size)) break;
+    }
+    close(fd);
+}
+
+// Worker thread: take connections from the queue and serve them, until the server stops
+static void *work(void *data) {
+    server *s = (server*) data;
+    arena a = {{NULL}, NULL, 0, 0};
+    while (true) {
+        pthread_mutex_lock(&s->lock);
+        while (!s->stop && s->count == 0) pthread_cond_wait(&s->waiting, &s->lock);
+        if (s->count == 0) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        int fd = s->queue[s->head];
+        s->head = (s->head + 1) % QUEUE_SIZE;
+        s->count--;
+        pthread_cond_broadcast(&s->waiting);
+        pthread_mutex_unlock(&s->lock);
+        serve(s, &a, fd);
+    }
+    for (int i = 0; i < 4; i++) {
+        if (a.c[i] != NULL) freeCanvas(a.c[i]);
+    }
+    free(a.out);
+    return NULL;
+}
+
+// Create a server listening on a Unix domain socket with a pool of worker threads
+// (0 for one per processor), returns NULL if the socket cannot be set up
+server *newServer(char *path, int threads) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) return NULL;
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return NULL;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, QUEUE_SIZE) != 0) {
+        close(fd);
+        return NULL;
+    }
+    server *s = calloc(1, sizeof(server));
+    s->socket = fd;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->waiting, NULL);
+    if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    s->threads = threads;
+    s->workers = malloc(sizeof(pthread_t) * threads);
+    for (int i = 0; i < threads; i++) pthread_create(&s->workers[i], NULL, work, s);
+    return s;
+}
+
+// Accept connections and hand them to the workers until stopServer is called
+void runServer(server *s) {
+    while (true) {
+        int fd = accept(s->socket, NULL, NULL);
+        pthread_mutex_lock(&s->lock);
+        if (s->stop) {
+            pthread_mutex_unlock(&s->lock);
+            if (fd >= 0) close(fd);
+            return;
+        }
+        if (fd >= 0) {
+            while (s->count == QUEUE_SIZE) pthread_cond_wait(&s->waiting, &s->lock);
+            s->queue[(s->head + s->count) % QUEUE_SIZE] = fd;
+            s->count++;
+            pthread_cond_broadcast(&s->waiting);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+// Make runServer return, finish the queued connections and release the server
+void stopServer(server *s) {
+    pthread_mutex_lock(&s->lock);
+    s->stop = true;
+    pthread_cond_broadcast(&s->waiting);
+    pthread_mutex_unlock(&s->lock);
+    shutdown(s->socket, SHUT_RDWR);
+}
+
+// Release a stopped server once runServer has returned
+void freeServer(server *s) {
+    for (int i = 0; i < s->threads; i++) pthread_join(s->workers[i], NULL);
+    close(s->socket);
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        if (s->cache[i].r == NULL) continue;
+        freeRecording(s->cache[i].r);
+        free(s->cache[i].bytes);
+    }
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->waiting);
+    free(s->workers);
+    free(s);
+}
+
+// Connect to a daemon, returns -1 if it cannot be reached
+int connectServer(char *path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Send a render request for images at 1/scale of the size over a connection and read the
+// first line of the answer, returns the number of images that follow or -1 on errors
+int requestRender(int fd, unsigned char *bytes, long n, char *format, int scale) {
+    char line[128];
+    int length = sprintf(line, "render %ld %s %d\n", n, format, scale);
+    if (!writeAll(fd, line, length) || !writeAll(fd, bytes, n)) return -1;
+    int images;
+    if (!readLine(fd, line, sizeof(line)) || sscanf(line, "ok %d", &images) != 1) return -1;
+    return images;
+}
+
+// Read the next image of an answer at 1/scale of the size into pixels (width*height*channels
+// bytes, with the width and height of the thumbnail) together with its frame and pause,
+// returns false on errors
+bool readImage(int fd, bool ppm, int scale, unsigned char *pixels, int *frame, int *pause) {
+    char line[128];
+    int width = (WIDTH + scale - 1) / scale, height = (HEIGHT + scale - 1) / scale;
+    if (!readLine(fd, line, sizeof(line)) || sscanf(line, "image %d %d", frame, pause) != 2) return false;
+    if (ppm) {
+        int w, h, maxval;
+        if (!readLine(fd, line, sizeof(line)) || strcmp(line, "P6") != 0) return false;
+        if (!readLine(fd, line, sizeof(line)) || sscanf(line, "%d %d", &w, &h) != 2) return false;
+        if (!readLine(fd, line, sizeof(line)) || sscanf(line, "%d", &maxval) != 1) return false;
+        if (w != width || h != height || maxval != 255) return false;
+    }
+    return readAll(fd, pixels, (long) width * height * (ppm ? 3 : 4));
+}
+
+// Read a whole file into a newly allocated array, returns NULL if it cannot be read
+unsigned char *readFile(char *filename, long *n) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    *n = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *bytes = malloc(*n + 1);
+    *n = fread(bytes, 1, *n, file);
+    fclose(file);
+    return bytes;
+}
+
+// Render a sketch file through a daemon at 1/scale of its size into PPM files named
+// prefix000.ppm, prefix001.ppm, ... and return the number of images written, or -1 on errors
+int renderRemote(char *path, char *filename, char *prefix, int scale) {
+    long n;
+    unsigned char *bytes = readFile(filename, &n);
+    if (bytes == NULL) return -1;
+    int fd = connectServer(path);
+    int images = fd < 0 ? -1 : requestRender(fd, bytes, n, "ppm", scale);
+    int width = (WIDTH + scale - 1) / scale, height = (HEIGHT + scale - 1) / scale;
+    free(bytes);
+    unsigned char *pixels = malloc(width * height * 3);
+    for (int i = 0; i < images; i++) {
+        int frame, pause;
+        char name[strlen(prefix) + 16];
+        sprintf(name, "%s%03d.ppm", prefix, i);
+        FILE *out = fopen(name, "wb");
+        if (out == NULL || !readImage(fd, true, scale, pixels, &frame, &pause)) {
+            if (out != NULL) fclose(out);
+            images = -1;
+            break;
+        }
+        fprintf(out, "P6\n%d %d\n255\n", width, height);
+        fwrite(pixels, 1, width * height * 3, out);
+        fclose(out);
+    }
+    free(pixels);
+    if (fd >= 0) close(fd);
+    return images;
+}
+
+// A replacement for the library assert function.
+void assert(int line, bool b) {
+    if (b) return;
+    printf("The test on line %d fails.\n", line);
+    exit(1);
+}
+
+// Test that sketches recorded from memory show the same as sketches recorded from files,
+// also once their covered calls are dropped
+void testRecordBytes() {
+    char filename[12];
+    for (int i = 0; i < 10; i++) {
+        sprintf(filename, "sketch%02d.sk", i);
+        long n;
+        unsigned char *bytes = readFile(filename, &n);
+        recording *a = recordSketch(filename, WIDTH, HEIGHT), *b = recordBytes(bytes, n, WIDTH, HEIGHT);
+        assert(__LINE__, sameRendering(a, b, WIDTH, HEIGHT));
+        dropCovered(b, WIDTH, HEIGHT, true);
+        assert(__LINE__, sameRendering(a, b, WIDTH, HEIGHT));
+        freeRecording(a);
+        freeRecording(b);
+        free(bytes);
+    }
+}
+
+// Run a server in a thread
+static void *runInThread(void *data) {
+    runServer((server*) data);
+    return NULL;
+}
+
+// Test rendering through a daemon: images and pauses, the cache, formats, thumbnails and
+// bad requests
+void testServer() {
+    server *s = newServer("sketchd.tmp", 2);
+    assert(__LINE__, s != NULL);
+    pthread_t thread;
+    pthread_create(&thread, NULL, runInThread, s);
+    int fd = connectServer("sketchd.tmp");
+    assert(__LINE__, fd >= 0);
+    long n;
+    unsigned char *bytes = readFile("sketch00.sk", &n), pixels[WIDTH * HEIGHT * 4];
+    int frame, pause;
+    assert(__LINE__, requestRender(fd, bytes, n, "ppm", 1) == 1);
+    assert(__LINE__, readImage(fd, true, 1, pixels, &frame, &pause));
+    assert(__LINE__, frame == 0 && pause == 0);
+    assert(__LINE__, pixels[3 * (10 * WIDTH + 10)] == 255 && pixels[3 * (10 * WIDTH + 20)] == 0);
+    assert(__LINE__, requestRender(fd, bytes, n, "rgba", 1) == 1);
+    assert(__LINE__, readImage(fd, false, 1, pixels, &frame, &pause));
+    assert(__LINE__, pixels[4 * (10 * WIDTH + 10)] == 255 && pixels[4 * (10 * WIDTH + 10) + 3] == 255);
+    assert(__LINE__, s->hits == 1 && s->misses == 1);
+    free(bytes);
+    bytes = readFile("sketch08.sk", &n);
+    assert(__LINE__, requestRender(fd, bytes, n, "ppm", 1) == 3);
+    int paused = 0;
+    for (int i = 0; i < 3; i++) {
+        assert(__LINE__, readImage(fd, true, 1, pixels, &frame, &pause));
+        paused += pause;
+    }
+    assert(__LINE__, paused == 2 * 192);
+    free(bytes);
+    bytes = readFile("sketch09.sk", &n);
+    assert(__LINE__, requestRender(fd, bytes, n, "ppm", 1) == 3);
+    for (int i = 0; i < 3; i++) {
+        assert(__LINE__, readImage(fd, true, 1, pixels, &frame, &pause));
+        assert(__LINE__, frame == i);
+    }
+    free(bytes);
+    // Thumbnails are the averages of the pixels of the full images under their pixels
+    bytes = readFile("sketch00.sk", &n);
+    unsigned char small[WIDTH * HEIGHT * 4];
+    assert(__LINE__, requestRender(fd, bytes, n, "rgba", 1) == 1);
+    assert(__LINE__, readImage(fd, false, 1, pixels, &frame, &pause));
+    for (int scale = 2; scale <= 8; scale *= 2) {
+        assert(__LINE__, requestRender(fd, bytes, n, "rgba", scale) == 1);
+        assert(__LINE__, readImage(fd, false, scale, small, &frame, &pause));
+        int width = WIDTH / scale;
+        for (int i = 0; i < width * width * 4; i++) {
+            int x = i / 4 % width, y = i / 4 / width, sum = 0;
+            for (int j = 0; j < scale * scale; j++) {
+                sum += pixels[4 * ((y * scale + j / scale) * WIDTH + x * scale + j % scale) + i % 4];
+            }
+            assert(__LINE__, small[i] == (sum + scale * scale / 2) / (scale * scale));
+        }
+    }
+    assert(__LINE__, requestRender(fd, bytes, n, "ppm", 3) == -1);
+    free(bytes);
+    // Answers of many images are sent image by image (the end of the sketch shows one more)
+    unsigned char shows[2000];
+    memset(shows, 0x86, sizeof(shows));
+    assert(__LINE__, requestRender(fd, shows, sizeof(shows), "rgba", 1) == 2001);
+    for (int i = 0; i < 2001; i++) assert(__LINE__, readImage(fd, false, 1, pixels, &frame, &pause));
+    assert(__LINE__, requestRender(fd, (unsigned char *) "", 0, "gif", 1) == -1);
+    assert(__LINE__, writeAll(fd, "hello\n", 6));
+    char line[64];
+    assert(__LINE__, readLine(fd, line, sizeof(line)) && strcmp(line, "error bad request") == 0);
+    close(fd);
+    assert(__LINE__, renderRemote("sketchd.tmp", "sketch09.sk", "sketchd.tmp", 8) == 3);
+    for (int i = 0; i < 3; i++) {
+        char name[32];
+        sprintf(name, "sketchd.tmp%03d.ppm", i);
+        assert(__LINE__, remove(name) == 0);
+    }
+    stopServer(s);
+    pthread_join(thread, NULL);
+    freeServer(s);
+    remove("sketchd.tmp");
+}
+
+// Run tests
+void test() {
+    testRecordBytes();
+    testServer();
+    printf("All tests passed.\n");
+}
+
+int main(int n, char *args[n]) {
+    if (n == 1) test();
+    else if ((n == 5 || n == 6) && strcmp(args[1], "-r") == 0) {
+        int scale = n == 6 ? atoi(args[5]) : 1;
+        if (scaleShift(scale) < 0) {
+            fprintf(stderr, "Error: thumbnails are 2, 4 or 8 times smaller\n");
+            exit(1);
+        }
+        int images = renderRemote(args[2], args[3], args[4], scale);
+        if (images < 0) {
+            fprintf(stderr, "Error: cannot render %s through %s\n", args[3], args[2]);
+            exit(1);
+        }
+        printf("%s: %d images written.\n", args[3], images);
+    } else if (n == 2 || (n == 4 && strcmp(args[1], "-j") == 0)) {
+        server *s = newServer(args[n - 1], n == 4 ? atoi(args[2]) : 0);
+        if (s == NULL) {
+            fprintf(stderr, "Error: cannot listen on %s\n", args[n - 1]);
+            exit(1);
+        }
+        runServer(s);
+        freeServer(s);
+    } else {
+        fprintf(stderr, "Usage: ./sketchd [-j threads] socket | ./sketchd -r socket file.sk prefix [scale]\n");
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,383 @@
+// Sketch diff: draws two sketch files (or a sketch file and a reference .pgm/.ppm image)
+// on a software canvas and compares the images they show, one by one. Reports the first
+// frame that shows a different image, how many pixels differ in it and the box around
+// them. Given two directories, every .sk/.skz file of the first is compared with the file
+// of the same name (.sk, .skz, .pgm or .ppm) in the second, on several threads.
+// Usage: ./sketchdiff [-j threads] a b (without arguments the tests are run)
+// The exit status is 0 if everything is the same, 1 if anything differs, 2 on errors.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "canvas.h"
+#include "recorder.h"
+
+// Size of the display the sketch files are drawn on
+#define WIDTH 200
+#define HEIGHT 200
+
+// Outcomes of a comparison
+enum { SAME, DIFFERENT, FAILED };
+
+// A comparison of file a with file b, and what was found: the first differing image
+// (shown in the given frame of a), its number of differing pixels and their bounding box.
+// For sketches showing a different number of images, pixels is -1. If the comparison
+// failed, unreadable is the file that could not be read (0 for a, 1 for b).
+typedef struct comparison {
+    char a[512], b[512];
+    int outcome, unreadable, frame, images;
+    long pixels;
+    int left, top, right, bottom;
+} comparison;
+
+// Recording a .skz file goes through processSketch, which keeps the open container between
+// frames in static variables, so only one thread records those at a time
+static pthread_mutex_t recordLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Check if a file name ends with the given extension
+static bool hasExtension(char *filename, char *extension) {
+    int n = strlen(filename), m = strlen(extension);
+    return (n > m && strcmp(filename + n - m, extension) == 0);
+}
+
+// Count the pixels that differ between two images in the bits of mask, and grow the
+// box (left, top, right, bottom) around them. Four pixels are compared at a time with SSE2.
+long diffImages(unsigned int *a, unsigned int *b, int width, int height, unsigned int mask, int box[4]) {
+    long count = 0;
+    for (int y = 0; y < height; y++) {
+        unsigned int *rowA = a + (long) y * width, *rowB = b + (long) y * width;
+        int x = 0, first = -1, last = -1;
+#ifdef __SSE2__
+        __m128i masks = _mm_set1_epi32(mask);
+        for (; x + 4 <= width; x += 4) {
+            __m128i va = _mm_and_si128(_mm_loadu_si128((__m128i *) (rowA + x)), masks);
+            __m128i vb = _mm_and_si128(_mm_loadu_si128((__m128i *) (rowB + x)), masks);
+            int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+            if (same == 15) continue;
+            for (int i = 0; i < 4; i++) {
+                if (same & (1 << i)) continue;
+                if (first < 0) first = x + i;
+                last = x + i;
+                count++;
+            }
+        }
+#endif
+        for (; x < width; x++) {
+            if (((rowA[x] ^ rowB[x]) & mask) == 0) continue;
+            if (first < 0) first = x;
+            last = x;
+            count++;
+        }
+        if (first < 0) continue;
+        if (first < box[0]) box[0] = first;
+        if (y < box[1]) box[1] = y;
+        if (last > box[2]) box[2] = last;
+        if (y > box[3]) box[3] = y;
+    }
+    return count;
+}
+
+// Read a .pgm (P5) or .ppm (P6) image with 8 or 16 bit samples into RGBA pixels,
+// returns NULL if it cannot be read or is not width*height pixels
+static unsigned int *readReference(char *filename, int width, int height) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+    int channels = 0, w, h, maxval;
+    char magic[3] = "";
+    if (fscanf(file, "%2s %d %d %d", magic, &w, &h, &maxval) == 4 && fgetc(file) != EOF) {
+        if (strcmp(magic, "P5") == 0) channels = 1;
+        if (strcmp(magic, "P6") == 0) channels = 3;
+    }
+    if (channels == 0 || w != width || h != height || maxval < 1 || maxval > 65535) {
+        fclose(file);
+        return NULL;
+    }
+    int bytes = maxval > 255 ? 2 : 1;
+    long n = (long) width * height * channels;
+    unsigned char *samples = malloc(n * bytes);
+    unsigned int *pixels = NULL;
+    if (fread(samples, bytes, n, file) == (size_t) n) {
+        pixels = malloc(sizeof(unsigned int) * width * height);
+        for (long p = 0; p < (long) width * height; p++) {
+            unsigned int rgba = 0xFF;
+            for (int c = 0; c < 3; c++) {
+                long i = p * channels + (channels == 3 ? c : 0);
+                unsigned int v = bytes == 1 ? samples[i] : (samples[2 * i] << 8) | samples[2 * i + 1];
+                rgba |= (v * 255 / maxval) << (24 - 8 * c);
+            }
+            pixels[p] = rgba;
+        }
+    }
+    free(samples);
+    fclose(file);
+    return pixels;
+}
+
+// Record a sketch file, NULL if it cannot be opened
+static recording *record(char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+    fclose(file);
+    bool packed = hasExtension(filename, ".skz");
+    if (packed) pthread_mutex_lock(&recordLock);
+    recording *r = recordSketch(filename, WIDTH, HEIGHT);
+    if (packed) pthread_mutex_unlock(&recordLock);
+    return r;
+}
+
+// Compare the files of a comparison and fill in what was found
+void compare(comparison *k) {
+    k->outcome = SAME;
+    k->frame = k->images = 0;
+    k->pixels = 0;
+    recording *ra = record(k->a), *rb = NULL;
+    unsigned int *reference = NULL;
+    bool image = hasExtension(k->b, ".pgm") || hasExtension(k->b, ".ppm");
+    if (image) reference = readReference(k->b, WIDTH, HEIGHT);
+    else rb = record(k->b);
+    if (ra == NULL || (image ? reference == NULL : rb == NULL)) {
+        k->unreadable = ra == NULL ? 0 : 1;
+        k->outcome = FAILED;
+        if (ra != NULL) freeRecording(ra);
+        if (rb != NULL) freeRecording(rb);
+        free(reference);
+        return;
+    }
+    player pa = {ra, newCanvas(WIDTH, HEIGHT), 0, 0, false}, pb = {rb, newCanvas(WIDTH, HEIGHT), 0, 0, false};
+    while (k->outcome == SAME) {
+        bool moreA = nextImage(&pa), moreB = image ? k->images == 0 : nextImage(&pb);
+        if (!moreA && !moreB) break;
+        k->frame = pa.frame;
+        if (moreA != moreB) {
+            k->outcome = DIFFERENT;
+            k->pixels = -1;
+            break;
+        }
+        int box[4] = {WIDTH, HEIGHT, -1, -1};
+        // References have no transparency, so only red, green and blue are compared with them
+        k->pixels = diffImages(pa.c->pixels, image ? reference : pb.c->pixels, WIDTH, HEIGHT,
+                               image ? 0xFFFFFF00 : 0xFFFFFFFF, box);
+        if (k->pixels > 0) {
+            k->outcome = DIFFERENT;
+            k->left = box[0];
+            k->top = box[1];
+            k->right = box[2];
+            k->bottom = box[3];
+        }
+        k->images++;
+        if (image) break;
+    }
+    freeCanvas(pa.c);
+    freeCanvas(pb.c);
+    freeRecording(ra);
+    if (rb != NULL) freeRecording(rb);
+    free(reference);
+}
+
+// Comparisons shared by the threads of compareAll, each thread takes the next one
+typedef struct jobs { comparison *list; int count, next; pthread_mutex_t lock; } jobs;
+
+// Thread body: run comparisons until none are left
+static void *worker(void *data) {
+    jobs *j = data;
+    while (true) {
+        pthread_mutex_lock(&j->lock);
+        int i = j->next++;
+        pthread_mutex_unlock(&j->lock);
+        if (i >= j->count) return NULL;
+        compare(&j->list[i]);
+    }
+}
+
+// Run a list of comparisons on the given number of threads
+void compareAll(comparison *list, int count, int threads) {
+    jobs j = {list, count, 0};
+    pthread_mutex_init(&j.lock, NULL);
+    if (threads < 1) threads = 1;
+    pthread_t ids[threads];
+    for (int t = 0; t < threads; t++) pthread_create(&ids[t], NULL, worker, &j);
+    for (int t = 0; t < threads; t++) pthread_join(ids[t], NULL);
+    pthread_mutex_destroy(&j.lock);
+}
+
+// Print the outcome of a comparison
+void report(comparison *k) {
+    if (k->outcome == FAILED) printf("%s: cannot read %s\n", k->a, k->unreadable == 0 ? k->a : k->b);
+    else if (k->outcome == SAME) printf("%s %s: same (%d images)\n", k->a, k->b, k->images);
+    else if (k->pixels < 0) printf("%s %s: differ in frame %d, one shows more images\n", k->a, k->b, k->frame);
+    else {
+        printf("%s %s: differ in frame %d, %ld pixels in (%d,%d)-(%d,%d)\n", k->a, k->b, k->frame,
+               k->pixels, k->left, k->top, k->right, k->bottom);
+    }
+}
+
+// Check if a path is a directory
+static bool isDirectory(char *path) {
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+// Order comparisons by the name of their first file
+static int compareNames(const void *a, const void *b) {
+    return strcmp(((const comparison *) a)->a, ((const comparison *) b)->a);
+}
+
+// List the comparisons of every .sk/.skz file in directory a with the file of the same name
+// in directory b, trying the extensions .sk, .skz, .pgm and .ppm. Returns their number.
+int listComparisons(char *a, char *b, comparison **list) {
+    DIR *dir = opendir(a);
+    int count = 0, capacity = 16;
+    *list = malloc(sizeof(comparison) * capacity);
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        char *name = entry->d_name;
+        if (!hasExtension(name, ".sk") && !hasExtension(name, ".skz")) continue;
+        if (count == capacity) {
+            capacity = capacity * 2;
+            *list = realloc(*list, sizeof(comparison) * capacity);
+        }
+        comparison *k = &(*list)[count++];
+        memset(k, 0, sizeof(comparison));
+        snprintf(k->a, sizeof(k->a), "%s/%s", a, name);
+        int base = strrchr(name, '.') - name;
+        char *extensions[] = {".sk", ".skz", ".pgm", ".ppm"};
+        for (int e = 0; e < 4; e++) {
+            snprintf(k->b, sizeof(k->b), "%s/%.*s%s", b, base, name, extensions[e]);
+            if (access(k->b, R_OK) == 0) break;
+        }
+    }
+    if (dir != NULL) closedir(dir);
+    qsort(*list, count, sizeof(comparison), compareNames);
+    return count;
+}
+
+// A replacement for the library assert function.
+void assert(int line, bool b) {
+    if (b) return;
+    printf("The test on line %d fails.\n", line);
+    exit(1);
+}
+
+// Write bytes into a file
+static void writeBytes(char *filename, unsigned char *bytes, int n) {
+    FILE *file = fopen(filename, "wb");
+    fwrite(bytes, 1, n, file);
+    fclose(file);
+}
+
+// Test diffImages() on rows that are not a multiple of four pixels wide
+void testDiffImages() {
+    unsigned int a[7 * 3] = {0}, b[7 * 3] = {0};
+    int box[4] = {7, 3, -1, -1};
+    assert(__LINE__, diffImages(a, b, 7, 3, 0xFFFFFFFF, box) == 0 && box[2] == -1);
+    b[1 * 7 + 2] = 0xFF;
+    b[2 * 7 + 6] = 0x100;
+    assert(__LINE__, diffImages(a, b, 7, 3, 0xFFFFFF00, box) == 1);
+    assert(__LINE__, box[0] == 6 && box[1] == 2 && box[2] == 6 && box[3] == 2);
+    assert(__LINE__, diffImages(a, b, 7, 3, 0xFFFFFFFF, box) == 2);
+    assert(__LINE__, box[0] == 2 && box[1] == 1 && box[2] == 6 && box[3] == 2);
+}
+
+// Test comparisons of sketches with each other and with reference images
+void testCompare() {
+    comparison k = {"sketch09.sk", "sketch09.sk"};
+    compare(&k);
+    assert(__LINE__, k.outcome == SAME && k.images == 3);
+    // A line from (0,0) to (0,30), and one from (1,0) to (1,30)
+    unsigned char line[] = {0x5e}, moved[] = {0x80, 0x01, 0x40, 0x81, 0x5e};
+    writeBytes("sketchdiff1.tmp", line, 1);
+    writeBytes("sketchdiff2.tmp", moved, 5);
+    k = (comparison) {"sketchdiff1.tmp", "sketchdiff2.tmp"};
+    compare(&k);
+    assert(__LINE__, k.outcome == DIFFERENT && k.frame == 0 && k.pixels == 2 * 31);
+    assert(__LINE__, k.left == 0 && k.top == 0 && k.right == 1 && k.bottom == 30);
+    strcpy(k.a, "sketch08.sk");
+    strcpy(k.b, "sketch09.sk");
+    compare(&k);
+    assert(__LINE__, k.outcome == DIFFERENT);
+    // Reference image: the line drawn in white on black, then one pixel changed
+    FILE *file = fopen("sketchdiff.pgm", "wb");
+    fprintf(file, "P5 200 200 255\n");
+    for (int i = 0; i < 200 * 200; i++) fputc(i % 200 == 0 && i / 200 <= 30 ? 255 : 0, file);
+    fclose(file);
+    k = (comparison) {"sketchdiff1.tmp", "sketchdiff.pgm"};
+    compare(&k);
+    assert(__LINE__, k.outcome == SAME && k.images == 1);
+    file = fopen("sketchdiff.pgm", "r+b");
+    fseek(file, -1, SEEK_END);
+    fputc(7, file);
+    fclose(file);
+    compare(&k);
+    assert(__LINE__, k.outcome == DIFFERENT && k.pixels == 1 && k.left == 199 && k.bottom == 199);
+    k = (comparison) {"sketchdiff1.tmp", "missing.pgm"};
+    compare(&k);
+    assert(__LINE__, k.outcome == FAILED);
+    remove("sketchdiff1.tmp");
+    remove("sketchdiff2.tmp");
+    remove("sketchdiff.pgm");
+}
+
+// Test that comparisons run on several threads give the same results as one by one
+void testCompareAll() {
+    comparison list[20];
+    for (int i = 0; i < 20; i++) {
+        list[i] = (comparison) {""};
+        sprintf(list[i].a, "sketch%02d.sk", i % 10);
+        sprintf(list[i].b, "sketch%02d.sk", (i + i / 10) % 10);
+    }
+    compareAll(list, 20, 4);
+    for (int i = 0; i < 20; i++) {
+        comparison k = list[i];
+        compare(&k);
+        assert(__LINE__, k.outcome == list[i].outcome && k.pixels == list[i].pixels);
+        assert(__LINE__, (i < 10) == (k.outcome == SAME));
+    }
+}
+
+// Run tests
+void test() {
+    testDiffImages();
+    testCompare();
+    testCompareAll();
+    printf("All tests passed.\n");
+}
+
+int main(int n, char *args[n]) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN), i = 1;
+    if (n > 2 && strcmp(args[1], "-j") == 0) {
+        threads = atoi(args[2]);
+        i = 3;
+    }
+    if (n == 1) test();
+    else if (n - i == 2) {
+        comparison *list;
+        int count = 1;
+        if (isDirectory(args[i]) && isDirectory(args[i + 1])) {
+            count = listComparisons(args[i], args[i + 1], &list);
+        } else {
+            list = calloc(1, sizeof(comparison));
+            snprintf(list[0].a, sizeof(list[0].a), "%s", args[i]);
+            snprintf(list[0].b, sizeof(list[0].b), "%s", args[i + 1]);
+        }
+        compareAll(list, count, threads);
+        int status = 0;
+        for (int k = 0; k < count; k++) {
+            report(&list[k]);
+            if (list[k].outcome == DIFFERENT && status == 0) status = 1;
+            if (list[k].outcome == FAILED) status = 2;
+        }
+        free(list);
+        return status;
+    } else {
+        fprintf(stderr, "Usage: ./sketchdiff [-j threads] a.sk b.sk|b.pgm|b.ppm or ./sketchdiff [-j threads] dirA dirB\n");
+        exit(1);
+    }
+    return 0;
+}
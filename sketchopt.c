@@ -0,0 +1,349 @@
+// Sketch optimiser (sketch-opt): rewrites a sketch file into a smaller one that shows exactly
+// the same frames. The input is decoded through processSketch into a recording of display
+// calls, lines and blocks covered by later opaque blocks before the next show are dropped
+// (they never reach the screen), and every remaining call is then encoded again with as few commands as possible: colours
+// and tools are only switched when a drawing needs them, lines continuing each other along
+// a row or column are merged, data values lose their leading zero chunks, target positions
+// are reached with relative DX/DY steps or absolute TARGETX/TARGETY (whichever is shorter)
+// and moves with the NONE tool are merged. The result is verified by drawing both files
+// frame by frame and comparing the pixels.
+// Usage: ./sketchopt in.sk out.sk (without arguments the tests are run)
+#include "displayfull.h"
+#include "sketch.h"
+#include "tools.h"
+#include "recorder.h"
+
+// Size of the display the sketch files are drawn on
+#define WIDTH 200
+#define HEIGHT 200
+
+// Decoder state as tracked by the encoder, the colour set on the display and the
+// colour the next drawing has to use
+typedef struct encoder {
+    FILE *out;
+    long bytes;
+    int x, y, tx, ty, tool;
+    unsigned int colour, wanted;
+} encoder;
+
+// Write one command byte
+static void put(encoder *e, int opcode, int operand) {
+    fputc((opcode << 6) | (operand & 63), e->out);
+    e->bytes++;
+}
+
+// Number of DATA commands needed to build up a value (the data field is 0 after any TOOL)
+static int chunks(unsigned int value) {
+    int n = 0;
+    while (value != 0) {
+        value = value >> 6;
+        n++;
+    }
+    return n;
+}
+
+// Number of DX commands needed to shift tx by dx
+static long long steps(long long dx) {
+    if (dx >= 0) return (dx + 30) / 31;
+    return (-dx + 31) / 32;
+}
+
+// Write a TOOL command with the given data value built up before it, and track its effect
+static void writeTool(encoder *e, int operand, unsigned int data) {
+    for (int i = chunks(data) - 1; i >= 0; i--) put(e, DATA, (data >> (6 * i)) & 63);
+    put(e, TOOL, operand);
+    if (operand == TARGETX) e->tx = data;
+    else if (operand == TARGETY) e->ty = data;
+    else if (operand == COLOUR) e->colour = data;
+    else if (operand < COLOUR) e->tool = operand;
+}
+
+// Select a tool unless it is already selected
+static void setTool(encoder *e, int tool) {
+    if (e->tool != tool) writeTool(e, tool, 0);
+}
+
+// Set tx to x with DX steps or TARGETX, whichever is shorter
+static void targetX(encoder *e, int x) {
+    if (e->tx == x) return;
+    if (steps((long long) x - e->tx) <= chunks(x) + 1) {
+        while (e->tx != x) {
+            long long dx = (long long) x - e->tx;
+            if (dx > 31) dx = 31;
+            if (dx < -32) dx = -32;
+            put(e, DX, dx);
+            e->tx += dx;
+        }
+    } else writeTool(e, TARGETX, x);
+}
+
+// Write the DY command that ends at y, preceded by a TARGETY if y is out of reach of one DY.
+// The TARGETY value is picked within reach of y so that it needs as few DATA commands as possible.
+static void finishY(encoder *e, int y) {
+    if ((long long) y - e->ty < -32 || (long long) y - e->ty > 31) {
+        int best = y;
+        for (int dy = -32; dy <= 31; dy++) {
+            if (chunks((unsigned int) y - dy) < chunks(best)) best = (unsigned int) y - dy;
+        }
+        writeTool(e, TARGETY, best);
+    }
+    put(e, DY, y - e->ty);
+    e->ty = y;
+    e->x = e->tx;
+    e->y = e->ty;
+}
+
+// Move the current position to (x,y) without drawing
+static void moveTo(encoder *e, int x, int y) {
+    if (e->x == x && e->y == y) return;
+    if (e->tool == LINE || e->tool == BLOCK) setTool(e, NONE);
+    targetX(e, x);
+    // Without a drawing tool several DY commands can be chained instead of a TARGETY
+    long long relative = steps((long long) y - e->ty);
+    if (relative > 1 && relative < chunks(y) + 2) {
+        while ((long long) y - e->ty < -32 || (long long) y - e->ty > 31) {
+            int dy = y > e->ty ? 31 : -32;
+            put(e, DY, dy);
+            e->ty += dy;
+        }
+    }
+    finishY(e, y);
+}
+
+// Draw a line or block from (x0,y0) to (x1,y1) in the wanted colour
+static void draw(encoder *e, int tool, int x0, int y0, int x1, int y1) {
+    if (e->colour != e->wanted) writeTool(e, COLOUR, e->wanted);
+    moveTo(e, x0, y0);
+    setTool(e, tool);
+    targetX(e, x1);
+    finishY(e, y1);
+}
+
+// Check if line l2 continues line l1 along the same column or row in the same direction,
+// so that one line from the start of l1 to the end of l2 covers exactly the same pixels
+static bool continues(call *l1, call *l2) {
+    if (l2->kind != LINECALL || l2->a != l1->c || l2->b != l1->d) return false;
+    if (l1->a == l1->c && l2->a == l2->c) return (l1->d - l1->b) * (long long) (l2->d - l2->b) >= 0;
+    if (l1->b == l1->d && l2->b == l2->d) return (l1->c - l1->a) * (long long) (l2->c - l2->a) >= 0;
+    return false;
+}
+
+// Encode the calls of one frame, the show ending the frame is implied by NEXTFRAME or the end of the file
+static void encodeFrame(encoder *e, call *calls, int n, bool last) {
+    for (int i = 0; i < n - 1; i++) {
+        call *k = &calls[i];
+        if (k->kind == LINECALL) {
+            // Merge lines continuing each other, skipping colour calls that change nothing
+            call merged = *k;
+            int j = i + 1;
+            while (j < n - 1) {
+                if (calls[j].kind == COLOURCALL && (unsigned int) calls[j].a == e->wanted) j++;
+                else if (continues(&merged, &calls[j])) {
+                    merged.c = calls[j].c;
+                    merged.d = calls[j].d;
+                    i = j;
+                    j++;
+                } else break;
+            }
+            draw(e, LINE, merged.a, merged.b, merged.c, merged.d);
+        }
+        else if (k->kind == BLOCKCALL) draw(e, BLOCK, k->a, k->b, k->a + k->c, k->b + k->d);
+        else if (k->kind == COLOURCALL) e->wanted = k->a;
+        else if (k->kind == SHOWCALL) writeTool(e, SHOW, 0);
+        else if (k->kind == PAUSECALL) writeTool(e, PAUSE, k->a);
+        else if (k->kind == KEEPCALL) writeTool(e, KEEP, k->a);
+    }
+    if (last) {
+        // The colour is kept when the animation loops, so it must end up the same
+        if (e->colour != e->wanted) writeTool(e, COLOUR, e->wanted);
+        return;
+    }
+    writeTool(e, NEXTFRAME, 0);
+    e->x = e->y = e->tx = e->ty = 0;
+    e->tool = LINE;
+}
+
+// Optimise a sketch file into another file, returns the size of the output in bytes
+// or -1 if the output does not show the same frames as the input. The number of hidden
+// lines and blocks left out is put in dropped. Lines and blocks off the display are kept,
+// as they show when the view is moved, and only blocks covering them in the coordinates
+// of the whole picture hide them.
+long optimise(char *input, char *output, int *dropped) {
+    recording *r = recordSketch(input, WIDTH, HEIGHT);
+    recording *original = recordSketch(input, WIDTH, HEIGHT);
+    *dropped = dropCovered(r, WIDTH, HEIGHT, false);
+    encoder e = {fopen(output, "wb"), 0, 0, 0, 0, 0, LINE, 0xFFFFFFFF, 0xFFFFFFFF};
+    if (e.out == NULL) {
+        fprintf(stderr, "Error: cannot open %s\n", output);
+        exit(1);
+    }
+    int begin = 0;
+    for (int f = 0; f < r->frames; f++) {
+        encodeFrame(&e, &r->calls[begin], r->ends[f] - begin, f == r->frames - 1);
+        begin = r->ends[f];
+    }
+    fclose(e.out);
+    recording *check = recordSketch(output, WIDTH, HEIGHT);
+    bool same = sameRendering(original, check, WIDTH, HEIGHT);
+    freeRecording(check);
+    freeRecording(original);
+    freeRecording(r);
+    return same ? e.bytes : -1;
+}
+
+// Size of a file in bytes
+long fileSize(char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+// A replacement for the library assert function.
+void assert(int line, bool b) {
+    if (b) return;
+    printf("The test on line %d fails.\n", line);
+    exit(1);
+}
+
+// Test chunks() and steps()
+void testCounts() {
+    assert(__LINE__, chunks(0) == 0);
+    assert(__LINE__, chunks(63) == 1);
+    assert(__LINE__, chunks(64) == 2);
+    assert(__LINE__, chunks(0xFFFFFFFF) == 6);
+    assert(__LINE__, steps(0) == 0);
+    assert(__LINE__, steps(31) == 1);
+    assert(__LINE__, steps(32) == 2);
+    assert(__LINE__, steps(-32) == 1);
+    assert(__LINE__, steps(-33) == 2);
+}
+
+// Test dropping a line covered by a later opaque block, but not one drawn after the block
+void testCovered() {
+    byte bytes[] = {
+        0x0A, 0x4A,                   // line from (0,0) to (10,10)
+        0x80, 0x36, 0x76,             // move back to (0,0)
+        0x82, 0xC3, 0xC8, 0x84,       // block tool, target x 200
+        0xC3, 0xC8, 0x85, 0x40,       // target y 200, block from (0,0) to (200,200)
+        0x81, 0x3B, 0x7B              // line from (200,200) to (195,195)
+    };
+    recording *r = recordBytes(bytes, sizeof(bytes), WIDTH, HEIGHT);
+    assert(__LINE__, r->count == 4 && r->calls[0].kind == LINECALL);
+    assert(__LINE__, dropCovered(r, WIDTH, HEIGHT, false) == 1);
+    assert(__LINE__, r->count == 3 && r->frames == 1 && r->ends[0] == 3);
+    assert(__LINE__, r->calls[0].kind == BLOCKCALL && r->calls[1].kind == LINECALL);
+    freeRecording(r);
+}
+
+// Test that lines off the display, or covered only on it, are kept for the whole picture
+// and dropped for the display alone, and that blocks of no size are dropped either way
+void testOffDisplay() {
+    byte bytes[] = {
+        0x80, 0xC3, 0xFA, 0x84, 0x40, // move to (250,0)
+        0x81, 0x45,                   // line from (250,0) to (250,5), off the display
+        0xC2, 0xE0, 0x84, 0x40,       // line from (250,5) to (160,5)
+        0x80, 0xC2, 0xD6, 0x84, 0x7B, // move to (150,0)
+        0x82, 0xC3, 0xC8, 0x84, 0x4A, // block from (150,0) to (200,10)
+        0x40                          // block at (200,10) of no size
+    };
+    for (int onDisplay = 0; onDisplay <= 1; onDisplay++) {
+        recording *r = recordBytes(bytes, sizeof(bytes), WIDTH, HEIGHT);
+        assert(__LINE__, r->count == 5 && r->calls[0].kind == LINECALL && r->calls[0].a == 250);
+        assert(__LINE__, r->calls[1].kind == LINECALL && r->calls[1].c == 160);
+        assert(__LINE__, r->calls[2].kind == BLOCKCALL && r->calls[3].kind == BLOCKCALL);
+        // The block covers the second line only on the display
+        assert(__LINE__, dropCovered(r, WIDTH, HEIGHT, onDisplay) == (onDisplay ? 3 : 1));
+        assert(__LINE__, r->calls[r->count - 2].kind == BLOCKCALL && r->calls[r->count - 2].c == 50);
+        assert(__LINE__, r->count == (onDisplay ? 2 : 4));
+        freeRecording(r);
+    }
+    FILE *file = fopen("sketchopt.tmp", "wb");
+    fwrite(bytes, 1, sizeof(bytes), file);
+    fclose(file);
+    int dropped;
+    assert(__LINE__, optimise("sketchopt.tmp", "sketchopt2.tmp", &dropped) > 0 && dropped == 1);
+    recording *r = recordSketch("sketchopt2.tmp", WIDTH, HEIGHT);
+    assert(__LINE__, r->count == 4 && r->calls[0].kind == LINECALL && r->calls[0].a == 250);
+    freeRecording(r);
+    remove("sketchopt.tmp");
+    remove("sketchopt2.tmp");
+}
+
+// Test that a kept canvas is recorded, shown without clearing, and survives optimising
+void testKept() {
+    byte bytes[] = {
+        0xC1, 0x89,                   // keep the canvas
+        0x0A, 0x4A,                   // line from (0,0) to (10,10)
+        0x88,                         // next frame
+        0x14, 0x40                    // line from (0,0) to (20,0)
+    };
+    FILE *file = fopen("sketchopt.tmp", "wb");
+    fwrite(bytes, 1, sizeof(bytes), file);
+    fclose(file);
+    recording *r = recordBytes(bytes, sizeof(bytes), WIDTH, HEIGHT);
+    assert(__LINE__, r->frames == 2 && r->calls[0].kind == KEEPCALL && r->calls[0].a == 1);
+    assert(__LINE__, r->calls[2].kind == SHOWCALL && r->calls[2].a == 1);
+    byte cleared[sizeof(bytes)];
+    memcpy(cleared, bytes, sizeof(bytes));
+    cleared[0] = 0xC0;
+    recording *c = recordBytes(cleared, sizeof(cleared), WIDTH, HEIGHT);
+    assert(__LINE__, !sameRendering(r, c, WIDTH, HEIGHT));
+    freeRecording(c);
+    freeRecording(r);
+    int dropped;
+    assert(__LINE__, optimise("sketchopt.tmp", "sketchopt2.tmp", &dropped) > 0);
+    r = recordSketch("sketchopt2.tmp", WIDTH, HEIGHT);
+    assert(__LINE__, r->calls[0].kind == KEEPCALL && r->calls[0].a == 1);
+    freeRecording(r);
+    remove("sketchopt.tmp");
+    remove("sketchopt2.tmp");
+}
+
+// Test that every example sketch file optimises into a verified file that is no larger
+void testSketches() {
+    char filename[12];
+    for (int i = 0; i < 10; i++) {
+        sprintf(filename, "sketch%02d.sk", i);
+        int dropped;
+        long size = optimise(filename, "sketchopt.tmp", &dropped);
+        assert(__LINE__, size >= 0);
+        assert(__LINE__, size <= fileSize(filename));
+    }
+    remove("sketchopt.tmp");
+}
+
+// Run tests
+void test() {
+    testCounts();
+    testCovered();
+    testOffDisplay();
+    testKept();
+    testSketches();
+    printf("All tests passed.\n");
+}
+
+int main(int n, char *args[n]) {
+    if (n == 1) test();
+    else if (n == 3) {
+        long before = fileSize(args[1]);
+        if (before < 0) {
+            fprintf(stderr, "Error: cannot open %s\n", args[1]);
+            exit(1);
+        }
+        int dropped;
+        long after = optimise(args[1], args[2], &dropped);
+        if (after < 0) {
+            fprintf(stderr, "Error: optimised file does not render the same, removed %s\n", args[2]);
+            remove(args[2]);
+            exit(1);
+        }
+        printf("%s: %ld -> %ld bytes, %d hidden lines and blocks dropped, verified.\n", args[1], before, after, dropped);
+    } else {
+        fprintf(stderr, "Usage: ./sketchopt in.sk out.sk\n");
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,529 @@
+// Compressed sketch container, see skz.h for the file layout.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "skz.h"
+
+// Chunks collect whole frames until they hold at least this many commands
+#define CHUNK 65536
+// Bytes taken by the header and by every index entry
+#define HEADER 16
+#define ENTRY 24
+// Match lengths, hash table size and how far the match finder follows hash chains
+#define MINMATCH 3
+#define MAXMATCH (MINMATCH + 255)
+#define HASHBITS 16
+#define CHAIN 64
+// Probabilities are 11bit, adapting by 1/32 of the distance to 0 or 1 on every bit
+#define PROBBITS 11
+#define ADAPT 5
+#define TOP (1u << 24)
+
+// NEXTFRAME command byte (TOOL opcode with operand 8)
+#define NEXTFRAMEBYTE 0x88
+
+// Index entry of a chunk
+typedef struct chunk { unsigned int first, frames, rawOffset, rawSize, offset, size; } chunk;
+
+// Open container with the chunk decompressed last
+struct skz {
+    FILE *file;
+    int count, frames;
+    long length;
+    chunk *chunks;
+    int loaded;
+    unsigned char *raw;
+};
+
+// Adaptive probabilities used to code the tokens of one chunk: whether a token is a match
+// (after a literal or after a match) and a repeat of the last distance, literals (in the
+// context of the opcode of the previous command), lengths and distance bit counts
+typedef struct model {
+    unsigned short isMatch[2], isRep[2];
+    unsigned short literal[4][256];
+    unsigned short length[2][256];
+    unsigned short slot[32];
+} model;
+
+// Range encoder writing into a growing array
+typedef struct encoder {
+    unsigned long long low;
+    unsigned int range;
+    unsigned char cache;
+    long pending;
+    unsigned char *out;
+    long n, capacity;
+} encoder;
+
+// Range decoder reading from an array
+typedef struct decoder {
+    unsigned int range, code;
+    unsigned char *in;
+    long n, pos;
+} decoder;
+
+// Check if file name string is of .skz format
+bool isSkz(char *filename) {
+    int n = strlen(filename);
+    return (n > 4 && strcmp(filename + n - 4, ".skz") == 0);
+}
+
+// Set all probabilities of a model to one half
+static void resetModel(model *m) {
+    unsigned short *p = (unsigned short *) m;
+    for (unsigned int i = 0; i < sizeof(model) / sizeof(unsigned short); i++) p[i] = 1 << (PROBBITS - 1);
+}
+
+// Append a byte to the output of an encoder
+static void emit(encoder *e, unsigned char b) {
+    if (e->n == e->capacity) {
+        e->capacity = e->capacity * 2 + 256;
+        e->out = realloc(e->out, e->capacity);
+    }
+    e->out[e->n] = b;
+    e->n++;
+}
+
+// Move the top byte of low to the output, resolving carries into bytes held back
+static void shiftLow(encoder *e) {
+    if (e->low < 0xFF000000ull || e->low >= 0x100000000ull) {
+        unsigned char carry = e->low >> 32;
+        unsigned char b = e->cache;
+        do {
+            emit(e, b + carry);
+            b = 0xFF;
+        } while (--e->pending != 0);
+        e->cache = (e->low >> 24) & 0xFF;
+    }
+    e->pending++;
+    e->low = (e->low & 0x00FFFFFF) << 8;
+}
+
+// Code one bit with an adaptive probability
+static void encodeBit(encoder *e, unsigned short *p, int bit) {
+    unsigned int bound = (e->range >> PROBBITS) * *p;
+    if (bit == 0) {
+        e->range = bound;
+        *p += ((1 << PROBBITS) - *p) >> ADAPT;
+    } else {
+        e->low += bound;
+        e->range -= bound;
+        *p -= *p >> ADAPT;
+    }
+    while (e->range < TOP) {
+        e->range <<= 8;
+        shiftLow(e);
+    }
+}
+
+// Code the lowest n bits of a value, each with probability one half
+static void encodeDirect(encoder *e, unsigned int value, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        e->range >>= 1;
+        if ((value >> i) & 1) e->low += e->range;
+        while (e->range < TOP) {
+            e->range <<= 8;
+            shiftLow(e);
+        }
+    }
+}
+
+// Code an n bit symbol with a tree of adaptive probabilities (most significant bit first)
+static void encodeTree(encoder *e, unsigned short *tree, unsigned int symbol, int n) {
+    unsigned int m = 1;
+    for (int i = n - 1; i >= 0; i--) {
+        int bit = (symbol >> i) & 1;
+        encodeBit(e, &tree[m], bit);
+        m = (m << 1) | bit;
+    }
+}
+
+// Read the next input byte of a decoder (zero past the end)
+static unsigned char next(decoder *d) {
+    if (d->pos >= d->n) return 0;
+    return d->in[d->pos++];
+}
+
+// Decode one bit with an adaptive probability
+static int decodeBit(decoder *d, unsigned short *p) {
+    unsigned int bound = (d->range >> PROBBITS) * *p;
+    int bit;
+    if (d->code < bound) {
+        d->range = bound;
+        *p += ((1 << PROBBITS) - *p) >> ADAPT;
+        bit = 0;
+    } else {
+        d->code -= bound;
+        d->range -= bound;
+        *p -= *p >> ADAPT;
+        bit = 1;
+    }
+    while (d->range < TOP) {
+        d->range <<= 8;
+        d->code = (d->code << 8) | next(d);
+    }
+    return bit;
+}
+
+// Decode n bits coded with probability one half
+static unsigned int decodeDirect(decoder *d, int n) {
+    unsigned int value = 0;
+    for (int i = 0; i < n; i++) {
+        d->range >>= 1;
+        int bit = d->code >= d->range;
+        if (bit) d->code -= d->range;
+        value = (value << 1) | bit;
+        while (d->range < TOP) {
+            d->range <<= 8;
+            d->code = (d->code << 8) | next(d);
+        }
+    }
+    return value;
+}
+
+// Decode an n bit symbol coded with encodeTree
+static unsigned int decodeTree(decoder *d, unsigned short *tree, int n) {
+    unsigned int m = 1;
+    for (int i = 0; i < n; i++) m = (m << 1) | decodeBit(d, &tree[m]);
+    return m - (1u << n);
+}
+
+// Number of bits needed for a value (at least 1)
+static int bitCount(unsigned int value) {
+    int n = 1;
+    while (value >> n) n++;
+    return n;
+}
+
+// Code a match distance (at least 1) as its bit count followed by the bits below the leading one
+static void encodeDistance(encoder *e, model *m, unsigned int distance) {
+    int n = bitCount(distance);
+    encodeTree(e, m->slot, n - 1, 5);
+    encodeDirect(e, distance, n - 1);
+}
+
+// Decode a match distance coded with encodeDistance
+static unsigned int decodeDistance(decoder *d, model *m) {
+    int n = decodeTree(d, m->slot, 5) + 1;
+    return (1u << (n - 1)) | decodeDirect(d, n - 1);
+}
+
+// Hash of the three commands starting at a position
+static unsigned int hash3(unsigned char *b) {
+    return ((b[0] << 16 | b[1] << 8 | b[2]) * 2654435761u) >> (32 - HASHBITS);
+}
+
+// Length of the common prefix of two positions, up to limit
+static int matchLength(unsigned char *a, unsigned char *b, int limit) {
+    int n = 0;
+    while (n < limit && a[n] == b[n]) n++;
+    return n;
+}
+
+// Compress n commands into a newly allocated array, storing its length in packedSize
+static unsigned char *packChunk(unsigned char *raw, long n, long *packedSize) {
+    encoder e = {0, 0xFFFFFFFF, 0, 1, NULL, 0, 0};
+    model *m = malloc(sizeof(model));
+    resetModel(m);
+    int *head = malloc(sizeof(int) * (1 << HASHBITS));
+    int *prev = malloc(sizeof(int) * (n + 1));
+    for (int i = 0; i < (1 << HASHBITS); i++) head[i] = -1;
+    long pos = 0, rep = 0;
+    int last = 0;
+    while (pos < n) {
+        int limit = n - pos < MAXMATCH ? n - pos : MAXMATCH;
+        // Repeat of the last distance, worth it from 2 commands
+        int repLimit = limit < MAXMATCH - 1 ? limit : MAXMATCH - 1;
+        int repLength = rep > 0 && pos >= rep ? matchLength(raw + pos, raw + pos - rep, repLimit) : 0;
+        // Longest match reachable through the hash chain
+        int bestLength = 0;
+        long bestDistance = 0;
+        if (limit >= MINMATCH) {
+            unsigned int h = hash3(raw + pos);
+            int candidate = head[h];
+            for (int steps = 0; candidate >= 0 && steps < CHAIN; steps++) {
+                int length = matchLength(raw + pos, raw + candidate, limit);
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = pos - candidate;
+                }
+                candidate = prev[candidate];
+            }
+        }
+        int length = 1;
+        if (repLength >= 2 && repLength + 1 >= bestLength) {
+            encodeBit(&e, &m->isMatch[last], 1);
+            encodeBit(&e, &m->isRep[last], 1);
+            encodeTree(&e, m->length[1], repLength - 2, 8);
+            length = repLength;
+            last = 1;
+        } else if (bestLength >= MINMATCH) {
+            encodeBit(&e, &m->isMatch[last], 1);
+            encodeBit(&e, &m->isRep[last], 0);
+            encodeTree(&e, m->length[0], bestLength - MINMATCH, 8);
+            encodeDistance(&e, m, bestDistance);
+            rep = bestDistance;
+            length = bestLength;
+            last = 1;
+        } else {
+            encodeBit(&e, &m->isMatch[last], 0);
+            encodeTree(&e, m->literal[pos > 0 ? raw[pos - 1] >> 6 : 0], raw[pos], 8);
+            last = 0;
+        }
+        // Insert every covered position into the hash chains
+        for (int i = 0; i < length; i++, pos++) {
+            if (n - pos >= MINMATCH) {
+                unsigned int h = hash3(raw + pos);
+                prev[pos] = head[h];
+                head[h] = pos;
+            }
+        }
+    }
+    for (int i = 0; i < 5; i++) shiftLow(&e);
+    free(head);
+    free(prev);
+    free(m);
+    *packedSize = e.n;
+    return e.out;
+}
+
+// Decompress a chunk of n commands into raw
+static void unpackChunk(unsigned char *packed, long size, unsigned char *raw, long n) {
+    decoder d = {0xFFFFFFFF, 0, packed, size, 0};
+    for (int i = 0; i < 5; i++) d.code = (d.code << 8) | next(&d);
+    model *m = malloc(sizeof(model));
+    resetModel(m);
+    long pos = 0, rep = 0;
+    int last = 0;
+    while (pos < n) {
+        if (decodeBit(&d, &m->isMatch[last]) == 0) {
+            raw[pos] = decodeTree(&d, m->literal[pos > 0 ? raw[pos - 1] >> 6 : 0], 8);
+            pos++;
+            last = 0;
+            continue;
+        }
+        long length;
+        if (decodeBit(&d, &m->isRep[last]) == 1) length = decodeTree(&d, m->length[1], 8) + 2;
+        else {
+            length = decodeTree(&d, m->length[0], 8) + MINMATCH;
+            rep = decodeDistance(&d, m);
+        }
+        last = 1;
+        // Corrupt input must not read before the chunk or write past its end
+        if (rep > pos) rep = pos;
+        if (length > n - pos) length = n - pos;
+        for (long i = 0; i < length; i++, pos++) raw[pos] = rep > 0 ? raw[pos - rep] : 0;
+    }
+    free(m);
+}
+
+// Write a 32bit little endian number
+static void putInt(FILE *file, unsigned int value) {
+    for (int i = 0; i < 4; i++) fputc((value >> (8 * i)) & 0xFF, file);
+}
+
+// Read a 32bit little endian number
+static unsigned int getInt(FILE *file) {
+    unsigned int value = 0;
+    for (int i = 0; i < 4; i++) value |= (unsigned int) (fgetc(file) & 0xFF) << (8 * i);
+    return value;
+}
+
+// Compress n sketch commands into a container file. Returns false if the file cannot be written.
+bool packSkz(unsigned char *commands, long n, char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) return false;
+    // Split into chunks of whole frames
+    int count = 0, capacity = 16, frames = 0;
+    chunk *chunks = malloc(sizeof(chunk) * capacity);
+    long start = 0;
+    while (start < n || count == 0) {
+        long end = start;
+        int inChunk = 0;
+        while (end < n && (end - start < CHUNK || inChunk == 0)) {
+            while (end < n && commands[end] != NEXTFRAMEBYTE) end++;
+            if (end < n) end++;
+            inChunk++;
+        }
+        // A sketch ending with NEXTFRAME plays one more (empty) frame at the end
+        if (end == n && (n == 0 || commands[n - 1] == NEXTFRAMEBYTE)) inChunk++;
+        if (count == capacity) {
+            capacity = capacity * 2;
+            chunks = realloc(chunks, sizeof(chunk) * capacity);
+        }
+        chunks[count] = (chunk) {frames, inChunk, start, end - start, 0, 0};
+        frames += inChunk;
+        count++;
+        start = end;
+    }
+    // Header and index (written again below once the packed sizes are known)
+    long offset = HEADER + ENTRY * count;
+    fseek(file, offset, SEEK_SET);
+    for (int i = 0; i < count; i++) {
+        long size;
+        unsigned char *packed = packChunk(commands + chunks[i].rawOffset, chunks[i].rawSize, &size);
+        fwrite(packed, 1, size, file);
+        free(packed);
+        chunks[i].offset = offset;
+        chunks[i].size = size;
+        offset += size;
+    }
+    fseek(file, 0, SEEK_SET);
+    fwrite("SKZ1", 1, 4, file);
+    putInt(file, count);
+    putInt(file, frames);
+    putInt(file, n);
+    for (int i = 0; i < count; i++) {
+        putInt(file, chunks[i].first);
+        putInt(file, chunks[i].frames);
+        putInt(file, chunks[i].rawOffset);
+        putInt(file, chunks[i].rawSize);
+        putInt(file, chunks[i].offset);
+        putInt(file, chunks[i].size);
+    }
+    free(chunks);
+    return fclose(file) == 0;
+}
+
+// Check that the index describes the file: chunks of frames and commands following each
+// other up to the recorded totals, packed inside the file after the index
+static bool validIndex(skz *z, long fileSize) {
+    long length = 0, frames = 0;
+    for (int i = 0; i < z->count; i++) {
+        chunk *c = &z->chunks[i];
+        if (c->first != frames || c->rawOffset != length) return false;
+        if (c->offset < HEADER + (long) ENTRY * z->count || (long) c->offset + c->size > fileSize) return false;
+        frames += c->frames;
+        length += c->rawSize;
+    }
+    return frames == z->frames && length == z->length;
+}
+
+// Open a container and read its index, returns NULL if the file is not a valid container.
+skz *openSkz(char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+    char magic[4];
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, "SKZ1", 4) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    unsigned int count = getInt(file);
+    if (count == 0 || HEADER + (long) ENTRY * count > fileSize) {
+        fclose(file);
+        return NULL;
+    }
+    skz *z = malloc(sizeof(skz));
+    z->file = file;
+    z->count = count;
+    z->frames = getInt(file);
+    z->length = getInt(file);
+    z->chunks = malloc(sizeof(chunk) * z->count);
+    for (int i = 0; i < z->count; i++) {
+        chunk *c = &z->chunks[i];
+        c->first = getInt(file);
+        c->frames = getInt(file);
+        c->rawOffset = getInt(file);
+        c->rawSize = getInt(file);
+        c->offset = getInt(file);
+        c->size = getInt(file);
+    }
+    z->loaded = -1;
+    z->raw = NULL;
+    if (feof(file) || !validIndex(z, fileSize)) {
+        closeSkz(z);
+        return NULL;
+    }
+    return z;
+}
+
+// Close a container.
+void closeSkz(skz *z) {
+    fclose(z->file);
+    free(z->chunks);
+    free(z->raw);
+    free(z);
+}
+
+// Number of commands in the original sketch.
+long skzSize(skz *z) {
+    return z->length;
+}
+
+// Number of frames in the sketch.
+int skzFrames(skz *z) {
+    return z->frames;
+}
+
+// Decompress chunk i unless it is the chunk decompressed last
+static void loadChunk(skz *z, int i) {
+    if (z->loaded == i) return;
+    chunk *c = &z->chunks[i];
+    unsigned char *packed = malloc(c->size > 0 ? c->size : 1);
+    fseek(z->file, c->offset, SEEK_SET);
+    long size = fread(packed, 1, c->size, z->file);
+    free(z->raw);
+    z->raw = malloc(c->rawSize > 0 ? c->rawSize : 1);
+    unpackChunk(packed, size, z->raw, c->rawSize);
+    free(packed);
+    z->loaded = i;
+}
+
+// Index of the chunk holding position start of the command stream (binary search)
+static int findChunk(skz *z, long start) {
+    int low = 0, high = z->count - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (z->chunks[middle].rawOffset <= start) low = middle;
+        else high = middle - 1;
+    }
+    return low;
+}
+
+// Position in the original command stream at which frame number f starts.
+long skzFrameStart(skz *z, int f) {
+    int i = 0;
+    while (i < z->count - 1 && z->chunks[i + 1].first <= (unsigned int) f) i++;
+    loadChunk(z, i);
+    chunk *c = &z->chunks[i];
+    long pos = 0;
+    for (unsigned int k = c->first; k < (unsigned int) f && pos < c->rawSize; k++) {
+        while (pos < c->rawSize && z->raw[pos] != NEXTFRAMEBYTE) pos++;
+        pos++;
+    }
+    if (pos > c->rawSize) pos = c->rawSize;
+    return c->rawOffset + pos;
+}
+
+// Copy the commands of the frame starting at position start of the original command
+// stream (up to and including NEXTFRAME) into a newly allocated array and return their number.
+int readSkzFrame(skz *z, long start, unsigned char **bytes) {
+    int i = findChunk(z, start);
+    loadChunk(z, i);
+    chunk *c = &z->chunks[i];
+    long from = start - c->rawOffset, to = from;
+    if (from < 0 || from > c->rawSize) from = to = c->rawSize;
+    while (to < c->rawSize && z->raw[to] != NEXTFRAMEBYTE) to++;
+    if (to < c->rawSize) to++;
+    *bytes = malloc(to - from + 1);
+    memcpy(*bytes, z->raw + from, to - from);
+    return to - from;
+}
+
+// Decompress a whole container into a newly allocated array, storing its length in n.
+unsigned char *unpackSkz(char *filename, long *n) {
+    skz *z = openSkz(filename);
+    if (z == NULL) return NULL;
+    *n = skzSize(z);
+    unsigned char *commands = malloc(*n + 1);
+    for (int i = 0; i < z->count; i++) {
+        loadChunk(z, i);
+        memcpy(commands + z->chunks[i].rawOffset, z->raw, z->chunks[i].rawSize);
+    }
+    closeSkz(z);
+    return commands;
+}
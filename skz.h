@@ -0,0 +1,47 @@
+// Compressed sketch container (.skz).
+// -----------------------------------------------------------------
+// The commands of a sketch file are split into chunks of whole frames (every chunk
+// ends with NEXTFRAME or the end of the sketch), and every chunk is compressed on its
+// own with LZ77 and an adaptive binary range coder. An index at the start of the file
+// gives, for every chunk, its first frame, its position in the original command stream
+// and its position in the container, so any frame can be decoded without the rest.
+//
+// Layout (all numbers are 32bit little endian):
+//   "SKZ1", chunk count, frame count, command count,
+//   per chunk: first frame, frames, raw offset, raw size, packed offset, packed size,
+//   the packed chunks.
+// The chunks follow each other without gaps, in frames and in commands, up to the counts
+// in the header, and are packed inside the file: containers whose index says otherwise
+// are not opened.
+
+// An open container, create it with openSkz and free it with closeSkz.
+struct skz;
+typedef struct skz skz;
+
+// Check if file name string is of .skz format
+bool isSkz(char *filename);
+
+// Compress n sketch commands into a container file. Returns false if the file cannot be written.
+bool packSkz(unsigned char *commands, long n, char *filename);
+
+// Open a container and read its index, returns NULL if the file is not a valid container.
+skz *openSkz(char *filename);
+
+// Close a container.
+void closeSkz(skz *z);
+
+// Number of commands in the original sketch.
+long skzSize(skz *z);
+
+// Number of frames in the sketch.
+int skzFrames(skz *z);
+
+// Position in the original command stream at which frame number f starts.
+long skzFrameStart(skz *z, int f);
+
+// Copy the commands of the frame starting at position start of the original command
+// stream (up to and including NEXTFRAME) into a newly allocated array and return their number.
+int readSkzFrame(skz *z, long start, unsigned char **bytes);
+
+// Decompress a whole container into a newly allocated array, storing its length in n.
+unsigned char *unpackSkz(char *filename, long *n);
@@ -0,0 +1,174 @@
+// Packs sketch files into compressed .skz containers (see skz.h) and unpacks them again.
+// Usage: ./skzip in.sk out.skz, ./skzip -d in.skz out.sk (without arguments the tests are run)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "skz.h"
+
+// Read a whole file into a newly allocated array, storing its length in n
+unsigned char *readFile(char *filename, long *n) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: cannot open %s\n", filename);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    *n = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *bytes = malloc(*n + 1);
+    *n = fread(bytes, 1, *n, file);
+    fclose(file);
+    return bytes;
+}
+
+// Size of a file in bytes
+long fileSize(char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+// A replacement for the library assert function.
+void assert(int line, bool b) {
+    if (b) return;
+    printf("The test on line %d fails.\n", line);
+    exit(1);
+}
+
+// Pack commands, unpack them again and check that nothing changed
+bool roundTrip(unsigned char *commands, long n) {
+    if (!packSkz(commands, n, "skzip.tmp")) return false;
+    long m;
+    unsigned char *unpacked = unpackSkz("skzip.tmp", &m);
+    bool same = unpacked != NULL && m == n && (n == 0 || memcmp(commands, unpacked, n) == 0);
+    free(unpacked);
+    return same;
+}
+
+// Test that the example sketch files and an empty sketch survive packing
+void testRoundTrip() {
+    char filename[12];
+    for (int i = 0; i < 10; i++) {
+        sprintf(filename, "sketch%02d.sk", i);
+        long n;
+        unsigned char *commands = readFile(filename, &n);
+        assert(__LINE__, roundTrip(commands, n));
+        free(commands);
+    }
+    assert(__LINE__, roundTrip(NULL, 0));
+    remove("skzip.tmp");
+}
+
+// Test a long animation spread over several chunks: sizes, frame starts and random frame access
+void testFrames() {
+    long n;
+    unsigned char *frame = readFile("sketch09.sk", &n);
+    int copies = 5000;
+    unsigned char *commands = malloc(n * copies + 1);
+    for (int i = 0; i < copies; i++) {
+        memcpy(commands + i * n, frame, n);
+        // Make every copy a little different: change the pause of its first frame
+        commands[i * n + 1] = 0xC0 + (i & 63);
+    }
+    commands[n * copies] = 0x88;
+    assert(__LINE__, roundTrip(commands, n * copies + 1));
+    skz *z = openSkz("skzip.tmp");
+    assert(__LINE__, z != NULL);
+    assert(__LINE__, skzSize(z) == n * copies + 1);
+    // sketch09 has 3 frames, the NEXTFRAME at the very end adds an empty one
+    assert(__LINE__, skzFrames(z) == 2 * copies + 2);
+    assert(__LINE__, fileSize("skzip.tmp") < n * copies / 10);
+    unsigned char *bytes;
+    long start = skzFrameStart(z, 2 * 1234 + 1);
+    assert(__LINE__, start == 1234 * n + 20);
+    int length = readSkzFrame(z, start, &bytes);
+    assert(__LINE__, length == 20 && memcmp(bytes, commands + start, length) == 0);
+    free(bytes);
+    length = readSkzFrame(z, n * copies + 1, &bytes);
+    assert(__LINE__, length == 0);
+    free(bytes);
+    closeSkz(z);
+    free(commands);
+    free(frame);
+    remove("skzip.tmp");
+}
+
+// Overwrite the 32bit little endian number at a position of a file
+void patch(char *filename, long position, unsigned int value) {
+    FILE *file = fopen(filename, "r+b");
+    fseek(file, position, SEEK_SET);
+    for (int i = 0; i < 4; i++) fputc((value >> (8 * i)) & 0xFF, file);
+    fclose(file);
+}
+
+// Test that containers whose index does not describe the file are rejected: chunks out
+// of place in the command stream, totals that do not add up, packed chunks past the end
+void testIndex() {
+    long n;
+    unsigned char *commands = readFile("sketch09.sk", &n);
+    // Header of 16 bytes, then 24 bytes per chunk: first frame, frames, raw offset,
+    // raw size, packed offset, packed size
+    long fields[][2] = {{24, 100000}, {28, 10}, {12, 1000}, {8, 7}, {32, 1000}, {36, 100000}, {4, 2}};
+    for (int i = 0; i < 7; i++) {
+        assert(__LINE__, packSkz(commands, n, "skzip.tmp"));
+        skz *z = openSkz("skzip.tmp");
+        assert(__LINE__, z != NULL);
+        closeSkz(z);
+        patch("skzip.tmp", fields[i][0], fields[i][1]);
+        assert(__LINE__, openSkz("skzip.tmp") == NULL);
+        long length;
+        assert(__LINE__, unpackSkz("skzip.tmp", &length) == NULL);
+    }
+    // A container cut short
+    assert(__LINE__, packSkz(commands, n, "skzip.tmp"));
+    long m;
+    unsigned char *packed = readFile("skzip.tmp", &m);
+    FILE *file = fopen("skzip.tmp", "wb");
+    fwrite(packed, 1, m - 1, file);
+    fclose(file);
+    assert(__LINE__, openSkz("skzip.tmp") == NULL);
+    free(packed);
+    free(commands);
+    remove("skzip.tmp");
+}
+
+// Run tests
+void test() {
+    testRoundTrip();
+    testFrames();
+    testIndex();
+    printf("All tests passed.\n");
+}
+
+int main(int n, char *args[n]) {
+    if (n == 1) test();
+    else if (n == 3) {
+        long size;
+        unsigned char *commands = readFile(args[1], &size);
+        if (!packSkz(commands, size, args[2])) {
+            fprintf(stderr, "Error: cannot write %s\n", args[2]);
+            exit(1);
+        }
+        printf("%s: %ld -> %ld bytes.\n", args[1], size, fileSize(args[2]));
+        free(commands);
+    } else if (n == 4 && strcmp(args[1], "-d") == 0) {
+        long size;
+        unsigned char *commands = unpackSkz(args[2], &size);
+        FILE *out = fopen(args[3], "wb");
+        if (commands == NULL || out == NULL) {
+            fprintf(stderr, "Error: cannot unpack %s into %s\n", args[2], args[3]);
+            exit(1);
+        }
+        fwrite(commands, 1, size, out);
+        fclose(out);
+        free(commands);
+    } else {
+        fprintf(stderr, "Usage: ./skzip in.sk out.skz or ./skzip -d in.skz out.sk\n");
+        exit(1);
+    }
+    return 0;
+}
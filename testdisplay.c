@@ -0,0 +1,22 @@
+// Display functions the testing framework (test.c) has no mocks for.
+// -----------------------------------------------------------------
+// test.c is used as shipped, so the display functions added since (frame capture,
+// viewports, kept canvases, frame numbers) are stubbed here and linked only into the
+// test program.
+// None of the tests reach them.
+#include "displayfull.h"
+
+void capture(display *d, unsigned int *pixels) {
+}
+
+void blit(display *d, unsigned int *pixels) {
+}
+
+void setViewport(display *d, int x, int y, int level) {
+}
+
+void keepCanvas(display *d, bool keep) {
+}
+
+void startFrame(display *d, long frame) {
+}
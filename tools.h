@@ -0,0 +1,6 @@
+// Tool types added to the sketch format since sketch.h, which is not to be changed.
+// -----------------------------------------------------------------
+
+// KEEP with a data value other than 0 keeps the canvas from one show to the next instead
+// of clearing it, KEEP with 0 clears it again (does not change the tool)
+enum { KEEP = 9 };
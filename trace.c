@@ -0,0 +1,57 @@
+// Timeline tracing, see trace.h for how to use it.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "trace.h"
+
+bool tracing = false;
+long tracedPixels = 0;
+
+// The trace file
+static FILE *traceFile = NULL;
+
+// Microseconds on a monotonic clock
+static long microseconds() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000L + t.tv_nsec / 1000;
+}
+
+// Close the trace file and switch tracing off, otherwise done at exit.
+void endTrace() {
+    if (traceFile == NULL) return;
+    fprintf(traceFile, "\n]\n");
+    fclose(traceFile);
+    traceFile = NULL;
+    tracing = false;
+}
+
+// Switch tracing on if SKETCH_TRACE is set, naming the process in the trace.
+void startTrace(char *process) {
+    char *filename = getenv("SKETCH_TRACE");
+    if (filename == NULL || tracing) return;
+    traceFile = fopen(filename, "w");
+    if (traceFile == NULL) {
+        fprintf(stderr, "Error: cannot write trace %s\n", filename);
+        return;
+    }
+    // Every event after this naming one starts with a comma
+    fprintf(traceFile, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"%s\"}}", process);
+    tracing = true;
+    atexit(endTrace);
+}
+
+// Time in microseconds to pass to traceSpan as the beginning of a span, 0 if tracing is off.
+long traceClock() {
+    if (!tracing) return 0;
+    return microseconds();
+}
+
+// Write a span from begin (given by traceClock) until now.
+void traceSpan(char *name, long begin, long commands, long pixels) {
+    if (!tracing) return;
+    fprintf(traceFile, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%ld,\"dur\":%ld,"
+            "\"args\":{\"commands\":%ld,\"pixels\":%ld}}", name, begin, microseconds() - begin, commands, pixels);
+}
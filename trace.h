@@ -0,0 +1,24 @@
+// Timeline tracing in the Chrome trace event format.
+// -----------------------------------------------------------------
+// Programs that call startTrace write a span for every timed step (reading a file,
+// playing a frame, drawing, presenting, sleeping) into the file named by the SKETCH_TRACE
+// environment variable, to be loaded into chrome://tracing or ui.perfetto.dev. Every
+// span carries the number of commands and of pixels it dealt with. Spans of a frame's
+// drawing, presenting and sleeping lie inside the span of the frame. When SKETCH_TRACE
+// is not set tracing is off, and traceClock returns 0 and traceSpan nothing at once.
+
+// Whether tracing is on, and the number of pixels drawn so far (counted by the display while tracing)
+extern bool tracing;
+extern long tracedPixels;
+
+// Switch tracing on if SKETCH_TRACE is set, naming the process in the trace.
+void startTrace(char *process);
+
+// Close the trace file and switch tracing off, otherwise done at exit.
+void endTrace();
+
+// Time in microseconds to pass to traceSpan as the beginning of a span, 0 if tracing is off.
+long traceClock();
+
+// Write a span from begin (given by traceClock) until now.
+void traceSpan(char *name, long begin, long commands, long pixels);
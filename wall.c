@@ -0,0 +1,284 @@
+// Sketch wall, see wall.h for how to use it.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include "displayfull.h"
+#include "backend.h"
+#include "sketch.h"
+#include "scan.h"
+#include "skz.h"
+#include "wall.h"
+
+// Size of a tile in pixels
+#define SIZE 200
+
+// Time a show takes in the viewer, and time between checks of a static tile's file
+#define SHOW_TIME 10
+#define IDLE_CHECK 1000
+
+// A sketch file played on a tile: the commands of the current pass, the drawing state,
+// the display drawn on (of the cpu backend) and the image last shown, when it has to be
+// advanced next, and the shows and pauses of the current pass (to spot static sketches)
+typedef struct tile {
+    char *filename;
+    byte *bytes;
+    long n, position;
+    state s;
+    display *d;
+    unsigned int *shown;
+    long wake;
+    int shows, pauses;
+    bool still, changed;
+} tile;
+
+struct wall {
+    int count, columns, rows;
+    tile *tiles;
+    unsigned int *pixels;
+    // Work handed to the workers: the tiles due at time now, the next one to take and
+    // the number finished, for the round of work with the given number
+    pthread_mutex_t lock;
+    pthread_cond_t start, finished;
+    int *due, dueCount, next, done;
+    long now, round;
+    bool stop;
+    int threads;
+    pthread_t *workers;
+};
+
+// Milliseconds on a monotonic clock
+static long milliseconds() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000L + t.tv_nsec / 1000000;
+}
+
+// Read a whole sketch (or .skz) file into a newly allocated array, returns NULL if it cannot be read
+static byte *readSketch(char *filename, long *n) {
+    if (isSkz(filename)) return unpackSkz(filename, n);
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    *n = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    byte *bytes = malloc(*n + 1);
+    *n = fread(bytes, 1, *n, file);
+    fclose(file);
+    return bytes;
+}
+
+// Reset the drawing state at the start of a frame
+static void resetTile(tile *t) {
+    t->s = (state) {0, 0, 0, 0, LINE, 0, 0, false};
+}
+
+// Note that a tile has shown the image captured from its display before the show
+static void presented(tile *t, long now) {
+    t->changed = true;
+    t->shows++;
+    t->wake = now + SHOW_TIME;
+}
+
+// Start a new pass over a tile's file, reading it again in case it changed.
+// Returns false if the tile is static and its file is unchanged, so nothing needs drawing.
+static bool startPass(tile *t, long now) {
+    long n;
+    byte *bytes = readSketch(t->filename, &n);
+    if (bytes != NULL) {
+        bool same = (n == t->n && memcmp(bytes, t->bytes, n) == 0);
+        free(t->bytes);
+        t->bytes = bytes;
+        t->n = n;
+        if (same && t->still) {
+            t->wake = now + IDLE_CHECK;
+            return false;
+        }
+    }
+    t->shows = t->pauses = 0;
+    return true;
+}
+
+// Finish a pass over a tile's file, a pass showing one image without pausing is static
+static void endPass(tile *t, long now) {
+    t->position = 0;
+    resetTile(t);
+    t->still = (t->shows == 1 && t->pauses == 0);
+    if (t->still) t->wake = now + IDLE_CHECK;
+}
+
+// Obey the commands of a tile's file on the tile's display up to the next show or pause,
+// which decides when the tile is due again. Like the viewer's frame cache, the display is
+// captured before every show, as showing starts the next image.
+static void advanceTile(tile *t, long now) {
+    if (t->position == 0 && !startPass(t, now)) return;
+    while (t->position < t->n) {
+        byte op = t->bytes[t->position++];
+        int tool = getOpcode(op) == TOOL ? getOperand(op) : NONE;
+        unsigned int data = t->s.data;
+        if (tool == SHOW || tool == NEXTFRAME) capture(t->d, t->shown);
+        obey(t->d, &t->s, op);
+        if (tool == SHOW || tool == NEXTFRAME) {
+            presented(t, now);
+            if (tool == NEXTFRAME) resetTile(t);
+            return;
+        }
+        if (tool == PAUSE) {
+            t->pauses++;
+            t->wake = now + data;
+            return;
+        }
+    }
+    // The end of the file shows the last frame and starts the next pass
+    capture(t->d, t->shown);
+    show(t->d);
+    presented(t, now);
+    endPass(t, now);
+}
+
+// Worker thread: advance due tiles until the wall is stopped
+static void *work(void *data) {
+    wall *w = (wall*) data;
+    long seen = 0;
+    pthread_mutex_lock(&w->lock);
+    while (true) {
+        while (!w->stop && w->round == seen) pthread_cond_wait(&w->start, &w->lock);
+        if (w->stop) break;
+        seen = w->round;
+        while (w->next < w->dueCount) {
+            tile *t = &w->tiles[w->due[w->next++]];
+            pthread_mutex_unlock(&w->lock);
+            advanceTile(t, w->now);
+            pthread_mutex_lock(&w->lock);
+            w->done++;
+            if (w->done == w->dueCount) pthread_cond_signal(&w->finished);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// Create a wall for n sketch (or .skz) files, played by the given number of worker
+// threads (0 for one per processor). Exits with an error if a file cannot be read.
+wall *newWall(int n, char *filenames[n], int threads) {
+    wall *w = malloc(sizeof(wall));
+    w->count = n;
+    w->columns = 1;
+    while (w->columns * w->columns < n) w->columns++;
+    w->rows = (n + w->columns - 1) / w->columns;
+    w->tiles = calloc(n, sizeof(tile));
+    w->pixels = malloc(sizeof(unsigned int) * w->columns * SIZE * w->rows * SIZE);
+    for (int i = 0; i < w->columns * SIZE * w->rows * SIZE; i++) w->pixels[i] = 0xFF;
+    for (int i = 0; i < n; i++) {
+        tile *t = &w->tiles[i];
+        t->filename = filenames[i];
+        t->bytes = readSketch(t->filename, &t->n);
+        if (t->bytes == NULL) {
+            fprintf(stderr, "Error: cannot read %s\n", t->filename);
+            exit(1);
+        }
+        resetTile(t);
+        t->d = openDisplay(&cpuBackend, t->filename, SIZE, SIZE);
+        t->shown = malloc(sizeof(unsigned int) * SIZE * SIZE);
+    }
+    if (threads <= 0) threads = processors();
+    if (threads > n) threads = n;
+    if (threads < 1) threads = 1;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->start, NULL);
+    pthread_cond_init(&w->finished, NULL);
+    w->due = malloc(sizeof(int) * n);
+    w->dueCount = w->next = w->done = 0;
+    w->now = w->round = 0;
+    w->stop = false;
+    w->threads = threads;
+    w->workers = malloc(sizeof(pthread_t) * threads);
+    for (int i = 0; i < threads; i++) pthread_create(&w->workers[i], NULL, work, w);
+    return w;
+}
+
+// Stop the workers and release the wall.
+void freeWall(wall *w) {
+    pthread_mutex_lock(&w->lock);
+    w->stop = true;
+    pthread_cond_broadcast(&w->start);
+    pthread_mutex_unlock(&w->lock);
+    for (int i = 0; i < w->threads; i++) pthread_join(w->workers[i], NULL);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->start);
+    pthread_cond_destroy(&w->finished);
+    for (int i = 0; i < w->count; i++) {
+        free(w->tiles[i].bytes);
+        freeDisplay(w->tiles[i].d);
+        free(w->tiles[i].shown);
+    }
+    free(w->tiles);
+    free(w->pixels);
+    free(w->due);
+    free(w->workers);
+    free(w);
+}
+
+// Width of the image of the whole wall in pixels.
+int wallWidth(wall *w) {
+    return w->columns * SIZE;
+}
+
+// Height of the image of the whole wall in pixels.
+int wallHeight(wall *w) {
+    return w->rows * SIZE;
+}
+
+// The image of the whole wall, packed rgba ints row by row.
+unsigned int *wallPixels(wall *w) {
+    return w->pixels;
+}
+
+// Copy the image shown by tile i into its place in the image of the wall
+static void compose(wall *w, int i) {
+    int width = wallWidth(w);
+    unsigned int *to = w->pixels + (i / w->columns) * SIZE * width + (i % w->columns) * SIZE;
+    for (int y = 0; y < SIZE; y++) {
+        memcpy(to + y * width, w->tiles[i].shown + y * SIZE, sizeof(unsigned int) * SIZE);
+    }
+}
+
+// Advance every tile that is due, returns true if the image of the wall changed.
+bool stepWall(wall *w) {
+    long now = milliseconds();
+    int count = 0;
+    for (int i = 0; i < w->count; i++) {
+        if (w->tiles[i].wake <= now) w->due[count++] = i;
+    }
+    if (count == 0) return false;
+    pthread_mutex_lock(&w->lock);
+    w->now = now;
+    w->dueCount = count;
+    w->next = w->done = 0;
+    w->round++;
+    pthread_cond_broadcast(&w->start);
+    while (w->done < w->dueCount) pthread_cond_wait(&w->finished, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+    bool changed = false;
+    for (int i = 0; i < count; i++) {
+        tile *t = &w->tiles[w->due[i]];
+        if (!t->changed) continue;
+        compose(w, w->due[i]);
+        t->changed = false;
+        changed = true;
+    }
+    return changed;
+}
+
+// Milliseconds from now until the next tile is due.
+int wallWait(wall *w) {
+    long now = milliseconds();
+    long wait = IDLE_CHECK;
+    for (int i = 0; i < w->count; i++) {
+        if (w->tiles[i].wake - now < wait) wait = w->tiles[i].wake - now;
+    }
+    return wait < 0 ? 0 : wait;
+}
@@ -0,0 +1,32 @@
+// Sketch wall: many sketch files played side by side as a grid of 200x200 tiles.
+// -----------------------------------------------------------------
+// Every tile obeys its sketch file on its own software display (of the cpu backend), and
+// the tiles that are due are advanced by a shared pool of worker threads, each up to its
+// next show or pause. The images the tiles show are composed into one image of the whole wall, so a
+// single window presents all of them.
+// A tile whose sketch shows a single image without pausing is static: it is only drawn
+// again once its file has changed (checked every second).
+
+// A wall object, create it with newWall and free it with freeWall.
+struct wall;
+typedef struct wall wall;
+
+// Create a wall for n sketch (or .skz) files, played by the given number of worker
+// threads (0 for one per processor). Exits with an error if a file cannot be read.
+wall *newWall(int n, char *filenames[n], int threads);
+
+// Stop the workers and release the wall.
+void freeWall(wall *w);
+
+// Width and height of the image of the whole wall in pixels.
+int wallWidth(wall *w);
+int wallHeight(wall *w);
+
+// The image of the whole wall, packed rgba ints row by row.
+unsigned int *wallPixels(wall *w);
+
+// Advance every tile that is due, returns true if the image of the wall changed.
+bool stepWall(wall *w);
+
+// Milliseconds from now until the next tile is due.
+int wallWait(wall *w);